@@ -9,6 +9,8 @@
 #include <opencv2/highgui.hpp>
 #include <iostream>
 
+#include "preprocess.hpp"
+
 
 using namespace std;
 using namespace cv;
@@ -17,13 +19,12 @@ int main()
 {
   string path = "./Resources/shapes.png";
   Mat img = imread(path);
-  Mat gray, blur, canny, dilated, eroded, resized, scaled, cropped;
+  Mat eroded, resized, scaled, cropped;
   Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
 
-  cvtColor(img, gray, COLOR_BGR2GRAY);      // rgb to grayscale
-  GaussianBlur(gray, blur, Size(3, 3), 3);   // blur
-  Canny(blur, canny, 25, 75);                // edge detection
-  dilate(canny, dilated, kernel);           // dilation
+  // rgb to grayscale, blur, edge detection and dilation in one pass
+  Preprocessor preprocessor;
+  const Mat& dilated = preprocessor.run(img);
   erode(dilated, eroded, kernel);           // erosion
 
   resize(img, resized, Size(320, 320));
@@ -35,9 +36,9 @@ int main()
 
   // Display images
   imshow("image", img);
-  imshow("Gray", gray);
-  imshow("Blur", blur);
-  imshow("Edge", canny);
+  imshow("Gray", preprocessor.gray());
+  imshow("Blur", preprocessor.blurred());
+  imshow("Edge", preprocessor.edges());
   imshow("Edge Dilate", dilated);
   imshow("Edge Erode", eroded);
 
@@ -0,0 +1,540 @@
+/**
+ * @file bench.cpp
+ * @brief Micro-benchmarks of every processing stage on the bundled Resources.
+ *      Each stage runs in isolation and reports mean, p50 and p99 latency, throughput
+ *      and allocations per call.
+ *      Usage:
+ *      cv_bench [--iterations N] [--format table|csv|json] [--output file]
+ *               [--filter text] [--resources dir] [--video-frames N] [--replay file]
+ *      --replay takes the video frames from a recording made with cv_read --record,
+ *      so runs see identical input without decoding test_video.mp4.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+
+#include "doc_detection.hpp"
+#include "frame_record.hpp"
+#include "face_detector.hpp"
+#include "face_tracker.hpp"
+#include "hsv_tuner.hpp"
+#include "marker_classifier.hpp"
+#include "multi_cascade.hpp"
+#include "overlay.hpp"
+#include "paint.hpp"
+#include "preprocess.hpp"
+#include "shape_detection.hpp"
+#include "static_pipeline.hpp"
+#include "tiled_contours.hpp"
+#include "warp_engine.hpp"
+
+using namespace std;
+using namespace cv;
+
+// Allocation accounting: heap allocations through operator new and Mat buffers
+static atomic<uint64_t> heap_allocs{0};
+static atomic<uint64_t> heap_bytes{0};
+static atomic<uint64_t> mat_allocs{0};
+static atomic<uint64_t> mat_bytes{0};
+
+void* operator new(size_t size)
+{
+  heap_allocs++;
+  heap_bytes += size;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+/**
+ * @brief CountingMatAllocator counts Mat buffer allocations and hands them to the
+ *        standard allocator, which also frees them
+ */
+class CountingMatAllocator : public MatAllocator
+{
+public:
+  UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usage) const override
+  {
+    if ( !data ) {
+      size_t bytes = CV_ELEM_SIZE(type);
+      for (int i = 0; i < dims; i++)
+        bytes *= sizes[i];
+      mat_allocs++;
+      mat_bytes += bytes;
+    }
+    return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+  }
+
+  bool allocate(UMatData* data, AccessFlag flags, UMatUsageFlags usage) const override
+  {
+    return Mat::getStdAllocator()->allocate(data, flags, usage);
+  }
+
+  void deallocate(UMatData* data) const override
+  {
+    Mat::getStdAllocator()->deallocate(data);
+  }
+};
+
+struct Stage {
+  string name;
+  string input;
+  double pixels;
+  function<void()> prepare;     // untimed, runs before every call
+  function<void()> run;
+};
+
+struct StageResult {
+  string name;
+  string input;
+  int iterations;
+  double mean_us, p50_us, p99_us;
+  double calls_per_s;
+  double mpix_per_s;
+  double allocs_per_call;
+  double bytes_per_call;
+};
+
+/**
+ * @brief matchedBoxes count the reference boxes a found box overlaps by at least half
+ *        of their union
+ */
+int matchedBoxes(const vector<Rect>& reference, const vector<Rect>& found)
+{
+  int matched = 0;
+  for (const Rect& r : reference) {
+    for (const Rect& f : found) {
+      double overlap = (r & f).area();
+      if (overlap >= 0.5 * (r.area() + f.area() - overlap)) {
+        matched++;
+        break;
+      }
+    }
+  }
+  return matched;
+}
+
+double percentile(const vector<double>& sorted, double q)
+{
+  size_t index = (size_t)ceil(q * sorted.size());
+  return sorted[min(sorted.size() - 1, index > 0 ? index - 1 : 0)];
+}
+
+StageResult runStage(const Stage& stage, int iterations)
+{
+  const int warmup = 2;
+  vector<double> times;
+  uint64_t allocs = 0, bytes = 0;
+
+  for (int i = 0; i < warmup + iterations; i++) {
+    if (stage.prepare)
+      stage.prepare();
+
+    uint64_t allocs_before = heap_allocs + mat_allocs;
+    uint64_t bytes_before = heap_bytes + mat_bytes;
+    auto start = chrono::steady_clock::now();
+
+    stage.run();
+
+    auto end = chrono::steady_clock::now();
+    if (i < warmup)
+      continue;
+
+    times.push_back(chrono::duration<double, micro>(end - start).count());
+    allocs += heap_allocs + mat_allocs - allocs_before;
+    bytes += heap_bytes + mat_bytes - bytes_before;
+  }
+
+  double total = 0;
+  for (double t : times)
+    total += t;
+  sort(times.begin(), times.end());
+
+  StageResult result;
+  result.name = stage.name;
+  result.input = stage.input;
+  result.iterations = iterations;
+  result.mean_us = total / iterations;
+  result.p50_us = percentile(times, 0.5);
+  result.p99_us = percentile(times, 0.99);
+  result.calls_per_s = 1e6 / result.mean_us;
+  result.mpix_per_s = stage.pixels / result.mean_us;
+  result.allocs_per_call = allocs / (double)iterations;
+  result.bytes_per_call = bytes / (double)iterations;
+
+  return result;
+}
+
+void printTable(ostream& out, const vector<StageResult>& results)
+{
+  out << left << setw(24) << "stage" << setw(18) << "input"
+      << right << setw(12) << "mean_us" << setw(12) << "p50_us" << setw(12) << "p99_us"
+      << setw(12) << "calls/s" << setw(10) << "MP/s" << setw(10) << "allocs" << setw(14) << "bytes" << endl;
+
+  out << fixed << setprecision(1);
+  for (const StageResult& r : results) {
+    out << left << setw(24) << r.name << setw(18) << r.input
+        << right << setw(12) << r.mean_us << setw(12) << r.p50_us << setw(12) << r.p99_us
+        << setw(12) << r.calls_per_s << setw(10) << r.mpix_per_s << setw(10) << r.allocs_per_call
+        << setw(14) << r.bytes_per_call << endl;
+  }
+}
+
+void printCsv(ostream& out, const vector<StageResult>& results)
+{
+  out << "stage,input,iterations,mean_us,p50_us,p99_us,calls_per_s,mpix_per_s,allocs_per_call,bytes_per_call" << endl;
+  for (const StageResult& r : results) {
+    out << r.name << "," << r.input << "," << r.iterations << ","
+        << r.mean_us << "," << r.p50_us << "," << r.p99_us << ","
+        << r.calls_per_s << "," << r.mpix_per_s << ","
+        << r.allocs_per_call << "," << r.bytes_per_call << endl;
+  }
+}
+
+void printJson(ostream& out, const vector<StageResult>& results)
+{
+  out << "{" << endl;
+  out << "  \"opencv\": \"" << CV_VERSION << "\"," << endl;
+  out << "  \"simd\": \"" << Preprocessor::simdPath() << "\"," << endl;
+  out << "  \"threads\": " << getNumThreads() << "," << endl;
+  out << "  \"stages\": [" << endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    const StageResult& r = results[i];
+    out << "    {\"stage\": \"" << r.name << "\", \"input\": \"" << r.input << "\""
+        << ", \"iterations\": " << r.iterations
+        << ", \"mean_us\": " << r.mean_us << ", \"p50_us\": " << r.p50_us << ", \"p99_us\": " << r.p99_us
+        << ", \"calls_per_s\": " << r.calls_per_s << ", \"mpix_per_s\": " << r.mpix_per_s
+        << ", \"allocs_per_call\": " << r.allocs_per_call << ", \"bytes_per_call\": " << r.bytes_per_call << "}"
+        << (i + 1 < results.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl;
+  out << "}" << endl;
+}
+
+int main(int argc, char** argv)
+{
+  int iterations = 50;
+  int video_frames = 30;
+  string format = "table";
+  string output_path;
+  string filter;
+  string resources = "./Resources";
+  string replay_path;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--iterations" && has_value) iterations = max(1, atoi(argv[++i]));
+    else if (arg == "--video-frames" && has_value) video_frames = max(1, atoi(argv[++i]));
+    else if (arg == "--format" && has_value) format = argv[++i];
+    else if (arg == "--output" && has_value) output_path = argv[++i];
+    else if (arg == "--filter" && has_value) filter = argv[++i];
+    else if (arg == "--resources" && has_value) resources = argv[++i];
+    else if (arg == "--replay" && has_value) replay_path = argv[++i];
+    else {
+      cerr << "Usage: cv_bench [--iterations N] [--format table|csv|json] [--output file]"
+           << " [--filter text] [--resources dir] [--video-frames N] [--replay file]" << endl;
+      return -1;
+    }
+  }
+
+  CountingMatAllocator counting_allocator;
+  Mat::setDefaultAllocator(&counting_allocator);
+
+  // Inputs
+  vector<pair<string, Mat>> images;
+  for (string name : {"shapes.png", "paper.jpg", "cards.jpg", "lambo.png", "test.png"}) {
+    Mat img = imread(resources + "/" + name);
+    if (img.empty()) {
+      cerr << "Could not read " << resources << "/" << name << endl;
+      return -1;
+    }
+    images.push_back({name, img});
+  }
+  auto image = [&](const string& name) -> const Mat& {
+    for (const auto& entry : images)
+      if (entry.first == name)
+        return entry.second;
+    return images[0].second;
+  };
+
+  // decoded up front so decoding stays out of the measurements,
+  // raw recorded frames are used straight from the mapped file
+  vector<Mat> frames;
+  unique_ptr<FrameReplay> replay;
+  if ( !replay_path.empty() ) {
+    replay = make_unique<FrameReplay>(replay_path);
+    if ( !replay->isOpened() )
+      return -1;
+    for (size_t i = 0; i < replay->size() && (int)frames.size() < video_frames; i++)
+      frames.push_back(replay->compressed() ? replay->frame(i).clone() : replay->frame(i));
+  } else {
+    VideoCapture video(resources + "/test_video.mp4");
+    Mat frame;
+    while ((int)frames.size() < video_frames && video.read(frame))
+      frames.push_back(frame.clone());
+  }
+
+  string cascade_path = resources + "/haarcascade_frontalface_default.xml";
+  CascadeClassifier cascade(cascade_path);
+  FaceDetector face_detector(cascade_path);
+  FaceTracker face_tracker(cascade_path);
+
+  string plate_path = resources + "/haarcascade_russian_plate_number.xml";
+  CascadeClassifier plate_cascade(plate_path);
+  MultiCascadeDetector multi_detector({{"Face", cascade_path}, {"Plate", plate_path}});
+  vector<Rect> plates;
+  vector<vector<Rect>> multi_hits;
+
+  // marker matching the orange of lambo.png
+  Marker marker;
+  marker.color = Scalar(0, 165, 255);
+  marker.min_color_range = Scalar(0, 110, 153);
+  marker.max_color_range = Scalar(19, 240, 255);
+  MarkerClassifier classifier;
+  classifier.build({marker});
+
+  HsvRange hsv_range;
+  hsv_range.h_max = 19; hsv_range.s_min = 110; hsv_range.v_min = 153;
+  hsv_range.s_max = 240;
+
+  // state shared by the stages, kept alive for the whole run
+  Preprocessor preprocessor;
+  Preprocessor doc_preprocessor(docPreprocessParams());
+  EdgePipeline static_edges;
+  RuntimePipeline generic_edges = makeEdgePipeline();
+  ShapeContourStage static_contours;
+  ContourStage<> generic_contours(1000, 0.02);
+  vector<vector<Point>> polygons;
+  TiledContourParams tiled_params;
+  tiled_params.tile_size = 512;
+  tiled_params.min_pixels = 0;
+  TiledContourFinder tiled_contours(tiled_params);
+  DocTrackerParams detect_only;
+  detect_only.tracking = false;
+  DocTracker doc_tracker(detect_only);
+  WarpEngine warp_engine;
+  ShapeClassifier shape_classifier;
+  PaintCanvas paint_canvas;
+  Mat edges, canvas, output, hsv, mask;
+  OverlayBuffer overlay;
+  vector<Point> quad;
+  vector<Rect> faces;
+  size_t frame_index = 0;
+
+  vector<Stage> stages;
+  auto addImageStages = [&](const string& input, const Mat& img) {
+    double pixels = (double)img.total();
+
+    stages.push_back({"preprocess/reference", input, pixels, nullptr, [&, img]() { preprocessReference(img, output); }});
+    stages.push_back({"preprocess/fused", input, pixels, nullptr, [&, img]() { preprocessor.run(img); }});
+    stages.push_back({"preprocess/static", input, pixels, nullptr, [&, img]() { static_edges.run(img); }});
+    stages.push_back({"preprocess/generic", input, pixels, nullptr, [&, img]() { generic_edges.run(img); }});
+    stages.push_back({"hsv/inRange", input, pixels, nullptr, [&, img]() {
+      cvtColor(img, hsv, COLOR_BGR2HSV);
+      hsvMask(hsv, hsv_range, mask);
+    }});
+    stages.push_back({"getPenTip", input, pixels,
+      [&, img]() { img.copyTo(canvas); marker.pen_tip.clear(); },
+      [&]() {
+        classifier.classify(canvas);
+        getPenTip(classifier, 0, &marker, overlay);
+        renderOverlay(overlay, canvas);
+        overlay.clear();
+      }
+    });
+    // a dashboard's worth of labels, drawn one by one and through the overlay
+    stages.push_back({"labels/putText", input, pixels,
+      [&, img]() { img.copyTo(canvas); },
+      [&]() {
+        for (int i = 0; i < 300; i++) {
+          Point at(20 + (i % 15) * 60, 20 + (i / 15) * 24);
+          rectangle(canvas, Rect(at.x, at.y, 50, 20), Scalar(0, 255, 0), 1);
+          putText(canvas, "Face " + to_string(i % 20), at, FONT_HERSHEY_PLAIN, 1.2, Scalar(0, 255, 0), 1);
+        }
+      }
+    });
+    stages.push_back({"labels/overlay", input, pixels,
+      [&, img]() { img.copyTo(canvas); },
+      [&]() {
+        for (int i = 0; i < 300; i++) {
+          Point at(20 + (i % 15) * 60, 20 + (i / 15) * 24);
+          overlay.addRect(Rect(at.x, at.y, 50, 20), Scalar(0, 255, 0), 1);
+          overlay.addText("Face " + to_string(i % 20), at, Scalar(0, 255, 0), 1.2, 1);
+        }
+        renderOverlay(overlay, canvas);
+        overlay.clear();
+      }
+    });
+    stages.push_back({"detectMultiScale", input, pixels, nullptr, [&, img]() { cascade.detectMultiScale(img, faces, 1.1, 1); }});
+    stages.push_back({"FaceDetector", input, pixels, nullptr, [&, img]() { face_detector.detect(img, faces); }});
+    stages.push_back({"face+plate/separate", input, pixels, nullptr, [&, img]() {
+      cascade.detectMultiScale(img, faces, 1.1, 1);
+      plate_cascade.detectMultiScale(img, plates, 1.1, 1);
+    }});
+    stages.push_back({"face+plate/shared", input, pixels, nullptr, [&, img]() { multi_detector.detect(img, multi_hits); }});
+
+    // the shared pyramid is only worth its time if it finds what the separate calls find
+    cascade.detectMultiScale(img, faces, 1.1, 1);
+    plate_cascade.detectMultiScale(img, plates, 1.1, 1);
+    multi_detector.detect(img, multi_hits);
+    if ( !multi_hits.empty() ) {
+      int matched = matchedBoxes(faces, multi_hits[0]) + matchedBoxes(plates, multi_hits[1]);
+      cout << "face+plate/shared recall on " << input << ": " << matched << " of "
+           << faces.size() + plates.size() << " separate call boxes" << endl;
+    }
+  };
+
+  // shapes
+  {
+    const Mat& img = image("shapes.png");
+    double pixels = (double)img.total();
+    preprocessReference(img, edges);
+    Mat shape_edges = edges.clone();
+    stages.push_back({"detectShapes", "shapes.png", pixels,
+      [&, img]() { img.copyTo(canvas); },
+      [&, shape_edges]() { detectShapes(shape_edges, canvas); }
+    });
+    stages.push_back({"ShapeClassifier", "shapes.png", pixels, nullptr,
+      [&, shape_edges]() { shape_classifier.classify(shape_edges); }
+    });
+    stages.push_back({"contours/static", "shapes.png", pixels, nullptr,
+      [&, shape_edges]() { static_contours.apply(shape_edges, polygons); }
+    });
+    stages.push_back({"contours/generic", "shapes.png", pixels, nullptr,
+      [&, shape_edges]() { generic_contours.apply(shape_edges, polygons); }
+    });
+
+    // a scan sized edge map: the whole image traced at once against in tiles
+    Mat large_edges;
+    repeat(shape_edges, 8, 8, large_edges);
+    double large_pixels = (double)large_edges.total();
+    stages.push_back({"contours/findContours", "shapes.png x64", large_pixels, nullptr,
+      [&, large_edges]() { findContours(large_edges, polygons, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE); }
+    });
+    stages.push_back({"contours/tiled", "shapes.png x64", large_pixels, nullptr,
+      [&, large_edges]() { tiled_contours.find(large_edges, polygons); }
+    });
+    tiled_contours.verify(large_edges);
+
+    // the specialized chain has to agree with the reference before its timings mean anything
+    int mismatch = countNonZero(static_edges.run(img) != edges) + countNonZero(generic_edges.run(img) != edges);
+    if (mismatch > 0)
+      cerr << "Static pipeline mismatch: " << mismatch << " pixels differ from the reference chain" << endl;
+  }
+
+  // document
+  for (const string& input : {string("paper.jpg"), string("video")}) {
+    const Mat& img = input == "video" && !frames.empty() ? frames[0] : image("paper.jpg");
+    double pixels = (double)img.total();
+    vector<Point> doc_quad;
+    if ( !doc_tracker.update(img, doc_quad) ) {
+      cerr << "No document found in " << input << ", skipping document stages" << endl;
+      continue;
+    }
+    vector<Point> sorted = sortDocBounds(doc_quad);
+    vector<Point2f> sorted_corners(sorted.begin(), sorted.end());
+
+    stages.push_back({"getDocBounds", input, pixels, nullptr, [&, img]() { doc_tracker.update(img, quad); }});
+    stages.push_back({"sortDocBounds", input, 4, nullptr, [&, doc_quad]() { quad = sortDocBounds(doc_quad); }});
+    stages.push_back({"wrapDoc", input, pixels, nullptr, [&, img, sorted]() { output = wrapDoc(img, sorted); }});
+    stages.push_back({"wrapDoc/engine", input, pixels, nullptr, [&, img, sorted_corners]() {
+      wrapDoc(img, sorted_corners, warp_engine, output);
+    }});
+  }
+
+  for (const auto& entry : images)
+    addImageStages(entry.first, entry.second);
+
+  // video frames, cycled so every call sees a different frame
+  if ( !frames.empty() ) {
+    double pixels = (double)frames[0].total();
+    auto next_frame = [&]() -> const Mat& { return frames[frame_index++ % frames.size()]; };
+
+    stages.push_back({"preprocess/reference", "video", pixels, nullptr, [&]() { preprocessReference(next_frame(), output); }});
+    stages.push_back({"preprocess/fused", "video", pixels, nullptr, [&]() { preprocessor.run(next_frame()); }});
+    stages.push_back({"preprocess/static", "video", pixels, nullptr, [&]() { static_edges.run(next_frame()); }});
+    stages.push_back({"preprocess/generic", "video", pixels, nullptr, [&]() { generic_edges.run(next_frame()); }});
+    stages.push_back({"hsv/inRange", "video", pixels, nullptr, [&]() {
+      cvtColor(next_frame(), hsv, COLOR_BGR2HSV);
+      hsvMask(hsv, hsv_range, mask);
+    }});
+    stages.push_back({"getPenTip", "video", pixels,
+      [&]() { next_frame().copyTo(canvas); marker.pen_tip.clear(); },
+      [&]() {
+        classifier.classify(canvas);
+        getPenTip(classifier, 0, &marker, overlay);
+        renderOverlay(overlay, canvas);
+        overlay.clear();
+      }
+    });
+    stages.push_back({"paint/canvas", "video", pixels,
+      [&]() { next_frame().copyTo(canvas); },
+      [&]() {
+        classifier.classify(canvas);
+        getPenTip(classifier, 0, &marker, overlay);
+        renderOverlay(overlay, canvas);
+        overlay.clear();
+        paint_canvas.addStrokes(0, marker, canvas.size());
+        paint_canvas.composite(canvas);
+      }
+    });
+    stages.push_back({"detectMultiScale", "video", pixels, nullptr, [&]() { cascade.detectMultiScale(next_frame(), faces, 1.1, 1); }});
+    stages.push_back({"FaceDetector", "video", pixels, nullptr, [&]() { face_detector.detect(next_frame(), faces); }});
+    stages.push_back({"FaceTracker", "video", pixels, nullptr, [&]() { face_tracker.update(next_frame()); }});
+    stages.push_back({"face+plate/separate", "video", pixels, nullptr, [&]() {
+      const Mat& img = next_frame();
+      cascade.detectMultiScale(img, faces, 1.1, 1);
+      plate_cascade.detectMultiScale(img, plates, 1.1, 1);
+    }});
+    stages.push_back({"face+plate/shared", "video", pixels, nullptr, [&]() { multi_detector.detect(next_frame(), multi_hits); }});
+  }
+
+  // Run
+  vector<StageResult> results;
+  for (const Stage& stage : stages) {
+    string label = stage.name + " " + stage.input;
+    if ( !filter.empty() && label.find(filter) == string::npos )
+      continue;
+
+    cerr << "running " << label << endl;
+    results.push_back(runStage(stage, iterations));
+  }
+
+  Mat::setDefaultAllocator(nullptr);
+
+  ofstream file;
+  if ( !output_path.empty() ) {
+    file.open(output_path);
+    if ( !file ) {
+      cerr << "Could not write " << output_path << endl;
+      return -1;
+    }
+  }
+  ostream& out = output_path.empty() ? cout : file;
+
+  if (format == "json")
+    printJson(out, results);
+  else if (format == "csv")
+    printCsv(out, results);
+  else
+    printTable(out, results);
+
+  trace::flush();
+  return 0;
+}
@@ -2,6 +2,8 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui.hpp>
 
+#include "hsv_tuner.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -9,33 +11,26 @@ int main()
 {
   string path = "./Resources/lambo.png";
   Mat img = imread(path);
-  Mat img_hsv, mask;
-  int h_min = 0, s_min = 0, v_min = 0;
-  int h_max = 179, s_max = 255, v_max = 255;
 
   namedWindow("Trackbars", (640, 200));
-  createTrackbar("Hue_min", "Trackbars", &h_min, 179);
-  createTrackbar("Hue_max", "Trackbars", &h_max, 179);
-  createTrackbar("Sat_min", "Trackbars", &s_min, 255);
-  createTrackbar("Sat_max", "Trackbars", &s_max, 255);
-  createTrackbar("Val_min", "Trackbars", &v_min, 255);
-  createTrackbar("Val_max", "Trackbars", &v_max, 255);
-
-  while(true) {
+  HsvTuner tuner("Trackbars");
+  tuner.createTrackbars();
 
-    // Conver RGB to HSV
-    cvtColor(img, img_hsv, COLOR_BGR2HSV);
+  // Conver RGB to HSV once, the image does not change
+  tuner.setImage(img);
 
-    Scalar lower(h_min, s_min, v_min);
-    Scalar upper(h_max, s_max, v_max);
+  imshow("Image", img);
+  imshow("Image HSV", tuner.hsv());
 
-    inRange(img_hsv, lower, upper, mask);
+  while(true) {
 
-    imshow("Image", img);
-    imshow("Image HSV", img_hsv);
-    imshow("Image mask", mask);
+    // only recompute the mask when a trackbar moved
+    if (tuner.update()) {
+      imshow("Image mask", tuner.mask());
+      setWindowTitle("Image mask", format("Image mask - %.1f%% of pixels%s", tuner.coverage() * 100, tuner.showingPreview() ? " (preview)" : ""));
+    }
 
-    waitKey(1);
+    waitKey(15);
   }
 
 
@@ -0,0 +1,223 @@
+/**
+ * @file doc_batch.cpp
+ * @brief Headless batch mode of the document scanner.
+ *
+ */
+
+#include "doc_batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "doc_detection.hpp"
+#include "frame_pool.hpp"
+#include "thread_pool.hpp"
+#include "warp_engine.hpp"
+
+using namespace cv;
+using namespace std;
+namespace fs = std::filesystem;
+
+static bool isImage(const fs::path& path)
+{
+  string ext = path.extension().string();
+  transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+  return ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".tif" || ext == ".tiff" || ext == ".bmp";
+}
+
+vector<string> listPages(const string& input)
+{
+  vector<string> pages;
+  fs::path path(input);
+
+  if (fs::is_directory(path)) {
+    for (const fs::directory_entry& entry : fs::directory_iterator(path))
+      if (entry.is_regular_file() && isImage(entry.path()))
+        pages.push_back(entry.path().string());
+    sort(pages.begin(), pages.end());
+  } else if (isImage(path)) {
+    pages.push_back(input);
+  } else {
+    ifstream list(input);
+    string line;
+    while (getline(list, line))
+      if ( !line.empty() )
+        pages.push_back(line);
+  }
+
+  return pages;
+}
+
+// JSON string literal, paths carry Windows backslashes and may carry quotes
+static string jsonString(const string& text)
+{
+  ostringstream out;
+  out << '"';
+  for (unsigned char c : text) {
+    switch (c) {
+      case '"':  out << "\\\""; break;
+      case '\\': out << "\\\\"; break;
+      case '\n': out << "\\n"; break;
+      case '\r': out << "\\r"; break;
+      case '\t': out << "\\t"; break;
+      default:
+        if (c < 0x20)
+          out << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec;
+        else
+          out << c;
+    }
+  }
+  out << '"';
+
+  return out.str();
+}
+
+// CSV field, quoted when it holds a separator, a quote or a line break
+static string csvField(const string& text)
+{
+  if (text.find_first_of(",\"\r\n") == string::npos)
+    return text;
+
+  string quoted = "\"";
+  for (char c : text) {
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  quoted += '"';
+
+  return quoted;
+}
+
+static void writeRecords(const string& path, const string& format, const vector<PageRecord>& records)
+{
+  ofstream out(path);
+  const char* names[4] = {"tl", "tr", "bl", "br"};
+
+  if (format == "json") {
+    out << "[" << endl;
+    for (size_t i = 0; i < records.size(); i++) {
+      const PageRecord& r = records[i];
+      out << "  {\"path\": " << jsonString(r.path) << ", \"output\": " << jsonString(r.output)
+          << ", \"found\": " << (r.found ? "true" : "false") << ", \"ms\": " << r.ms;
+      for (size_t c = 0; c < r.corners.size(); c++)
+        out << ", \"" << names[c] << "\": [" << r.corners[c].x << ", " << r.corners[c].y << "]";
+      out << "}" << (i + 1 < records.size() ? "," : "") << endl;
+    }
+    out << "]" << endl;
+    return;
+  }
+
+  out << "path,output,found,tl_x,tl_y,tr_x,tr_y,bl_x,bl_y,br_x,br_y,ms" << endl;
+  for (const PageRecord& r : records) {
+    out << csvField(r.path) << "," << csvField(r.output) << "," << r.found;
+    for (int c = 0; c < 4; c++) {
+      if (c < r.corners.size())
+        out << "," << r.corners[c].x << "," << r.corners[c].y;
+      else
+        out << ",,";
+    }
+    out << "," << r.ms << endl;
+  }
+}
+
+int runDocBatch(const DocBatchOptions& options)
+{
+  vector<string> pages = listPages(options.input);
+  if (pages.empty()) {
+    cout << "No pages found in " << options.input << endl;
+    return -1;
+  }
+
+  fs::create_directories(options.output_dir);
+
+  size_t num_workers = options.threads > 0 ? options.threads : max(1u, thread::hardware_concurrency());
+  num_workers = min(num_workers, pages.size());
+
+  // parallelism comes from the pages, keep each page on one core
+  setNumThreads(1);
+
+  vector<PageRecord> records(pages.size());
+  atomic<size_t> next_page{0};
+  auto start = chrono::steady_clock::now();
+
+  // encodes next to the workers, pages are stored in input order
+  PageWriterOptions page_options = options.pages;
+  page_options.output_dir = options.output_dir;
+  PageWriter writer(page_options);
+  if ( !writer.isOpened() )
+    return -1;
+
+  {
+    ThreadPool pool(num_workers);
+    vector<future<void>> workers;
+
+    for (size_t w = 0; w < num_workers; w++) {
+      workers.push_back(pool.submit([&]() {
+        // detector state owned by this worker, pages are independent stills
+        DocTrackerParams params;
+        params.tracking = false;
+        params.proxy_width = options.proxy_width;
+        DocTracker tracker(params);
+        WarpEngine warp_engine;
+        Mat scanned;
+        vector<Point> quad;
+
+        for (size_t i = next_page++; i < pages.size(); i = next_page++) {
+          FrameScope page_scope(true);
+          PageRecord& record = records[i];
+          auto page_start = chrono::steady_clock::now();
+          record.path = pages[i];
+
+          // pages of the same stem from other folders or formats must not overwrite
+          // each other, the index keeps the names unique and in input order
+          ostringstream name_stream;
+          name_stream << setw(4) << setfill('0') << i << "_" << fs::path(pages[i]).stem().string() << "_scan";
+          string name = name_stream.str();
+
+          Mat page = imread(pages[i]);
+          if ( !page.empty() && tracker.update(page, quad) ) {
+            record.found = true;
+            record.corners = sortDocBounds(tracker.lastCorners());
+            wrapDoc(page, record.corners, warp_engine, scanned);
+
+            record.output = writer.outputPath(name);
+            writer.submit(i, scanned, name);
+          } else {
+            // the writer still has to hear about the index to keep the order
+            writer.submit(i, Mat(), name);
+          }
+
+          record.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - page_start).count();
+        }
+      }));
+    }
+
+    for (future<void>& worker : workers)
+      worker.get();
+  }
+
+  writer.close();
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  size_t found = count_if(records.begin(), records.end(), [](const PageRecord& r) { return r.found; });
+
+  string records_path = (fs::path(options.output_dir) / ("records." + options.record_format)).string();
+  writeRecords(records_path, options.record_format, records);
+
+  double pages_per_second = pages.size() / seconds;
+  cout << "Pages: " << pages.size() << " (" << found << " documents found)" << endl;
+  cout << "Workers: " << num_workers << endl;
+  cout << "Pages per second: " << pages_per_second << " (" << pages_per_second / num_workers << " per core)" << endl;
+  printPageWriterStats(writer.stats());
+  printFramePoolStats(FramePool::shared().stats());
+  cout << "Records: " << records_path << endl;
+
+  return 0;
+}
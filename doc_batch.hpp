@@ -0,0 +1,50 @@
+/**
+ * @file doc_batch.hpp
+ * @brief Headless batch mode of the document scanner.
+ *        Pages are rectified on a thread pool, every worker owns its own detector
+ *        state, and a CSV or JSON record of the detected quad is written per page.
+ *        Rectified pages go to a page writer that encodes them while scanning goes on
+ *        and stores them in input order.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "page_writer.hpp"
+
+struct DocBatchOptions {
+  std::string input;                  // directory of images, text file listing one image per line, or a single image
+  std::string output_dir = "scans";
+  std::string record_format = "csv";  // csv or json
+  int threads = 0;                    // 0 uses the hardware concurrency
+  int proxy_width = 960;
+  PageWriterOptions pages;            // output_dir is taken from above
+};
+
+struct PageRecord {
+  std::string path;
+  std::string output;
+  bool found = false;
+  std::vector<cv::Point2f> corners;   // sorted: top left, top right, bottom left, bottom right
+  double ms = 0;
+};
+
+/**
+ * @brief listPages collect the image paths of a batch input
+ *
+ * @param input directory, list file or image
+ * @return std::vector<std::string> image paths
+ */
+std::vector<std::string> listPages(const std::string& input);
+
+/**
+ * @brief runDocBatch rectify every page of a batch
+ *
+ * @param options batch options
+ * @return int 0 on success
+ */
+int runDocBatch(const DocBatchOptions& options);
@@ -0,0 +1,375 @@
+/**
+ * @file doc_detection.cpp
+ * @brief Document quad detection and frame to frame tracking for the doc scanner.
+ *
+ */
+
+#include "doc_detection.hpp"
+
+#include <opencv2/video.hpp>
+#include <cmath>
+#include <iostream>
+
+#include "frame_pool.hpp"
+#include "tiled_contours.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+vector<Point> invalid_points = {Point(-1, -1)};
+
+PreprocessParams docPreprocessParams()
+{
+  PreprocessParams params;
+  params.blur_size = 7;
+
+  return params;
+}
+
+bool findDocQuad(const Mat& edges, vector<Point>& quad, double min_area)
+{
+  FrameScope scope;
+  ContourSet& contours = scope.contours();
+  thread_local vector<Point> min_polygon;    // Minimum bounding box poligon, used to predict shape
+  bool found = false;
+
+  findExternalContours(edges, contours);
+
+  for (int i = 0; i < contours.size(); i++) {
+    double area = contourArea(contours[i]);
+
+    if (area > min_area) {      // skip small contours
+      // Find minimum polygon, assume quadrilateral is document
+      double perimeter    = arcLength(contours[i], true);
+      approxPolyDP(contours[i], min_polygon, 0.02*perimeter, true);
+
+      if (min_polygon.size() == 4 && isContourConvex(min_polygon)) {
+        quad = min_polygon;
+        found = true;
+      }
+    }
+  }
+
+  return found;
+}
+
+const Mat& makeDocProxy(const Mat& frame, int proxy_width, Mat& buffer, double& scale)
+{
+  scale = 1;
+  if (proxy_width <= 0 || frame.cols <= proxy_width)
+    return frame;
+
+  scale = frame.cols / (double) proxy_width;
+  resize(frame, buffer, Size(), 1 / scale, 1 / scale, INTER_AREA);
+  return buffer;
+}
+
+void refineDocCorners(const Mat& input, vector<Point2f>& corners, int half_window)
+{
+  const Rect image_bounds(0, 0, input.cols, input.rows);
+  const TermCriteria criteria(TermCriteria::COUNT | TermCriteria::EPS, 30, 0.01);
+  FrameScope scope;
+  Mat gray;
+
+  for (Point2f& corner : corners) {
+    // cornerSubPix needs a one pixel margin around its search window
+    int margin = half_window + 2;
+    Rect roi = Rect(cvRound(corner.x) - margin, cvRound(corner.y) - margin, 2 * margin + 1, 2 * margin + 1) & image_bounds;
+    if (roi.width < 2 * margin + 1 || roi.height < 2 * margin + 1)
+      continue;   // too close to the image border to refine
+
+    // the windows are all the same size, one pooled buffer serves every corner
+    if (gray.empty())
+      gray = scope.mat(roi.size(), CV_8UC1);
+    cvtColor(input(roi), gray, COLOR_BGR2GRAY);
+
+    vector<Point2f> local = { corner - Point2f((float)roi.x, (float)roi.y) };
+    cornerSubPix(gray, local, Size(half_window, half_window), Size(-1, -1), criteria);
+    corner = local[0] + Point2f((float)roi.x, (float)roi.y);
+  }
+}
+
+vector<Point2f> sortDocBounds(vector<Point2f> doc_bounds)
+{
+  if (doc_bounds.size() != 4) {
+    cout << "Invalid document bounds" << endl;
+    return { Point2f(-1, -1) };
+  }
+
+  vector<Point2f> sorted_bounds;
+  vector<float> sums, diffs;
+  int tl, tr, br, bl;
+
+  for (int i = 0; i < doc_bounds.size(); i++) {
+    sums.push_back( doc_bounds[i].x + doc_bounds[i].y );
+    diffs.push_back( doc_bounds[i].x - doc_bounds[i].y );
+  }
+
+  tl = min_element(sums.begin(), sums.end()) - sums.begin();
+  tr = max_element(diffs.begin(), diffs.end()) - diffs.begin();
+  bl = min_element(diffs.begin(), diffs.end()) - diffs.begin();
+  br = max_element(sums.begin(), sums.end()) - sums.begin();
+
+  sorted_bounds.push_back(doc_bounds[tl]);
+  sorted_bounds.push_back(doc_bounds[tr]);
+  sorted_bounds.push_back(doc_bounds[bl]);
+  sorted_bounds.push_back(doc_bounds[br]);
+
+  return sorted_bounds;
+}
+
+vector<Point> sortDocBounds(vector<Point> doc_bounds)
+{
+  if (doc_bounds.size() != 4) {
+    cout << "Invalid document bounds" << endl;
+    return invalid_points;
+  }
+
+  vector<Point2f> sorted_bounds = sortDocBounds(vector<Point2f>(doc_bounds.begin(), doc_bounds.end()));
+
+  return vector<Point>(sorted_bounds.begin(), sorted_bounds.end());
+}
+
+void drawDocBounds(OverlayBuffer& overlay, Size size, const vector<Point>& quad)
+{
+  static const Scalar CYAN = Scalar(182, 196, 46);
+  static const Scalar RED = Scalar(84, 0, 255);
+
+  if ( !quad.empty() ) {
+    overlay.addPolyline(quad, true, CYAN, 2);
+    return;
+  }
+
+  // draw  small X mid screen
+  int x = size.width / 2;
+  int y = size.height / 2;
+  overlay.addLine(Point(x-50, y-50), Point(x+50, y+50), RED, 2);
+  overlay.addLine(Point(x-50, y+50), Point(x+50, y-50), RED, 2);
+}
+
+void drawDocBounds(Mat& img, const vector<Point>& quad)
+{
+  thread_local OverlayBuffer overlay;
+  overlay.clear();
+  drawDocBounds(overlay, img.size(), quad);
+  renderOverlay(overlay, img);
+}
+
+/**
+ * @brief estimateDocSize estimate width and height from bounds when they are not given
+ */
+static void estimateDocSize(const vector<Point2f>& doc_bounds, float& width, float& height)
+{
+  if (width <= 0 || height <= 0) {
+    int max_width = (int) max(doc_bounds[1].x - doc_bounds[0].x, doc_bounds[3].x - doc_bounds[2].x);
+    int max_height = (int) max(doc_bounds[2].y - doc_bounds[0].y, doc_bounds[3].y - doc_bounds[1].y);
+    width = (float) max_width;
+    height = (float) max_height;
+  }
+}
+
+Mat wrapDoc(Mat input, vector<Point2f> doc_bounds, float width, float height, bool crop)
+{
+  if (doc_bounds.size() != 4) {
+    cout << "Invalid document bounds" << endl;
+    return input;
+  }
+
+  estimateDocSize(doc_bounds, width, height);
+
+  Point doc_dim((int)width, (int)height);
+  Mat matrix, img_warp;
+
+  Point2f src_coord[4] = {doc_bounds[0], doc_bounds[1], doc_bounds[2], doc_bounds[3]};
+
+  Point2f dest_coord[4] = {
+    {0.0f, 0.0f},
+    {width, 0.0f},
+    {0.0f, height},
+    {width, height}
+  };
+  
+  // get transformation matrix and warp image
+  matrix = getPerspectiveTransform(src_coord, dest_coord);
+  warpPerspective(input, img_warp, matrix, doc_dim);
+
+  // crop image
+  if (crop) {
+    int crop_amount = 10;
+    Rect crop_region(crop_amount, crop_amount, (int) width-crop_amount*2, (int) height-crop_amount*2);
+    img_warp = img_warp(crop_region);
+  }
+
+  return img_warp;
+}
+
+Mat wrapDoc(Mat input, vector<Point> doc_bounds, float width, float height, bool crop)
+{
+  return wrapDoc(input, vector<Point2f>(doc_bounds.begin(), doc_bounds.end()), width, height, crop);
+}
+
+void wrapDoc(const Mat& input, const vector<Point2f>& doc_bounds, WarpEngine& engine, Mat& output, float width, float height, bool crop)
+{
+  if (doc_bounds.size() != 4) {
+    cout << "Invalid document bounds" << endl;
+    input.copyTo(output);
+    return;
+  }
+
+  estimateDocSize(doc_bounds, width, height);
+
+  int crop_amount = crop ? 10 : 0;
+  engine.warp(input, doc_bounds, Size((int)width, (int)height), crop_amount, output);
+}
+
+DocTracker::DocTracker(const DocTrackerParams& params, const PreprocessParams& preprocess_params)
+  : params_(params), preprocessor_(preprocess_params)
+{
+}
+
+void DocTracker::reset()
+{
+  has_corners_ = false;
+  tracked_ = false;
+  frames_since_detection_ = 0;
+  quad_.clear();
+  corners_.clear();
+}
+
+bool DocTracker::update(const Mat& frame, vector<Point>& quad)
+{
+  bool found = false;
+  tracked_ = false;
+
+  if (params_.tracking && has_corners_ && frames_since_detection_ < params_.redetect_interval)
+    found = track(frame);
+
+  // tracking lost or due for a refresh
+  if ( !found )
+    found = detect(frame);
+
+  if (found)
+    quad = quad_;
+
+  return found;
+}
+
+bool DocTracker::update(const Mat& frame, const Mat& edges, double scale, vector<Point>& quad)
+{
+  bool found = false;
+  tracked_ = false;
+
+  if (params_.tracking && has_corners_ && frames_since_detection_ < params_.redetect_interval)
+    found = track(frame);
+
+  if ( !found ) {
+    TRACE_SPAN("doc.detect");
+    found = locate(frame, edges, scale, nullptr);
+  }
+
+  if (found)
+    quad = quad_;
+
+  return found;
+}
+
+/**
+ * @brief detect finds the document on a downscaled proxy of the frame, scales the
+ *        corners back up and refines them at full resolution, so large stills
+ *        cost about as much as the proxy while keeping full resolution corners
+ */
+bool DocTracker::detect(const Mat& frame)
+{
+  TRACE_SPAN("doc.detect");
+  double scale;
+  const Mat& proxy = makeDocProxy(frame, params_.proxy_width, proxy_, scale);
+  const Mat& edges = preprocessor_.run(proxy);
+
+  // at full resolution the preprocessor's gray image serves the tracker too
+  return locate(frame, edges, scale, scale == 1 ? &preprocessor_.gray() : nullptr);
+}
+
+/**
+ * @brief locate finds the document quad in the edges of the proxy
+ *
+ * @param gray gray frame at full resolution if there is one, converted otherwise
+ */
+bool DocTracker::locate(const Mat& frame, const Mat& edges, double scale, const Mat* gray)
+{
+  frames_since_detection_ = 0;
+
+  // keep the pyramid of this frame, the next frame is tracked against it
+  if (params_.tracking) {
+    if ( !gray ) {
+      cvtColor(frame, gray_, COLOR_BGR2GRAY);
+      gray = &gray_;
+    }
+    buildOpticalFlowPyramid(*gray, pyramid_, params_.window, params_.pyramid_levels);
+  }
+
+  vector<Point> found_quad;
+  if ( !findDocQuad(edges, found_quad, 1000 / (scale * scale)) ) {
+    has_corners_ = false;
+    return false;
+  }
+
+  // pixel centers of the proxy back to full resolution
+  corners_.clear();
+  for (const Point& corner : found_quad)
+    corners_.push_back(Point2f((float)((corner.x + 0.5) * scale - 0.5), (float)((corner.y + 0.5) * scale - 0.5)));
+
+  if (params_.refine_corners && scale > 1)
+    refineDocCorners(frame, corners_, max(5, cvRound(2 * scale)));
+
+  quad_.clear();
+  for (const Point2f& corner : corners_)
+    quad_.push_back(Point(cvRound(corner.x), cvRound(corner.y)));
+  has_corners_ = true;
+
+  return true;
+}
+
+/**
+ * @brief track moves the corners with optical flow and rejects the result when a
+ *        corner is lost, its flow error is high, it leaves the frame, or the quad
+ *        stops being convex or changes area abruptly
+ */
+bool DocTracker::track(const Mat& frame)
+{
+  TRACE_SPAN("doc.track");
+  cvtColor(frame, gray_, COLOR_BGR2GRAY);
+
+  // the previous frame's pyramid is reused, only the new frame's is built
+  swap(prev_pyramid_, pyramid_);
+  buildOpticalFlowPyramid(gray_, pyramid_, params_.window, params_.pyramid_levels);
+
+  vector<Point2f> next_corners;
+  vector<uchar> status;
+  vector<float> error;
+  calcOpticalFlowPyrLK(prev_pyramid_, pyramid_, corners_, next_corners, status, error, params_.window, params_.pyramid_levels);
+
+  Rect2f bounds(0, 0, (float)frame.cols, (float)frame.rows);
+  for (int i = 0; i < next_corners.size(); i++) {
+    if ( !status[i] || error[i] > params_.max_error || !bounds.contains(next_corners[i]) ) {
+      has_corners_ = false;
+      return false;
+    }
+  }
+
+  double prev_area = contourArea(corners_);
+  double area = contourArea(next_corners);
+  if ( !isContourConvex(next_corners) || prev_area <= 0 || abs(area / prev_area - 1) > params_.max_area_change ) {
+    has_corners_ = false;
+    return false;
+  }
+
+  corners_ = next_corners;
+  for (int i = 0; i < corners_.size(); i++)
+    quad_[i] = Point(cvRound(corners_[i].x), cvRound(corners_[i].y));
+
+  frames_since_detection_++;
+  tracked_ = true;
+
+  return true;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file doc_detection.hpp
+ * @brief Document quad detection and frame to frame tracking for the doc scanner.
+ *        Full detection (preprocess, contours, polygon fit) only runs every few frames
+ *        or when tracking loses confidence; in between the four corners are followed
+ *        with pyramidal Lucas-Kanade optical flow.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "overlay.hpp"
+#include "preprocess.hpp"
+#include "warp_engine.hpp"
+
+// Invalid points type
+extern std::vector<cv::Point> invalid_points;
+
+/**
+ * @brief docPreprocessParams preprocessing used for document detection
+ *
+ * @return PreprocessParams
+ */
+PreprocessParams docPreprocessParams();
+
+/**
+ * @brief findDocQuad find the document in an edge image, the last convex
+ *        quadrilateral larger than 1000 px is assumed to be the document
+ *
+ * @param edges preprocessed edge image
+ * @param quad document corners
+ * @param min_area smallest contour area considered
+ * @return true if a document was found
+ */
+bool findDocQuad(const cv::Mat& edges, std::vector<cv::Point>& quad, double min_area = 1000);
+
+/**
+ * @brief makeDocProxy downscale a frame for detection when it is wider than proxy_width
+ *
+ * @param frame BGR frame
+ * @param proxy_width detection width, 0 keeps full resolution
+ * @param buffer receives the downscaled copy
+ * @param scale frame width over proxy width, 1 when the frame is used as is
+ * @return const cv::Mat& the frame or the buffer
+ */
+const cv::Mat& makeDocProxy(const cv::Mat& frame, int proxy_width, cv::Mat& buffer, double& scale);
+
+/**
+ * @brief refineDocCorners refine corners to sub-pixel accuracy at full resolution,
+ *        only a small window around each corner is converted and searched
+ *
+ * @param input full resolution BGR image
+ * @param corners corners to refine in place
+ * @param half_window half size of the search window in pixels
+ */
+void refineDocCorners(const cv::Mat& input, std::vector<cv::Point2f>& corners, int half_window);
+
+/**
+ * @brief sortDocBounds function to sort document bounds
+ * 
+ * @param doc_bounds document bounds
+ * @return sorted document bounds: top left, top right, bottom left, bottom right
+ */
+std::vector<cv::Point> sortDocBounds(std::vector<cv::Point> doc_bounds);
+std::vector<cv::Point2f> sortDocBounds(std::vector<cv::Point2f> doc_bounds);
+
+/**
+ * @brief drawDocBounds outline the document, or cross out the middle of the
+ *        image when there is none yet
+ *
+ * @param img image to draw on
+ * @param quad document corners, empty when no document was found
+ */
+void drawDocBounds(cv::Mat& img, const std::vector<cv::Point>& quad);
+
+/**
+ * @brief drawDocBounds same as above, added to an overlay
+ *
+ * @param overlay overlay the outline is added to
+ * @param size size of the image the overlay is rendered on
+ * @param quad document corners, empty when no document was found
+ */
+void drawDocBounds(OverlayBuffer& overlay, cv::Size size, const std::vector<cv::Point>& quad);
+
+/**
+ * @brief wrapDoc function to wrap document image
+ * 
+ * @param input input image
+ * @param doc_bounds sorted document bounds
+ * @param width width of the document
+ * @param height height of the document
+ * @param crop crop the image
+ * @return Mat wrapped document image
+ */
+cv::Mat wrapDoc(cv::Mat input, std::vector<cv::Point> doc_bounds, float width=0, float height=0, bool crop=true);
+cv::Mat wrapDoc(cv::Mat input, std::vector<cv::Point2f> doc_bounds, float width=0, float height=0, bool crop=true);
+
+/**
+ * @brief wrapDoc same as above, through a warp engine that keeps its remap tables
+ *        while the bounds are stable and writes into a caller provided buffer
+ * 
+ * @param input input image
+ * @param doc_bounds sorted document bounds
+ * @param engine warp engine
+ * @param output wrapped document image
+ * @param width width of the document
+ * @param height height of the document
+ * @param crop crop the image
+ */
+void wrapDoc(const cv::Mat& input, const std::vector<cv::Point2f>& doc_bounds, WarpEngine& engine, cv::Mat& output, float width=0, float height=0, bool crop=true);
+
+struct DocTrackerParams {
+  bool tracking = true;             // false runs full detection on every frame
+  int redetect_interval = 30;       // frames between forced full detections
+  cv::Size window = cv::Size(21, 21);
+  int pyramid_levels = 3;
+  float max_error = 30;             // largest accepted optical flow error per corner
+  double max_area_change = 0.25;    // largest accepted relative change of the quad area per frame
+  int proxy_width = 960;            // detection runs on a copy downscaled to this width, 0 keeps full resolution
+  bool refine_corners = true;       // refine proxy corners at full resolution with sub-pixel accuracy
+};
+
+class DocTracker
+{
+public:
+  explicit DocTracker(const DocTrackerParams& params = DocTrackerParams(), const PreprocessParams& preprocess_params = docPreprocessParams());
+
+  /**
+   * @brief update locate the document in the next frame
+   *
+   * @param frame BGR frame
+   * @param quad document corners in this frame
+   * @return true if the document was found or tracked in this frame
+   */
+  bool update(const cv::Mat& frame, std::vector<cv::Point>& quad);
+
+  /**
+   * @brief update same as above with the edges already computed, for pipelines that
+   *        preprocess on another thread
+   *
+   * @param frame BGR frame
+   * @param edges preprocessed edges of makeDocProxy(frame)
+   * @param scale frame width over edges width
+   * @param quad document corners in this frame
+   * @return true if the document was found or tracked in this frame
+   */
+  bool update(const cv::Mat& frame, const cv::Mat& edges, double scale, std::vector<cv::Point>& quad);
+
+  const DocTrackerParams& params() const { return params_; }
+
+  // last document found, empty until the first detection
+  const std::vector<cv::Point>& lastQuad() const { return quad_; }
+  // same corners with sub-pixel accuracy
+  const std::vector<cv::Point2f>& lastCorners() const { return corners_; }
+
+  bool tracked() const { return tracked_; }
+  void reset();
+
+private:
+  bool detect(const cv::Mat& frame);
+  bool locate(const cv::Mat& frame, const cv::Mat& edges, double scale, const cv::Mat* gray);
+  bool track(const cv::Mat& frame);
+
+  DocTrackerParams params_;
+  Preprocessor preprocessor_;
+
+  cv::Mat gray_, proxy_;
+  std::vector<cv::Mat> prev_pyramid_, pyramid_;
+  std::vector<cv::Point2f> corners_;
+  std::vector<cv::Point> quad_;
+  int frames_since_detection_ = 0;
+  bool has_corners_ = false;
+  bool tracked_ = false;
+};
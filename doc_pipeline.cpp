@@ -0,0 +1,282 @@
+/**
+ * @file doc_pipeline.cpp
+ * @brief Stage-parallel live document scanner.
+ *
+ */
+
+#include "doc_pipeline.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "frame_pool.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+static const char* STAGE_NAMES[DOC_STAGES] = {"capture", "preprocess", "detect", "overlay", "display"};
+
+DocScanPipeline::DocScanPipeline(FrameSource& source, const DocPipelineParams& params)
+  : source_(source),
+    params_(params),
+    free_(max<size_t>(params.in_flight, 1) + 1),
+    captured_(max<size_t>(params.in_flight, 1) + 1),
+    preprocessed_(max<size_t>(params.in_flight, 1) + 1),
+    detected_(max<size_t>(params.in_flight, 1) + 1),
+    overlaid_(max<size_t>(params.in_flight, 1) + 1)
+{
+  for (int i = 0; i < DOC_STAGES; i++) {
+    done_[i] = false;
+    stats_[i].name = STAGE_NAMES[i];
+  }
+
+  // every queue holds all frames, so a push never has to wait; one frame more than
+  // in flight, the display keeps its frame until the next one has arrived
+  for (size_t i = 0; i < free_.capacity(); i++)
+    free_.push(DocFrame());
+
+  threads_.emplace_back(&DocScanPipeline::captureLoop, this);
+  threads_.emplace_back(&DocScanPipeline::preprocessLoop, this);
+  threads_.emplace_back(&DocScanPipeline::detectLoop, this);
+  threads_.emplace_back(&DocScanPipeline::overlayLoop, this);
+}
+
+DocScanPipeline::~DocScanPipeline()
+{
+  stop();
+  for (thread& worker : threads_)
+    worker.join();
+}
+
+void DocScanPipeline::stop()
+{
+  stopping_ = true;
+}
+
+/**
+ * @brief relay runs one stage: take a frame from the stage before, work on it and
+ *        pass it on, until the stage before is done and its queue is drained
+ */
+template <class Work>
+void DocScanPipeline::relay(DocStage stage, SpscQueue<DocFrame>& input, SpscQueue<DocFrame>& output, Work work)
+{
+  DocFrame item;
+  int attempt = 0;
+
+  while (true) {
+    if ( !input.pop(item) ) {
+      // everything pushed before done was set is visible, one more pop settles it
+      if ( !done_[stage - 1].load(memory_order_acquire) ) {
+        spscWait(attempt);
+        continue;
+      }
+      if ( !input.pop(item) )
+        break;
+    }
+    attempt = 0;
+
+    item.stage_start[stage] = trace::now();
+    {
+      // temporaries of the stage go back to the pool with the frame, the last
+      // stage closes the frame for the pool's counters
+      FrameScope scope(stage == DOC_OVERLAY);
+      work(item);
+    }
+    item.stage_end[stage] = trace::now();
+
+    output.push(move(item));
+  }
+
+  done_[stage].store(true, memory_order_release);
+}
+
+void DocScanPipeline::captureLoop()
+{
+  DocFrame item;
+  int attempt = 0;
+  uint64_t index = 0;
+
+  while ( !stopping_ ) {
+    // all frames are in flight, the pipeline is full
+    if ( !free_.pop(item) ) {
+      spscWait(attempt);
+      continue;
+    }
+    attempt = 0;
+
+    item.stage_start[DOC_CAPTURE] = trace::now();
+    bool ok;
+    {
+      TRACE_SPAN("scan.capture");
+      ok = source_.read(item.frame, &item.captured_at);
+    }
+    if ( !ok )
+      break;
+
+    // the stages draw on the frame
+    makeWritable(item.frame);
+    item.index = index++;
+    item.stage_end[DOC_CAPTURE] = trace::now();
+
+    captured_.push(move(item));
+  }
+
+  done_[DOC_CAPTURE].store(true, memory_order_release);
+}
+
+/**
+ * @brief preprocessLoop computes the edges of every frame, even the ones the
+ *        tracker follows without them: the stage has its own core, and the detect
+ *        stage never has to wait for a full detection
+ */
+void DocScanPipeline::preprocessLoop()
+{
+  Preprocessor preprocessor(params_.preprocess);
+  Mat proxy_buffer;
+
+  relay(DOC_PREPROCESS, captured_, preprocessed_, [&](DocFrame& item) {
+    TRACE_SPAN("scan.preprocess");
+    const Mat& proxy = makeDocProxy(item.frame, params_.tracker.proxy_width, proxy_buffer, item.scale);
+    preprocessor.run(proxy).copyTo(item.edges);
+  });
+}
+
+void DocScanPipeline::detectLoop()
+{
+  DocTracker tracker(params_.tracker, params_.preprocess);
+  vector<Point> quad;
+
+  relay(DOC_DETECT, preprocessed_, detected_, [&](DocFrame& item) {
+    TRACE_SPAN("scan.detect");
+    item.found = tracker.update(item.frame, item.edges, item.scale, quad);
+    item.quad = tracker.lastQuad();
+    item.corners = tracker.lastCorners();
+  });
+}
+
+void DocScanPipeline::overlayLoop()
+{
+  // keeps the remap tables while the document does not move
+  WarpEngine warp_engine;
+  OverlayBuffer overlay;
+
+  relay(DOC_OVERLAY, detected_, overlaid_, [&](DocFrame& item) {
+    TRACE_SPAN("scan.overlay");
+
+    // the page is rectified before the outline is drawn over it
+    if (params_.preview && item.corners.size() == 4)
+      wrapDoc(item.frame, sortDocBounds(item.corners), warp_engine, item.preview);
+    else
+      item.preview.release();
+
+    if (params_.annotate) {
+      overlay.clear();
+      drawDocBounds(overlay, item.frame.size(), item.quad);
+      renderOverlay(overlay, item.frame);
+    }
+  });
+}
+
+bool DocScanPipeline::next(DocFrame& frame)
+{
+  const int64_t now = trace::now();
+
+  // taken into a spare, at the end the caller keeps the frame it holds
+  DocFrame incoming;
+  int attempt = 0;
+  while ( !overlaid_.pop(incoming) ) {
+    if (done_[DOC_OVERLAY].load(memory_order_acquire)) {
+      if ( !overlaid_.pop(incoming) )
+        return false;
+      break;
+    }
+    spscWait(attempt);
+  }
+
+  // the previous frame is done being displayed
+  if (holding_) {
+    DocStageStats& display = stats_[DOC_DISPLAY];
+    double ms = (now - frame.stage_start[DOC_DISPLAY]) / 1e6;
+    display.mean_ms += (ms - display.mean_ms) / (display.frames + 1);
+    display.max_ms = max(display.max_ms, ms);
+    display.frames++;
+
+    swap(frame, incoming);
+    free_.push(move(incoming));
+  } else {
+    frame = move(incoming);
+  }
+
+  frame.stage_start[DOC_DISPLAY] = trace::now();
+  holding_ = true;
+  account(frame);
+  TRACE_LATENCY("scan.frame", frame.captured_at);
+
+  return true;
+}
+
+void DocScanPipeline::account(const DocFrame& frame)
+{
+  const SpscQueue<DocFrame>* queues[DOC_STAGES] = {&free_, &captured_, &preprocessed_, &detected_, &overlaid_};
+
+  for (int stage = 0; stage < DOC_STAGES; stage++) {
+    DocStageStats& current = stats_[stage];
+    current.queue_depth = queues[stage]->size();
+    current.max_queue_depth = max(current.max_queue_depth, current.queue_depth);
+
+    // the display stage is timed when its frame comes back
+    if (stage == DOC_DISPLAY)
+      continue;
+
+    double ms = (frame.stage_end[stage] - frame.stage_start[stage]) / 1e6;
+    double wait = stage > 0 ? (frame.stage_start[stage] - frame.stage_end[stage - 1]) / 1e6 : 0;
+    current.frames++;
+    current.mean_ms += (ms - current.mean_ms) / current.frames;
+    current.wait_ms += (wait - current.wait_ms) / current.frames;
+    current.max_ms = max(current.max_ms, ms);
+  }
+
+  // display waits are known once the frame is shown
+  DocStageStats& display = stats_[DOC_DISPLAY];
+  double display_wait = (frame.stage_start[DOC_DISPLAY] - frame.stage_end[DOC_OVERLAY]) / 1e6;
+  display.wait_ms += (display_wait - display.wait_ms) / (frames_ + 1);
+
+  if (frames_ == 0)
+    first_display_ = frame.stage_start[DOC_DISPLAY];
+  last_display_ = frame.stage_start[DOC_DISPLAY];
+  latency_sum_ms_ += (frame.stage_start[DOC_DISPLAY] - frame.captured_at) / 1e6;
+  frames_++;
+}
+
+DocPipelineStats DocScanPipeline::stats() const
+{
+  DocPipelineStats all;
+  all.stages.assign(stats_, stats_ + DOC_STAGES);
+  all.frames = frames_;
+
+  if (frames_ > 0)
+    all.latency_ms = latency_sum_ms_ / frames_;
+  if (frames_ > 1 && last_display_ > first_display_)
+    all.fps = (frames_ - 1) * 1e9 / (last_display_ - first_display_);
+
+  return all;
+}
+
+void printDocPipelineStats(const DocPipelineStats& stats)
+{
+  cout << left << setw(12) << "stage" << right
+       << setw(8) << "frames" << setw(10) << "mean ms" << setw(10) << "max ms"
+       << setw(10) << "wait ms" << setw(8) << "queue" << setw(10) << "max queue" << endl;
+
+  for (const DocStageStats& s : stats.stages) {
+    cout << left << setw(12) << s.name << right
+         << setw(8) << s.frames
+         << fixed << setprecision(2) << setw(10) << s.mean_ms << setw(10) << s.max_ms << setw(10) << s.wait_ms
+         << setw(8) << s.queue_depth << setw(10) << s.max_queue_depth << endl;
+  }
+
+  cout << "Frames: " << stats.frames << ", " << fixed << setprecision(1) << stats.fps << " fps, "
+       << stats.latency_ms << " ms capture to display" << endl;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file doc_pipeline.hpp
+ * @brief Stage-parallel live document scanner.
+ *        Capture, preprocess, quad detection and overlay each run on their own
+ *        thread and hand frames on through single-producer/single-consumer queues;
+ *        the display stage is the caller's thread, since HighGUI wants the main
+ *        thread. Throughput is set by the slowest stage instead of the sum of all
+ *        of them. A fixed set of frames circulates through the stages and back to
+ *        capture, so the buffers are reused and at most in_flight frames are queued.
+ *        Every stage takes its temporaries from the shared frame pool, one scope per frame.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "doc_detection.hpp"
+#include "frame_source.hpp"
+#include "spsc_queue.hpp"
+
+enum DocStage {
+  DOC_CAPTURE,
+  DOC_PREPROCESS,
+  DOC_DETECT,
+  DOC_OVERLAY,
+  DOC_DISPLAY,
+  DOC_STAGES
+};
+
+struct DocFrame {
+  cv::Mat frame;                    // annotated by the overlay stage
+  cv::Mat edges;                    // edges of the detection proxy
+  cv::Mat preview;                  // rectified page, empty when there is no document
+  double scale = 1;                 // frame width over edges width
+  std::vector<cv::Point> quad;      // last document found, empty before the first one
+  std::vector<cv::Point2f> corners; // same corners with sub-pixel accuracy
+  bool found = false;               // found or tracked in this frame
+  uint64_t index = 0;
+  int64_t captured_at = 0;
+  int64_t stage_start[DOC_STAGES] = {};
+  int64_t stage_end[DOC_STAGES] = {};
+};
+
+struct DocPipelineParams {
+  size_t in_flight = 4;             // frames in the pipeline at once, bounds the latency
+  bool preview = true;              // rectify the page in the overlay stage
+  bool annotate = true;             // outline the document, false skips drawing when headless
+  DocTrackerParams tracker;
+  PreprocessParams preprocess = docPreprocessParams();
+};
+
+struct DocStageStats {
+  std::string name;
+  uint64_t frames = 0;
+  double mean_ms = 0;               // time the stage spent on a frame
+  double max_ms = 0;
+  double wait_ms = 0;               // mean time a frame waited in the queue in front of the stage
+  size_t queue_depth = 0;           // frames waiting in front of the stage at the last sample
+  size_t max_queue_depth = 0;
+};
+
+struct DocPipelineStats {
+  std::vector<DocStageStats> stages;
+  uint64_t frames = 0;
+  double latency_ms = 0;            // mean capture to display
+  double fps = 0;
+};
+
+class DocScanPipeline
+{
+public:
+  /**
+   * @brief Construct a new Doc Scan Pipeline, the stages start right away
+   *
+   * @param source frame source, must outlive the pipeline
+   * @param params pipeline parameters
+   */
+  DocScanPipeline(FrameSource& source, const DocPipelineParams& params = DocPipelineParams());
+  ~DocScanPipeline();
+
+  DocScanPipeline(const DocScanPipeline&) = delete;
+  DocScanPipeline& operator=(const DocScanPipeline&) = delete;
+
+  /**
+   * @brief next take the next overlaid frame, display thread only. The frame handed
+   *        out by the previous call goes back to the capture stage, so keep a copy of
+   *        anything needed for longer.
+   *
+   * @param frame receives the frame and its detection, left as it was when there is none
+   * @return false once the source is exhausted or the pipeline was stopped
+   */
+  bool next(DocFrame& frame);
+
+  // stop capturing, the frames already in the pipeline are drained
+  void stop();
+
+  // display thread only
+  DocPipelineStats stats() const;
+
+private:
+  template <class Work>
+  void relay(DocStage stage, SpscQueue<DocFrame>& input, SpscQueue<DocFrame>& output, Work work);
+
+  void captureLoop();
+  void preprocessLoop();
+  void detectLoop();
+  void overlayLoop();
+  void account(const DocFrame& frame);
+
+  FrameSource& source_;
+  DocPipelineParams params_;
+
+  SpscQueue<DocFrame> free_;        // display -> capture
+  SpscQueue<DocFrame> captured_;    // capture -> preprocess
+  SpscQueue<DocFrame> preprocessed_;// preprocess -> detect
+  SpscQueue<DocFrame> detected_;    // detect -> overlay
+  SpscQueue<DocFrame> overlaid_;    // overlay -> display
+
+  std::atomic<bool> stopping_{false};
+  std::atomic<bool> done_[DOC_STAGES];
+  std::vector<std::thread> threads_;
+
+  bool holding_ = false;            // the caller holds a frame from next
+  DocStageStats stats_[DOC_STAGES];
+  uint64_t frames_ = 0;
+  double latency_sum_ms_ = 0;
+  int64_t first_display_ = 0;
+  int64_t last_display_ = 0;
+};
+
+/**
+ * @brief printDocPipelineStats print one line per stage
+ *
+ * @param stats pipeline statistics
+ */
+void printDocPipelineStats(const DocPipelineStats& stats);
@@ -9,182 +9,61 @@
  * 
  */
 
+#include <csignal>
 #include <iostream>
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <iomanip>
+#include <memory>
 #include <optional>
+#include <sstream>
+
+#include "doc_batch.hpp"
+#include "doc_detection.hpp"
+#include "doc_pipeline.hpp"
+#include "frame_pool.hpp"
+#include "frame_source.hpp"
+#include "overlay.hpp"
+#include "page_writer.hpp"
+#include "trace.hpp"
 
 using namespace std;
 using namespace cv;
 
 bool debug = true;
 
-const Scalar CYAN = Scalar(182, 196, 46);
-const Scalar RED = Scalar(84, 0, 255);
-
-// Invalid points type
-vector<Point> invalid_points = {Point(-1, -1)};
-
+static volatile sig_atomic_t stop_requested = 0;
 
-/**
- * @brief preprocess function to preprocess image
- * 
- * @param input input image
- * @return Mat preprocessed image
- */
-Mat preprocess(Mat input)
+// Ctrl-C leaves the camera loop, queued pages and the trace are still written,
+// a second one kills the process
+static void requestStop(int signal_number)
 {
-  Mat gray, blur, canny, dilated;
-  Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
-
-  int blur_size = 7;
-
-  cvtColor(input, gray, COLOR_BGR2GRAY);        // rgb to grayscale
-  GaussianBlur(gray, blur, Size(blur_size, blur_size), 3);      // blur
-  Canny(blur, canny, 25, 75);                   // edge detection
-  dilate(canny, dilated, kernel);               // dilation
-
-  return dilated;
+  stop_requested = 1;
+  std::signal(signal_number, SIG_DFL);
 }
 
+
 /**
  * @brief getDocBounds function to get document bounds
  * 
  * @param input input image
+ * @param tracker document tracker holding the state between frames
  * @return vector<Point> document bounds
  */
-vector<Point> getDocBounds(Mat input)
+vector<Point> getDocBounds(Mat input, DocTracker& tracker)
 {
-  vector<vector<Point>> contours;
-  vector<Vec4i> heirarchy;
-  static vector<Point> prev_doc_identified;
-  int likely_doc = -1;
-
-  Mat processed = preprocess(input);
-  findContours(processed, contours, heirarchy, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
-
-  vector<vector<Point>> min_polygon(contours.size());   // Minimum bounding box poligon, used to predict shape
-
-  for (int i = 0; i < contours.size(); i++) {
-
-    // draw contours
-    double area = contourArea(contours[i]);
-
-    if (area > 1000) {      // skip small contours
-      // Find minimum polygon, assume quadrilateral is document
-      double perimeter    = arcLength(contours[i], true);
-      approxPolyDP(contours[i], min_polygon[i], 0.02*perimeter, true);
-
-      if (min_polygon[i].size() == 4 && isContourConvex(min_polygon[i])) {
-        likely_doc = i;
-        prev_doc_identified = min_polygon[i];
-      }
-    }
-  }
-
-  if (likely_doc >= 0) {
-    drawContours(input, min_polygon, likely_doc, CYAN, 2);
-  } else if (prev_doc_identified.size() > 0) {
-    vector<vector<Point>> prev_doc_contour = {prev_doc_identified};
-    drawContours(input, prev_doc_contour, 0, CYAN, 2); 
-  } else {
-    // draw  small X mid screen
-    int x = input.cols / 2;
-    int y = input.rows / 2;
-    line(input, Point(x-50, y-50), Point(x+50, y+50), RED, 2);
-    line(input, Point(x-50, y+50), Point(x+50, y-50), RED, 2);
-
-    return invalid_points;
-  }
+  TRACE_SPAN("doc.getDocBounds");
+  vector<Point> doc_bounds;
 
-  return prev_doc_identified;
-}
+  // the last document found stays outlined while it is lost
+  tracker.update(input, doc_bounds);
+  drawDocBounds(input, tracker.lastQuad());
 
-/**
- * @brief sortDocBounds function to sort document bounds
- * 
- * @param doc_bounds document bounds
- * @return vector<Point> sorted document bounds
- */
-vector<Point> sortDocBounds(vector<Point> doc_bounds)
-{
-  if (doc_bounds.size() != 4) {
-    cout << "Invalid document bounds" << endl;
+  if (tracker.lastQuad().empty())
     return invalid_points;
-  }
-
-  vector<Point> sorted_bounds;
-  vector<int> sums, diffs;
-  int tl, tr, br, bl;
-
-  for (int i = 0; i < doc_bounds.size(); i++) {
-    sums.push_back( doc_bounds[i].x + doc_bounds[i].y );
-    diffs.push_back( doc_bounds[i].x - doc_bounds[i].y );
-  }
-
-  tl = min_element(sums.begin(), sums.end()) - sums.begin();
-  tr = max_element(diffs.begin(), diffs.end()) - diffs.begin();
-  bl = min_element(diffs.begin(), diffs.end()) - diffs.begin();
-  br = max_element(sums.begin(), sums.end()) - sums.begin();
-
-  sorted_bounds.push_back(doc_bounds[tl]);
-  sorted_bounds.push_back(doc_bounds[tr]);
-  sorted_bounds.push_back(doc_bounds[bl]);
-  sorted_bounds.push_back(doc_bounds[br]);
-
-  return sorted_bounds;
-}
-
-/**
- * @brief wrapDoc function to wrap document image
- * 
- * @param input input image
- * @param doc_bounds document bounds
- * @param width width of the document
- * @param height height of the document
- * @param crop crop the image
- * @return Mat wrapped document image
- */
-Mat wrapDoc(Mat input, vector<Point> doc_bounds, float width=0, float height=0, bool crop=true)
-{
-  if (doc_bounds.size() != 4) {
-    cout << "Invalid document bounds" << endl;
-    return input;
-  }
-
-  // estimate width and height from bounds
-  if (width <= 0 || height <= 0) {
-    int max_width = max(doc_bounds[1].x - doc_bounds[0].x, doc_bounds[3].x - doc_bounds[2].x);
-    int max_height = max(doc_bounds[2].y - doc_bounds[0].y, doc_bounds[3].y - doc_bounds[1].y);
-    width = (float) max_width;
-    height = (float) max_height;
-  }
-
-  Point doc_dim((int)width, (int)height);
-  Mat matrix, img_warp;
-
-  Point2f src_coord[4] = {doc_bounds[0], doc_bounds[1], doc_bounds[2], doc_bounds[3]};
-
-  Point2f dest_coord[4] = {
-    {0.0f, 0.0f},
-    {width, 0.0f},
-    {0.0f, height},
-    {width, height}
-  };
-  
-  // get transformation matrix and warp image
-  matrix = getPerspectiveTransform(src_coord, dest_coord);
-  warpPerspective(input, img_warp, matrix, doc_dim);
-
-  // crop image
-  if (crop) {
-    int crop_amount = 10;
-    Rect crop_region(crop_amount, crop_amount, (int) width-crop_amount*2, (int) height-crop_amount*2);
-    img_warp = img_warp(crop_region);
-  }
 
-  return img_warp;
+  return tracker.lastQuad();
 }
 
 /**
@@ -207,8 +86,75 @@ void mouseCallback(int event, int xPos, int yPos, int flags, void* userdata) {
 }
 
 
-int main()
+/**
+ * @brief savePage hand a rectified page to the writer without holding up the scan
+ *
+ * @param writer page writer, nothing is saved when null
+ * @param page rectified page
+ * @param count pages saved so far, names the page
+ */
+void savePage(PageWriter* writer, const Mat& page, int& count)
+{
+  if (writer == nullptr || page.empty())
+    return;
+
+  ostringstream name;
+  name << "page_" << setw(3) << setfill('0') << count;
+
+  if (writer->trySubmit(page, name.str())) {
+    count++;
+    if (debug) cout << "Saving " << writer->outputPath(name.str()) << endl;
+  } else {
+    cout << "Encoders busy, page dropped" << endl;
+  }
+}
+
+/**
+ * @brief main interactive scanner, or headless batch mode with
+ *        cv_doc_scanner --batch <dir|list|image> [--out dir] [--threads N] [--records csv|json],
+ *        --source <spec> scans from another source than camera 1, see openSource,
+ *        --sequential runs the live stages one after another instead of pipelined,
+ *        --save stores the scanned page to --out, and 's' stores the page on screen while
+ *        scanning; --format png|jpg|tiff, --color color|gray|binary, --container name.pdf
+ *        and --encoders N set how pages are stored, in batch mode too
+ */
+int main(int argc, char** argv)
 {
+  DocBatchOptions batch;
+  string source = "1";
+  bool sequential = false;
+  bool save = false;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--batch" && has_value) batch.input = argv[++i];
+    else if (arg == "--out" && has_value) batch.output_dir = argv[++i];
+    else if (arg == "--threads" && has_value) batch.threads = atoi(argv[++i]);
+    else if (arg == "--records" && has_value) batch.record_format = argv[++i];
+    else if (arg == "--proxy-width" && has_value) batch.proxy_width = atoi(argv[++i]);
+    else if (arg == "--source" && has_value) source = argv[++i];
+    else if (arg == "--sequential") sequential = true;
+    else if (arg == "--save") save = true;
+    else if (arg == "--format" && has_value && parsePageFormat(argv[i + 1], batch.pages.format)) i++;
+    else if (arg == "--color" && has_value && parsePageColor(argv[i + 1], batch.pages.color)) i++;
+    else if (arg == "--container" && has_value) batch.pages.container = argv[++i];
+    else if (arg == "--encoders" && has_value) batch.pages.encoders = atoi(argv[++i]);
+    else {
+      cout << "Usage: cv_doc_scanner [--source spec] [--sequential] [--save] [--batch <dir|list|image> [--threads N] [--records csv|json] [--proxy-width px]]"
+           << " [--out dir] [--format png|jpg|tiff] [--color color|gray|binary] [--container name.pdf] [--encoders N]" << endl;
+      return -1;
+    }
+  }
+
+  if ( !batch.input.empty() ) {
+    int result = runDocBatch(batch);
+    trace::flush();
+    return result;
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
   bool from_camera = true;
   bool running = true;
 
@@ -221,11 +167,72 @@ int main()
   Mat doc_original;
   Mat doc_scanned;
   vector<Point> doc_bounds;
+  vector<Point2f> doc_corners;
+
+  // keeps the remap tables while the document does not move
+  WarpEngine warp_engine;
+
+  // follow the document corners between frames, full detection every 30 frames or when lost
+  DocTracker tracker;
+
+  // pages are encoded and written on their own threads while scanning goes on
+  unique_ptr<PageWriter> writer;
+  int saved_pages = 0;
+  if (save || !batch.pages.container.empty()) {
+    PageWriterOptions page_options = batch.pages;
+    page_options.output_dir = batch.output_dir;
+    writer = make_unique<PageWriter>(page_options);
+    if ( !writer->isOpened() )
+      return -1;
+  }
+
+  if (from_camera && !sequential) {
+    // capture, preprocess, detection and overlay run on their own threads, this one displays
+    unique_ptr<FrameSource> cap = openSource(source);
+    DocFrame current;
+    {
+      DocScanPipeline pipeline(*cap);
+      int64_t report_at = trace::now();
+
+      while( !stop_requested && pipeline.next(current) ) {
+        if ( !current.preview.empty() )
+          imshow("Doc Preview", current.preview);
+        imshow(window, current.frame);
+
+        int key = waitKey(1);
+        if (key == 'q') {
+          running = false;
+          break;
+        }
+        if (key == 's')
+          savePage(writer.get(), current.preview, saved_pages);
+
+        // mouse click captures the frame on screen
+        if ( mouse_click_pos.x > 0 && mouse_click_pos.y > 0 )
+          break;
+
+        if (debug && trace::now() - report_at > 5000000000) {
+          printDocPipelineStats(pipeline.stats());
+          printFramePoolStats(FramePool::shared().stats());
+          report_at = trace::now();
+        }
+      }
+
+      pipeline.stop();
+      printDocPipelineStats(pipeline.stats());
+    }
 
-  if (from_camera) {
-    VideoCapture cap(1);
-    while(1) {
-      cap.read(doc_original);
+    doc_original = current.frame;
+    doc_bounds = current.quad.empty() ? invalid_points : current.quad;
+    doc_corners = current.corners;
+
+  } else if (from_camera) {
+    unique_ptr<FrameSource> cap = openSource(source);
+    while( !stop_requested && cap->read(doc_original) ) {
+      FrameScope frame_scope(true);
+
+      // the corner labels are drawn on the last frame
+      makeWritable(doc_original);
 
       // wait for mouse click to capture image
       if ( mouse_click_pos.x > 0 && mouse_click_pos.y > 0 )
@@ -234,36 +241,72 @@ int main()
       if (doc_original.empty())
         continue;
       
-      doc_bounds = getDocBounds(doc_original);
+      doc_bounds = getDocBounds(doc_original, tracker);
+
+      // live preview of the rectified page
+      if (doc_bounds != invalid_points) {
+        wrapDoc(doc_original, sortDocBounds(tracker.lastCorners()), warp_engine, doc_scanned);
+        if ( !doc_scanned.empty() )
+          imshow("Doc Preview", doc_scanned);
+      }
+
       imshow(window, doc_original);
-      if (waitKey(10) == 'q') {
+      int key = waitKey(10);
+      if (key == 'q') {
         running = false;
         break;
       }
+      if (key == 's' && doc_bounds != invalid_points)
+        savePage(writer.get(), doc_scanned, saved_pages);
     }
+    doc_corners = tracker.lastCorners();
+    if (debug) printFramePoolStats(FramePool::shared().stats());
   
   } else {
     string path = "./Resources/paper.jpg";
     doc_original = imread(path);
+    doc_bounds = getDocBounds(doc_original, tracker);
+    doc_corners = tracker.lastCorners();
+  }
+
+  // stopped from the terminal: nothing to capture, only finish the queued pages
+  if (stop_requested) {
+    if (writer) {
+      writer->close();
+      printPageWriterStats(writer->stats());
+    }
+    trace::flush();
+    return 0;
   }
 
   if (doc_bounds == invalid_points) {
     cout << "Invalid document bounds" << endl;
+    trace::flush();
     return -1;
   }
 
+  // warp with the sub-pixel corners refined at full resolution
+  doc_corners = sortDocBounds(doc_corners);
   doc_bounds = sortDocBounds(doc_bounds);
-  doc_scanned = wrapDoc(doc_original, doc_bounds);
+  wrapDoc(doc_original, doc_corners, warp_engine, doc_scanned);
+  savePage(writer.get(), doc_scanned, saved_pages);
 
   if (debug) {
+    OverlayBuffer overlay;
     for (int i = 0; i < doc_bounds.size(); i++) {
-      putText(doc_original, to_string(i), doc_bounds[i], FONT_HERSHEY_PLAIN, 2, Scalar(255, 255, 0), 2);
+      overlay.addText(to_string(i), doc_bounds[i], Scalar(255, 255, 0), 2, 2);
     }
+    renderOverlay(overlay, doc_original);
   }
 
   imshow(window, doc_scanned);
   waitKey(0);
 
-  
+  if (writer) {
+    writer->close();
+    printPageWriterStats(writer->stats());
+  }
+
+  trace::flush();
   return 0;
 }
\ No newline at end of file
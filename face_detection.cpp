@@ -1,61 +1,307 @@
+#include <atomic>
+#include <csignal>
 #include <iostream>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/objdetect.hpp>
 
+#include "face_detector.hpp"
+#include "face_tracker.hpp"
+#include "frame_source.hpp"
+#include "multi_cascade.hpp"
+#include "overlay.hpp"
+#include "stream_scheduler.hpp"
+#include "trace.hpp"
+
 using namespace cv;
 using namespace std;
 
-void detectFaces(int camera_index, string cascade_path)
+static volatile sig_atomic_t stop_requested = 0;
+
+// Ctrl-C ends the loops so the trace is still written, a second one kills the process
+static void requestStop(int signal_number)
+{
+  stop_requested = 1;
+  std::signal(signal_number, SIG_DFL);
+}
+
+/**
+ * @brief showAnnotated hand the frame and its overlay to the renderer and show the
+ *        frames it has finished, the overlay is left empty for the next frame
+ *
+ * @param renderer overlay renderer
+ * @param frame frame to annotate
+ * @param overlay annotations of the frame
+ * @return false once 'q' was pressed or Ctrl-C asked to stop
+ */
+static bool showAnnotated(OverlayRenderer& renderer, const Mat& frame, OverlayBuffer& overlay)
 {
-  VideoCapture cap(camera_index);
-  Mat img;
+  renderer.submit(frame, overlay);
+
+  Mat shown;
+  while (renderer.collect(shown))
+    if ( !renderer.headless() )
+      imshow("Video", shown);
+  return waitKey(1) != 'q' && !stop_requested;
+}
+
+/**
+ * @brief detectFaces run the cascade on every frame
+ *
+ * @param source source spec, see openSource
+ * @param cascade_path face cascade
+ * @param overlay_mode how the annotations are rendered
+ */
+void detectFaces(string source, string cascade_path, OverlayMode overlay_mode)
+{
+  unique_ptr<FrameSource> cap = openSource(source);
+  if ( !cap->isOpened() )
+    return;
+  // the renderer may still draw on the previous frame while the next one is read
+  Mat frames[2];
+  int64_t captured_at = 0;
+  OverlayRenderer renderer(overlay_mode);
+  OverlayBuffer overlay;
+
+  // load cascade once, detect on a 640px wide grayscale copy of each frame
+  FaceDetectorParams params;
+  params.detection_width = 640;
+
+  FaceDetector detector(cascade_path, params);
+  if ( detector.empty() )
+    return;
   
-  while(1) {
-    cap.read(img);
-
-    if (img.empty())
-      return;
-    
-    // load cascade
-    CascadeClassifier faceCascade;
-    faceCascade.load(cascade_path);
-    if ( faceCascade.empty() ) {
-      cout << "Could not load cascade: " << cascade_path << endl;
-      return;
-    }
+  // reused between frames, detect clears it
+  vector<Rect> faces;
+
+  for (uint64_t n = 0; cap->read(frames[n % 2], &captured_at); n++) {
+    Mat& img = frames[n % 2];
 
     // detect faces
-    vector<Rect> faces;
-    faceCascade.detectMultiScale(img, faces, 1.1, 1);
+    detector.detect(img, faces);
+    makeWritable(img);
 
     // draw bounding box
     for (int i = 0; i < faces.size(); i++) {
-      string text =  "Face " + to_string(i+1);
-      rectangle(img, faces[i].tl(), faces[i].br(), Scalar(0, 255, 0), 1);
-      putText(
-        img, 
-        text,
-        { faces[i].x, faces[i].y - 2 }, 
-        FONT_HERSHEY_PLAIN, 
-        1.2,
-        Scalar(0, 255, 0),
-        1
-      );
+      overlay.addRect(faces[i], Scalar(0, 255, 0), 1);
+      overlay.addText("Face " + to_string(i+1), { faces[i].x, faces[i].y - 2 }, Scalar(0, 255, 0), 1.2, 1);
     }
 
-    imshow("Video", img);
-    waitKey(1);
+    overlay.addText(format("%.1f fps", detector.fps()), { 10, 20 }, Scalar(0, 255, 0), 1.2, 1);
+
+    if ( !showAnnotated(renderer, img, overlay) )
+      break;
+    TRACE_LATENCY("face.frame", captured_at);
   }
 
 }
 
-int main()
+/**
+ * @brief trackFaces run the cascade every few frames and track the faces in between,
+ *        faces keep their id while they are tracked
+ *
+ * @param source source spec, see openSource
+ * @param cascade_path face cascade
+ * @param overlay_mode how the annotations are rendered
+ */
+void trackFaces(string source, string cascade_path, OverlayMode overlay_mode)
+{
+  unique_ptr<FrameSource> cap = openSource(source);
+  if ( !cap->isOpened() )
+    return;
+  Mat frames[2];
+  int64_t captured_at = 0;
+  OverlayRenderer renderer(overlay_mode);
+  OverlayBuffer overlay;
+
+  FaceDetectorParams params;
+  params.detection_width = 640;
+
+  FaceTracker tracker(cascade_path, params);
+  if ( tracker.empty() )
+    return;
+
+  for (uint64_t n = 0; cap->read(frames[n % 2], &captured_at); n++) {
+    Mat& img = frames[n % 2];
+
+    const vector<TrackedFace>& faces = tracker.update(img);
+    makeWritable(img);
+
+    for (const TrackedFace& face : faces) {
+      overlay.addRect(face.box, Scalar(0, 255, 0), 1);
+      overlay.addText("Face " + to_string(face.id), { face.box.x, face.box.y - 2 }, Scalar(0, 255, 0), 1.2, 1);
+    }
+
+    overlay.addText(format("%.1f fps", tracker.fps()), { 10, 20 }, Scalar(0, 255, 0), 1.2, 1);
+
+    if ( !showAnnotated(renderer, img, overlay) )
+      break;
+    TRACE_LATENCY("face.frame", captured_at);
+  }
+}
+
+/**
+ * @brief detectFacesAndPlates detect faces and license plates over one shared pyramid
+ *
+ * @param source source spec, see openSource
+ * @param face_cascade_path face cascade
+ * @param plate_cascade_path plate cascade
+ * @param plates_dir directory plate crops are saved to, empty disables saving
+ * @param overlay_mode how the annotations are rendered
+ */
+void detectFacesAndPlates(string source, string face_cascade_path, string plate_cascade_path, string plates_dir, OverlayMode overlay_mode)
+{
+  unique_ptr<FrameSource> cap = openSource(source);
+  if ( !cap->isOpened() )
+    return;
+  Mat frames[2];
+  int64_t captured_at = 0;
+  OverlayRenderer renderer(overlay_mode);
+  OverlayBuffer overlay;
+
+  CascadeSpec face = {"Face", face_cascade_path};
+  CascadeSpec plate = {"Plate", plate_cascade_path};
+
+  MultiCascadeParams params;
+  params.detection_width = 640;
+
+  MultiCascadeDetector detector({face, plate}, params);
+  if ( detector.empty() )
+    return;
+
+  const Scalar colors[2] = {Scalar(0, 255, 0), Scalar(255, 0, 255)};
+  const int save_interval = 30;   // frames between two saved sets of plate crops
+  int frame_count = 0;
+  int plate_count = 0;
+
+  for (uint64_t n = 0; cap->read(frames[n % 2], &captured_at); n++) {
+    Mat& img = frames[n % 2];
+
+    vector<vector<Rect>> hits;
+    detector.detect(img, hits);
+
+    // crop before drawing so the saved plates are clean
+    if ( !plates_dir.empty() && !hits[1].empty() && frame_count % save_interval == 0 ) {
+      for (const Rect& hit : hits[1]) {
+        Rect crop = hit & Rect(0, 0, img.cols, img.rows);
+        if (crop.area() > 0)
+          imwrite(plates_dir + "/plate_" + to_string(plate_count++) + ".png", img(crop));
+      }
+    }
+    frame_count++;
+
+    makeWritable(img);
+    for (size_t c = 0; c < hits.size(); c++) {
+      for (int i = 0; i < hits[c].size(); i++) {
+        overlay.addRect(hits[c][i], colors[c], 1);
+        overlay.addText(detector.spec(c).name + " " + to_string(i+1), { hits[c][i].x, hits[c][i].y - 2 }, colors[c], 1.2, 1);
+      }
+    }
+
+    overlay.addText(format("%.1f fps", detector.fps()), { 10, 20 }, Scalar(0, 255, 0), 1.2, 1);
+
+    if ( !showAnnotated(renderer, img, overlay) )
+      break;
+    TRACE_LATENCY("multi.frame", captured_at);
+  }
+}
+
+/**
+ * @brief detectFacesInStreams headless face detection over many streams on one shared pool
+ *
+ * @param sources camera indices, video files or .cvraw recordings
+ * @param cascade_path face cascade
+ * @param params workers, core pinning and queue bound
+ * @param seconds run time limit, 0 runs until every source ends
+ */
+void detectFacesInStreams(const vector<string>& sources, string cascade_path, const SchedulerParams& params, double seconds)
+{
+  StreamScheduler scheduler(cascade_path, params);
+
+  for (const string& source : sources)
+    scheduler.addStream({source, source});
+
+  if (scheduler.size() == 0)
+    return;
+
+  // the signal handler can only set the flag, stopping the scheduler takes its lock
+  atomic<bool> finished{false};
+  thread watcher([&]() {
+    while ( !finished ) {
+      if (stop_requested)
+        scheduler.stop();
+      this_thread::sleep_for(chrono::milliseconds(100));
+    }
+  });
+
+  scheduler.run(seconds, 2.0);
+
+  finished = true;
+  watcher.join();
+}
+
+int main(int argc, char** argv)
 {
   string cascade_path   = "./Resources/haarcascade_frontalface_default.xml";
+  string plate_path     = "./Resources/haarcascade_russian_plate_number.xml";
+  string plates_dir     = "./Resources/Plates";
   string image_path     = "./Resources/test.png";
 
-  detectFaces(0, cascade_path);
+  // --source <spec> reads from a file, image sequence, synthetic pattern, recording or
+  // shared memory ring instead of camera 0, see openSource
+  string source         = "0";
+
+  // --plates adds license plates to the face detection, --save-plates also crops them into Resources/Plates,
+  // --track runs the cascade every few frames and tracks the faces in between
+  bool plates = false;
+  bool save_plates = false;
+  bool track = false;
+
+  // --overlay thread renders the annotations on their own thread, --overlay off skips them
+  OverlayMode overlay_mode = OverlayMode::INLINE;
+
+  // --stream <source> (repeatable) runs the headless multi-stream scheduler,
+  // with --workers N, --pin and --seconds N
+  vector<string> streams;
+  SchedulerParams scheduler_params;
+  scheduler_params.detector.detection_width = 640;
+  double seconds = 0;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--plates")
+      plates = true;
+    else if (arg == "--save-plates")
+      plates = save_plates = true;
+    else if (arg == "--track")
+      track = true;
+    else if (arg == "--source" && i + 1 < argc)
+      source = argv[++i];
+    else if (arg == "--stream" && i + 1 < argc)
+      streams.push_back(argv[++i]);
+    else if (arg == "--workers" && i + 1 < argc)
+      scheduler_params.workers = atoi(argv[++i]);
+    else if (arg == "--pin")
+      scheduler_params.pin_cores = true;
+    else if (arg == "--seconds" && i + 1 < argc)
+      seconds = atof(argv[++i]);
+    else if (arg == "--overlay" && i + 1 < argc && parseOverlayMode(argv[i + 1], overlay_mode))
+      i++;
+  }
+
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  if ( !streams.empty() )
+    detectFacesInStreams(streams, cascade_path, scheduler_params, seconds);
+  else if (plates)
+    detectFacesAndPlates(source, cascade_path, plate_path, save_plates ? plates_dir : "", overlay_mode);
+  else if (track)
+    trackFaces(source, cascade_path, overlay_mode);
+  else
+    detectFaces(source, cascade_path, overlay_mode);
 
+  // every worker, capture and renderer thread has been joined by now
+  trace::flush();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,181 @@
+/**
+ * @file face_detector.cpp
+ * @brief Reusable cascade face detector.
+ *
+ */
+
+#include "face_detector.hpp"
+
+#include <iostream>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+// same grouping epsilon CascadeClassifier::detectMultiScale uses internally
+const double GROUP_EPS = 0.2;
+
+FaceDetector::FaceDetector(const string& cascade_path, const FaceDetectorParams& params)
+  : params_(params)
+{
+  size_t num_bands = params_.num_threads > 0 ? params_.num_threads : max(1u, thread::hardware_concurrency());
+
+  // load the cascades once up front; CascadeClassifier copies share their internal
+  // state, so every band gets its own instance
+  CascadeClassifier cascade;
+  if ( !cascade.load(cascade_path) ) {
+    cout << "Could not load cascade: " << cascade_path << endl;
+    return;
+  }
+  window_ = cascade.getOriginalWindowSize();
+
+  cascades_.push_back(cascade);
+  for (size_t i = 1; i < num_bands; i++) {
+    CascadeClassifier band_cascade;
+    band_cascade.load(cascade_path);
+    cascades_.push_back(band_cascade);
+  }
+
+  // one band runs on the calling thread, a pool would only add a hop per frame
+  if (num_bands > 1)
+    pool_ = make_unique<ThreadPool>(num_bands);
+}
+
+/**
+ * @brief planBands splits the scale pyramid into contiguous bands of roughly equal cost.
+ *        The cost of a scale is the number of window positions, which shrinks with
+ *        the square of the scale factor, so the first bands hold fewer scales.
+ *
+ * @param image_size size of the image the cascade runs on
+ * @param frame_size size of the frame it was downscaled from
+ */
+void FaceDetector::planBands(Size image_size, Size frame_size)
+{
+  bands_.clear();
+  planned_size_ = image_size;
+  planned_frame_size_ = frame_size;
+
+  Size min_size = window_;
+  Size max_size = image_size;
+  const double to_detection = image_size.width / (double) frame_size.width;
+
+  if (params_.min_size.area() > 0)
+    min_size = Size(cvRound(params_.min_size.width * to_detection), cvRound(params_.min_size.height * to_detection));
+  if (params_.max_size.area() > 0)
+    max_size = Size(cvRound(params_.max_size.width * to_detection), cvRound(params_.max_size.height * to_detection));
+
+  // enumerate scales the same way detectMultiScale does
+  vector<Size> windows;
+  vector<double> costs;
+  double total_cost = 0;
+  for (double factor = 1; ; factor *= params_.scale_factor) {
+    Size window(cvRound(window_.width * factor), cvRound(window_.height * factor));
+    if (window.width > max_size.width || window.height > max_size.height)
+      break;
+    if (window.width > image_size.width || window.height > image_size.height)
+      break;
+    if (window.width < min_size.width || window.height < min_size.height)
+      continue;
+
+    double cost = (image_size.width / factor) * (image_size.height / factor);
+    windows.push_back(window);
+    costs.push_back(cost);
+    total_cost += cost;
+  }
+
+  if (windows.empty())
+    return;
+
+  // cut into contiguous bands, never between two scales that round to the same window
+  double band_cost = total_cost / cascades_.size();
+  double accumulated = 0;
+  Band band = { windows[0], windows[0] };
+  for (size_t i = 0; i < windows.size(); i++) {
+    bool same_window = windows[i] == band.max_size;
+    if (i > 0 && !same_window && accumulated >= band_cost && bands_.size() + 1 < cascades_.size()) {
+      bands_.push_back(band);
+      band = { windows[i], windows[i] };
+      accumulated = 0;
+    }
+    band.max_size = windows[i];
+    accumulated += costs[i];
+  }
+  bands_.push_back(band);
+
+  band_hits_.resize(bands_.size());
+}
+
+void FaceDetector::detect(const Mat& frame, vector<Rect>& faces)
+{
+  TRACE_SPAN("face.detect");
+  auto start = chrono::steady_clock::now();
+  faces.clear();
+
+  if (empty() || frame.empty())
+    return;
+
+  if (frame.channels() == 1)
+    frame.copyTo(gray_);
+  else
+    cvtColor(frame, gray_, COLOR_BGR2GRAY);
+
+  Mat detection = gray_;
+  if (params_.detection_width > 0 && params_.detection_width < gray_.cols) {
+    double ratio = params_.detection_width / (double) gray_.cols;
+    resize(gray_, small_, Size(), ratio, ratio, INTER_AREA);
+    detection = small_;
+  }
+
+  if (detection.size() != planned_size_ || gray_.size() != planned_frame_size_)
+    planBands(detection.size(), gray_.size());
+
+  // raw candidates from every band, grouped together afterwards so the
+  // result matches a single detectMultiScale call over the whole pyramid
+  auto scanBand = [this, &detection](size_t i) {
+    TRACE_SPAN("face.band");
+    band_hits_[i].clear();
+    cascades_[i].detectMultiScale(
+      detection,
+      band_hits_[i],
+      params_.scale_factor,
+      0,
+      0,
+      bands_[i].min_size,
+      bands_[i].max_size
+    );
+  };
+
+  if (bands_.size() == 1 || !pool_) {
+    for (size_t i = 0; i < bands_.size(); i++)
+      scanBand(i);
+  } else {
+    vector<future<void>> pending;
+    for (size_t i = 0; i < bands_.size(); i++)
+      pending.push_back(pool_->submit([&scanBand, i]() { scanBand(i); }));
+    for (future<void>& band : pending)
+      band.get();
+  }
+
+  for (const vector<Rect>& hits : band_hits_)
+    faces.insert(faces.end(), hits.begin(), hits.end());
+
+  groupRectangles(faces, params_.min_neighbors, GROUP_EPS);
+
+  // map boxes back to full resolution
+  if (detection.data != gray_.data) {
+    double to_frame = gray_.cols / (double) detection.cols;
+    for (Rect& face : faces) {
+      face = Rect(
+        cvRound(face.x * to_frame),
+        cvRound(face.y * to_frame),
+        cvRound(face.width * to_frame),
+        cvRound(face.height * to_frame)
+      );
+    }
+  }
+
+  last_latency_ms_ = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  double current_fps = 1000.0 / max(last_latency_ms_, 1e-3);
+  fps_ = fps_ > 0 ? 0.9 * fps_ + 0.1 * current_fps : current_fps;
+}
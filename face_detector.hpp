@@ -0,0 +1,69 @@
+/**
+ * @file face_detector.hpp
+ * @brief Reusable cascade face detector.
+ *        The cascade is loaded once, frames are converted to grayscale (optionally
+ *        downscaled) and the scale pyramid is split into bands evaluated in parallel.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+struct FaceDetectorParams {
+  double scale_factor = 1.1;
+  int min_neighbors = 1;
+  int detection_width = 0;      // width frames are downscaled to before detection, 0 keeps full resolution
+  cv::Size min_size;            // in full resolution pixels
+  cv::Size max_size;            // in full resolution pixels
+  int num_threads = 0;          // number of pyramid bands, 0 uses the hardware concurrency
+};
+
+class FaceDetector
+{
+public:
+  FaceDetector(const std::string& cascade_path, const FaceDetectorParams& params = FaceDetectorParams());
+
+  bool empty() const { return cascades_.empty(); }
+
+  /**
+   * @brief detect faces in a BGR or grayscale frame
+   *
+   * @param frame input frame
+   * @param faces face boxes in full resolution frame coordinates
+   */
+  void detect(const cv::Mat& frame, std::vector<cv::Rect>& faces);
+
+  double fps() const { return fps_; }
+  double lastLatencyMs() const { return last_latency_ms_; }
+  const FaceDetectorParams& params() const { return params_; }
+
+private:
+  struct Band {
+    cv::Size min_size;
+    cv::Size max_size;
+  };
+
+  void planBands(cv::Size image_size, cv::Size frame_size);
+
+  FaceDetectorParams params_;
+  std::vector<cv::CascadeClassifier> cascades_;   // one per band, a classifier is not safe to share between threads
+  std::unique_ptr<ThreadPool> pool_;             // only with more than one band, a single band runs inline
+  std::vector<Band> bands_;
+  std::vector<std::vector<cv::Rect>> band_hits_;
+  cv::Size planned_size_;
+  cv::Size planned_frame_size_;   // the size limits are scaled from this frame size
+  cv::Size window_;
+
+  cv::Mat gray_, small_;
+
+  double fps_ = 0;
+  double last_latency_ms_ = 0;
+};
@@ -0,0 +1,245 @@
+/**
+ * @file face_tracker.cpp
+ * @brief Detect-then-track face mode.
+ *
+ */
+
+#include "face_tracker.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <iostream>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+static Rect expandRect(const Rect& box, float margin, Size bounds)
+{
+  int dx = cvRound(box.width * margin);
+  int dy = cvRound(box.height * margin);
+  return Rect(box.x - dx, box.y - dy, box.width + 2 * dx, box.height + 2 * dy) & Rect(Point(0, 0), bounds);
+}
+
+static Rect scaleRect(const Rect& box, double scale)
+{
+  return Rect(cvRound(box.x * scale), cvRound(box.y * scale), cvRound(box.width * scale), cvRound(box.height * scale));
+}
+
+static double overlap(const Rect& a, const Rect& b)
+{
+  double intersection = (a & b).area();
+  double area = a.area() + b.area() - intersection;
+  return area > 0 ? intersection / area : 0;
+}
+
+FaceTracker::FaceTracker(const string& cascade_path, const FaceDetectorParams& detector_params, const FaceTrackerParams& params)
+  : params_(params), detector_(cascade_path, detector_params)
+{
+  params_.redetect_interval = max(params_.redetect_interval, 1);
+  params_.roi_interval = max(params_.roi_interval, 1);
+
+  // the region re-detection is small and runs on the calling thread
+  roi_cascade_.load(cascade_path);
+}
+
+void FaceTracker::reset()
+{
+  tracks_.clear();
+  faces_.clear();
+  frame_count_ = 0;
+  force_full_ = true;
+}
+
+const vector<TrackedFace>& FaceTracker::update(const Mat& frame)
+{
+  TRACE_SPAN("face.track");
+  auto start = chrono::steady_clock::now();
+
+  faces_.clear();
+  if (empty() || frame.empty())
+    return faces_;
+
+  if (frame.channels() == 1)
+    frame.copyTo(gray_);
+  else
+    cvtColor(frame, gray_, COLOR_BGR2GRAY);
+
+  to_small_ = 1.0;
+  if (params_.tracking_width > 0 && params_.tracking_width < gray_.cols)
+    to_small_ = params_.tracking_width / (double) gray_.cols;
+  if (to_small_ < 1.0)
+    resize(gray_, small_, Size(), to_small_, to_small_, INTER_AREA);
+  else
+    small_ = gray_;
+
+  last_full_ = force_full_ || frame_count_ % params_.redetect_interval == 0;
+  force_full_ = false;
+  frame_count_++;
+
+  if (last_full_) {
+    detectFull();
+  } else {
+    bool roi_frame = frame_count_ % params_.roi_interval == 0;
+
+    for (Track& track : tracks_) {
+      bool tracked = trackTemplate(track);
+      bool detected = (roi_frame || !tracked) && detectAround(track);
+
+      track.located = tracked || detected;
+      if (detected)
+        track.face.missed = 0;
+      else if ( !tracked )
+        track.face.missed++;
+
+      // a lost face brings the full frame cascade back on the next frame
+      if ( !track.located )
+        force_full_ = true;
+    }
+  }
+
+  tracks_.erase(remove_if(tracks_.begin(), tracks_.end(), [&](const Track& track) {
+    return track.face.missed > params_.max_missed;
+  }), tracks_.end());
+
+  for (const Track& track : tracks_)
+    if (track.located)
+      faces_.push_back(track.face);
+
+  double latency_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  double current_fps = 1000.0 / max(latency_ms, 1e-3);
+  fps_ = fps_ > 0 ? 0.9 * fps_ + 0.1 * current_fps : current_fps;
+
+  return faces_;
+}
+
+void FaceTracker::detectFull()
+{
+  vector<Rect> detections;
+  detector_.detect(gray_, detections);
+  associate(detections);
+}
+
+/**
+ * @brief associate hand detections to the tracks they overlap most, unmatched
+ *        detections start new ids and unmatched tracks fall back to template matching
+ */
+void FaceTracker::associate(const vector<Rect>& detections)
+{
+  vector<bool> matched(tracks_.size(), false);
+
+  for (const Rect& detection : detections) {
+    int best = -1;
+    double best_overlap = params_.match_iou;
+    for (size_t t = 0; t < tracks_.size(); t++) {
+      double current = overlap(detection, tracks_[t].face.box);
+      if ( !matched[t] && current > best_overlap ) {
+        best = (int)t;
+        best_overlap = current;
+      }
+    }
+
+    if (best < 0) {
+      Track track;
+      track.face.id = next_id_++;
+      tracks_.push_back(track);
+      matched.push_back(true);
+      best = (int)tracks_.size() - 1;
+    }
+
+    Track& track = tracks_[best];
+    matched[best] = true;
+    track.face.box = detection;
+    track.face.missed = 0;
+    track.face.score = 1.0;
+    track.located = true;
+    setTemplate(track);
+  }
+
+  for (size_t t = 0; t < tracks_.size(); t++) {
+    if (matched[t])
+      continue;
+    tracks_[t].located = trackTemplate(tracks_[t]);
+    tracks_[t].face.missed++;
+  }
+}
+
+void FaceTracker::setTemplate(Track& track)
+{
+  Rect patch = scaleRect(track.face.box, to_small_) & Rect(Point(0, 0), small_.size());
+  if (patch.area() > 0)
+    small_(patch).copyTo(track.templ);
+}
+
+bool FaceTracker::trackTemplate(Track& track)
+{
+  if (track.templ.empty())
+    return false;
+
+  Rect box = scaleRect(track.face.box, to_small_);
+  Rect search = expandRect(box, params_.search_margin, small_.size());
+  if (search.width < track.templ.cols || search.height < track.templ.rows)
+    return false;
+
+  matchTemplate(small_(search), track.templ, match_, TM_CCOEFF_NORMED);
+
+  double score;
+  Point location;
+  minMaxLoc(match_, nullptr, &score, nullptr, &location);
+  track.face.score = score;
+  if (score < params_.min_score)
+    return false;
+
+  // only the position moves, the size is refreshed by the next detection
+  Point moved = search.tl() + location;
+  track.face.box.x = cvRound(moved.x / to_small_);
+  track.face.box.y = cvRound(moved.y / to_small_);
+
+  return true;
+}
+
+bool FaceTracker::detectAround(Track& track)
+{
+  const Rect& box = track.face.box;
+  Rect roi = expandRect(box, params_.roi_margin, gray_.size());
+  if (roi.area() == 0)
+    return false;
+
+  // the face can only have changed size a little since it was last seen
+  Size min_size(cvRound(box.width * 0.7), cvRound(box.height * 0.7));
+  Size max_size(min(roi.width, cvRound(box.width * 1.4)), min(roi.height, cvRound(box.height * 1.4)));
+
+  vector<Rect> hits;
+  roi_cascade_.detectMultiScale(
+    gray_(roi),
+    hits,
+    detector_.params().scale_factor,
+    detector_.params().min_neighbors,
+    0,
+    min_size,
+    max_size
+  );
+  if (hits.empty())
+    return false;
+
+  // the hit closest to where the face was
+  Point center(box.x + box.width / 2, box.y + box.height / 2);
+  Rect best = hits[0];
+  double best_distance = DBL_MAX;
+  for (const Rect& hit : hits) {
+    Point offset(roi.x + hit.x + hit.width / 2 - center.x, roi.y + hit.y + hit.height / 2 - center.y);
+    double distance = offset.dot(offset);
+    if (distance < best_distance) {
+      best_distance = distance;
+      best = hit;
+    }
+  }
+
+  track.face.box = best + roi.tl();
+  track.face.score = 1.0;
+  setTemplate(track);
+
+  return true;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file face_tracker.hpp
+ * @brief Detect-then-track face mode.
+ *        The full frame cascade only runs every few frames or after a track was lost.
+ *        In between every face is followed by template matching inside a small search
+ *        window, and the cascade is re-run only inside expanded regions around the
+ *        known faces. Faces keep their id for as long as they are tracked.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect.hpp>
+#include <string>
+#include <vector>
+
+#include "face_detector.hpp"
+
+struct FaceTrackerParams {
+  int redetect_interval = 15;     // frames between two full frame detections
+  int roi_interval = 5;           // frames between two re-detections around the known faces
+  int tracking_width = 320;       // width of the frame copy template matching runs on
+  float search_margin = 0.3f;     // search window grows the face by this fraction per side
+  float roi_margin = 0.5f;        // re-detection region grows the face by this fraction per side
+  double min_score = 0.6;         // normalized correlation below which a track counts as lost
+  double match_iou = 0.3;         // overlap needed to give a detection an existing id
+  int max_missed = 5;             // frames a face may go undetected before its id is dropped
+};
+
+struct TrackedFace {
+  int id;
+  cv::Rect box;                   // full resolution frame coordinates
+  int missed = 0;                 // consecutive frames without a detection or good match
+  double score = 1.0;             // last template match score
+};
+
+class FaceTracker
+{
+public:
+  FaceTracker(
+    const std::string& cascade_path,
+    const FaceDetectorParams& detector_params = FaceDetectorParams(),
+    const FaceTrackerParams& params = FaceTrackerParams()
+  );
+
+  bool empty() const { return detector_.empty() || roi_cascade_.empty(); }
+
+  /**
+   * @brief update the faces with a new frame
+   *
+   * @param frame BGR or grayscale frame
+   * @return const std::vector<TrackedFace>& faces with stable ids
+   */
+  const std::vector<TrackedFace>& update(const cv::Mat& frame);
+
+  const std::vector<TrackedFace>& faces() const { return faces_; }
+  bool lastWasFullDetection() const { return last_full_; }
+  double fps() const { return fps_; }
+
+  void reset();
+
+private:
+  struct Track {
+    TrackedFace face;
+    cv::Mat templ;                // face patch on the tracking frame
+    bool located = false;         // found by a detection or a good match this frame
+  };
+
+  void detectFull();
+  bool trackTemplate(Track& track);
+  bool detectAround(Track& track);
+  void setTemplate(Track& track);
+  void associate(const std::vector<cv::Rect>& detections);
+
+  FaceTrackerParams params_;
+  FaceDetector detector_;
+  cv::CascadeClassifier roi_cascade_;
+
+  std::vector<Track> tracks_;
+  std::vector<TrackedFace> faces_;
+  int next_id_ = 1;
+  size_t frame_count_ = 0;
+  bool force_full_ = true;
+  bool last_full_ = false;
+
+  cv::Mat gray_, small_, match_;
+  double to_small_ = 1.0;
+
+  double fps_ = 0;
+};
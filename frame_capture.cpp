@@ -0,0 +1,196 @@
+/**
+ * @file frame_capture.cpp
+ * @brief Reads frames on a dedicated thread into a fixed size ring of Mat buffers.
+ *
+ */
+
+#include "frame_capture.hpp"
+
+#include <iostream>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+FrameCapture::FrameCapture(int camera_index, DropPolicy policy, size_t capacity)
+  : source_(make_unique<VideoCaptureSource>(camera_index)), policy_(policy), ring_(max<size_t>(capacity, 1) + 1),
+    stamps_(ring_.size(), 0)
+{
+  start();
+}
+
+FrameCapture::FrameCapture(const string& path, DropPolicy policy, size_t capacity)
+  : source_(make_unique<VideoCaptureSource>(path)), policy_(policy), ring_(max<size_t>(capacity, 1) + 1),
+    stamps_(ring_.size(), 0)
+{
+  start();
+}
+
+FrameCapture::FrameCapture(unique_ptr<FrameSource> source, DropPolicy policy, size_t capacity)
+  : source_(move(source)), policy_(policy), ring_(max<size_t>(capacity, 1) + 1),
+    stamps_(ring_.size(), 0)
+{
+  start();
+}
+
+FrameCapture::~FrameCapture()
+{
+  stop();
+}
+
+void FrameCapture::start()
+{
+  opened_ = source_ && source_->isOpened();
+  if ( !opened_ ) {
+    cerr << "Could not open the capture source" << endl;
+    finished_ = true;
+    return;
+  }
+
+  thread_ = thread(&FrameCapture::captureLoop, this);
+}
+
+void FrameCapture::stop()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  frame_ready_.notify_all();
+  slot_free_.notify_all();
+
+  if (thread_.joinable())
+    thread_.join();
+}
+
+CaptureStats FrameCapture::stats() const
+{
+  lock_guard<mutex> lock(mutex_);
+  CaptureStats current = stats_;
+  current.queued = count_;
+  return current;
+}
+
+/**
+ * @brief captureLoop decodes into the free slot after the queued ones.
+ *        Only that slot is touched without the lock, the reader never sees it
+ *        until the frame is committed.
+ */
+void FrameCapture::captureLoop()
+{
+  const size_t max_queued = ring_.size() - 1;
+
+  while ( !stopping_ ) {
+    size_t slot;
+    {
+      unique_lock<mutex> lock(mutex_);
+      if (policy_ == DropPolicy::BLOCK)
+        slot_free_.wait(lock, [&]() { return stopping_ || count_ < max_queued; });
+
+      if (stopping_)
+        break;
+
+      // latest frame wins, give up the oldest queued frame
+      if (count_ == max_queued) {
+        head_ = (head_ + 1) % ring_.size();
+        count_--;
+        stats_.dropped++;
+      }
+
+      slot = (head_ + count_) % ring_.size();
+    }
+
+    bool ok = source_->read(ring_[slot], &stamps_[slot]);
+
+    unique_lock<mutex> lock(mutex_);
+    if ( !ok || ring_[slot].empty() )
+      break;
+
+    count_++;
+    stats_.captured++;
+    frame_ready_.notify_one();
+
+    // the callback may take the reader's lock, which is held around tryRead
+    function<void()> ready = ready_callback_;
+    lock.unlock();
+    if (ready)
+      ready();
+  }
+
+  function<void()> ready;
+  {
+    lock_guard<mutex> lock(mutex_);
+    finished_ = true;
+    frame_ready_.notify_all();
+    ready = ready_callback_;
+  }
+  if (ready)
+    ready();
+}
+
+bool FrameCapture::setReadyCallback(function<void()> callback)
+{
+  lock_guard<mutex> lock(mutex_);
+  ready_callback_ = move(callback);
+  return true;
+}
+
+bool FrameCapture::read(Mat& frame, int64_t* capture_ns)
+{
+  unique_lock<mutex> lock(mutex_);
+  frame_ready_.wait(lock, [this]() { return count_ > 0 || finished_ || stopping_; });
+
+  if (count_ == 0)
+    return false;
+
+  take(frame, capture_ns);
+
+  lock.unlock();
+  slot_free_.notify_one();
+
+  return true;
+}
+
+bool FrameCapture::tryRead(Mat& frame, int64_t* capture_ns)
+{
+  unique_lock<mutex> lock(mutex_);
+  if (count_ == 0)
+    return false;
+
+  take(frame, capture_ns);
+
+  lock.unlock();
+  slot_free_.notify_one();
+
+  return true;
+}
+
+bool FrameCapture::exhausted() const
+{
+  lock_guard<mutex> lock(mutex_);
+  return (finished_ || stopping_) && count_ == 0;
+}
+
+// called with the lock held and at least one frame queued
+void FrameCapture::take(Mat& frame, int64_t* capture_ns)
+{
+  // skip straight to the newest frame
+  if (policy_ == DropPolicy::LATEST && count_ > 1) {
+    stats_.dropped += count_ - 1;
+    head_ = (head_ + count_ - 1) % ring_.size();
+    count_ = 1;
+  }
+
+  // hand the slot over and recycle the reader's previous buffer into the ring,
+  // unless someone else still references it
+  if (frame.u && frame.u->refcount > 1)
+    frame.release();
+  swap(frame, ring_[head_]);
+  if (capture_ns)
+    *capture_ns = stamps_[head_];
+
+  head_ = (head_ + 1) % ring_.size();
+  count_--;
+  stats_.delivered++;
+}
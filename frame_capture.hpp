@@ -0,0 +1,100 @@
+/**
+ * @file frame_capture.hpp
+ * @brief Reads frames on a dedicated thread into a fixed size ring of Mat buffers,
+ *        so decoding overlaps with processing instead of stacking on top of it.
+ *        Any FrameSource can be read ahead this way.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_source.hpp"
+
+enum class DropPolicy {
+  LATEST,     // camera: overwrite the oldest queued frame, readers always get the newest one
+  BLOCK       // file playback: lossless, capture waits while the ring is full
+};
+
+struct CaptureStats {
+  uint64_t captured = 0;    // frames decoded by the capture thread
+  uint64_t delivered = 0;   // frames handed to the reader
+  uint64_t dropped = 0;     // frames overwritten or skipped before they were read
+  size_t queued = 0;        // frames currently waiting in the ring
+};
+
+class FrameCapture : public FrameSource
+{
+public:
+  FrameCapture(int camera_index, DropPolicy policy = DropPolicy::LATEST, size_t capacity = 4);
+  FrameCapture(const std::string& path, DropPolicy policy = DropPolicy::BLOCK, size_t capacity = 8);
+  FrameCapture(std::unique_ptr<FrameSource> source, DropPolicy policy, size_t capacity = 4);
+  ~FrameCapture();
+
+  FrameCapture(const FrameCapture&) = delete;
+  FrameCapture& operator=(const FrameCapture&) = delete;
+
+  bool isOpened() const override { return opened_; }
+
+  /**
+   * @brief read the next frame, blocks until one is available.
+   *        The buffer previously held by frame is recycled into the ring,
+   *        so do not keep shallow copies of it across reads.
+   *
+   * @param frame output frame
+   * @param capture_ns optional monotonic timestamp (trace::now) of when the frame was captured
+   * @return false once the source is exhausted and the ring is empty
+   */
+  bool read(cv::Mat& frame, int64_t* capture_ns = nullptr) override;
+
+  /**
+   * @brief same as read, but returns false right away when no frame is queued
+   *
+   * @param frame output frame
+   * @param capture_ns optional capture timestamp
+   * @return true if a frame was taken
+   */
+  bool tryRead(cv::Mat& frame, int64_t* capture_ns = nullptr) override;
+
+  // true once the source is exhausted and every queued frame was read
+  bool exhausted() const override;
+
+  // called from the capture thread after every queued frame and once it finishes
+  bool setReadyCallback(std::function<void()> callback) override;
+
+  void stop();
+  CaptureStats stats() const;
+
+private:
+  void start();
+  void captureLoop();
+  void take(cv::Mat& frame, int64_t* capture_ns);
+
+  std::unique_ptr<FrameSource> source_;
+  DropPolicy policy_;
+  bool opened_ = false;
+
+  std::vector<cv::Mat> ring_;     // one slot more than can be queued, reserved for the frame being decoded
+  std::vector<int64_t> stamps_;   // capture timestamp of each slot
+  size_t head_ = 0;               // oldest queued slot
+  size_t count_ = 0;              // number of queued slots
+
+  mutable std::mutex mutex_;
+  std::condition_variable frame_ready_;
+  std::condition_variable slot_free_;
+  bool finished_ = false;
+  std::atomic<bool> stopping_{false};
+  std::function<void()> ready_callback_;
+  std::thread thread_;
+
+  CaptureStats stats_;
+};
@@ -0,0 +1,220 @@
+/**
+ * @file frame_pool.cpp
+ * @brief Recycled storage for per-frame buffers.
+ *
+ */
+
+#include "frame_pool.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+using namespace cv;
+using namespace std;
+
+FramePool::FramePool(uint64_t keep_frames)
+  : keep_frames_(keep_frames)
+{
+}
+
+FramePool& FramePool::shared()
+{
+  static FramePool pool;
+  return pool;
+}
+
+Mat FramePool::acquire(Size size, int type)
+{
+  return acquire(size, type, nullptr);
+}
+
+Mat FramePool::acquire(Size size, int type, const FrameScope* owner)
+{
+  if (size.empty())
+    return Mat();
+
+  lock_guard<mutex> lock(mutex_);
+  stats_.requests++;
+
+  for (Slot& slot : slots_) {
+    // a header kept from an earlier frame still points at the storage
+    if (slot.in_use || slot.buffer.size() != size || slot.buffer.type() != type || slot.buffer.u->refcount > 1)
+      continue;
+
+    slot.in_use = true;
+    slot.owner = owner;
+    slot.last_used = stats_.frames;
+    stats_.in_use_bytes += slot.bytes;
+    stats_.high_water_bytes = max(stats_.high_water_bytes, stats_.in_use_bytes);
+    return slot.buffer;
+  }
+
+  Slot slot;
+  slot.buffer.create(size, type);
+  slot.bytes = slot.buffer.total() * slot.buffer.elemSize();
+  slot.in_use = true;
+  slot.owner = owner;
+  slot.last_used = stats_.frames;
+
+  stats_.allocations++;
+  stats_.allocated_bytes += slot.bytes;
+  stats_.pooled_bytes += slot.bytes;
+  stats_.in_use_bytes += slot.bytes;
+  stats_.high_water_bytes = max(stats_.high_water_bytes, stats_.in_use_bytes);
+
+  slots_.push_back(slot);
+  return slot.buffer;
+}
+
+void FramePool::release(const Mat& buffer)
+{
+  if (buffer.empty())
+    return;
+
+  lock_guard<mutex> lock(mutex_);
+  for (Slot& slot : slots_) {
+    if (slot.in_use && slot.buffer.data == buffer.data) {
+      slot.in_use = false;
+      slot.owner = nullptr;
+      stats_.in_use_bytes -= slot.bytes;
+      return;
+    }
+  }
+}
+
+ContourSet& FramePool::acquireContours()
+{
+  return acquireContours(nullptr);
+}
+
+ContourSet& FramePool::acquireContours(const FrameScope* owner)
+{
+  lock_guard<mutex> lock(mutex_);
+  stats_.requests++;
+
+  for (unique_ptr<ContourSlot>& slot : contour_slots_) {
+    if ( !slot->in_use ) {
+      slot->in_use = true;
+      slot->owner = owner;
+      return slot->contours;
+    }
+  }
+
+  stats_.allocations++;
+
+  contour_slots_.push_back(make_unique<ContourSlot>());
+  contour_slots_.back()->in_use = true;
+  contour_slots_.back()->owner = owner;
+  return contour_slots_.back()->contours;
+}
+
+void FramePool::releaseContours(ContourSet& contours)
+{
+  lock_guard<mutex> lock(mutex_);
+  for (unique_ptr<ContourSlot>& slot : contour_slots_) {
+    if (&slot->contours == &contours) {
+      slot->in_use = false;
+      slot->owner = nullptr;
+      return;
+    }
+  }
+}
+
+void FramePool::releaseScope(const FrameScope* scope, bool frame)
+{
+  lock_guard<mutex> lock(mutex_);
+
+  for (Slot& slot : slots_) {
+    if (slot.in_use && slot.owner == scope) {
+      slot.in_use = false;
+      slot.owner = nullptr;
+      stats_.in_use_bytes -= slot.bytes;
+    }
+  }
+  for (unique_ptr<ContourSlot>& slot : contour_slots_) {
+    if (slot->in_use && slot->owner == scope) {
+      slot->in_use = false;
+      slot->owner = nullptr;
+    }
+  }
+
+  if ( !frame )
+    return;
+
+  // everything since the last frame closed counts towards this one, whichever
+  // thread asked for it
+  const double requests = (double)(stats_.requests - frame_requests_);
+  const double allocations = (double)(stats_.allocations - frame_allocations_);
+  const double bytes = (double)(stats_.allocated_bytes - frame_bytes_);
+  frame_requests_ = stats_.requests;
+  frame_allocations_ = stats_.allocations;
+  frame_bytes_ = stats_.allocated_bytes;
+
+  stats_.frames++;
+  double n = (double)stats_.frames;
+  stats_.requests_per_frame += (requests - stats_.requests_per_frame) / n;
+  stats_.allocations_per_frame += (allocations - stats_.allocations_per_frame) / n;
+  stats_.bytes_per_frame += (bytes - stats_.bytes_per_frame) / n;
+
+  // storage of sizes no frame asked for in a while
+  auto stale = remove_if(slots_.begin(), slots_.end(), [&](const Slot& slot) {
+    return !slot.in_use && stats_.frames - slot.last_used > keep_frames_;
+  });
+  for (auto it = stale; it != slots_.end(); ++it)
+    stats_.pooled_bytes -= it->bytes;
+  slots_.erase(stale, slots_.end());
+}
+
+void FramePool::trim()
+{
+  lock_guard<mutex> lock(mutex_);
+
+  auto unused = remove_if(slots_.begin(), slots_.end(), [](const Slot& slot) { return !slot.in_use; });
+  for (auto it = unused; it != slots_.end(); ++it)
+    stats_.pooled_bytes -= it->bytes;
+  slots_.erase(unused, slots_.end());
+
+  contour_slots_.erase(
+    remove_if(contour_slots_.begin(), contour_slots_.end(), [](const unique_ptr<ContourSlot>& slot) { return !slot->in_use; }),
+    contour_slots_.end()
+  );
+}
+
+FramePoolStats FramePool::stats() const
+{
+  lock_guard<mutex> lock(mutex_);
+  FramePoolStats all = stats_;
+  all.buffers = slots_.size();
+
+  return all;
+}
+
+FrameScope::FrameScope(bool frame, FramePool& pool)
+  : pool_(pool), frame_(frame)
+{
+}
+
+FrameScope::~FrameScope()
+{
+  pool_.releaseScope(this, frame_);
+}
+
+Mat FrameScope::mat(Size size, int type)
+{
+  return pool_.acquire(size, type, this);
+}
+
+ContourSet& FrameScope::contours()
+{
+  return pool_.acquireContours(this);
+}
+
+void printFramePoolStats(const FramePoolStats& stats)
+{
+  cout << "Frame pool: " << stats.frames << " frames, "
+       << fixed << setprecision(2) << stats.requests_per_frame << " buffers and "
+       << stats.allocations_per_frame << " allocations (" << stats.bytes_per_frame / 1024 << " KB) per frame" << endl;
+  cout << "Frame pool: " << stats.buffers << " buffers, " << stats.pooled_bytes / 1048576.0 << " MB pooled, "
+       << stats.high_water_bytes / 1048576.0 << " MB in use at most" << endl;
+}
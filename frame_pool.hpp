@@ -0,0 +1,152 @@
+/**
+ * @file frame_pool.hpp
+ * @brief Recycled storage for per-frame buffers.
+ *        A FramePool keeps the Mats and contour vectors handed out on earlier
+ *        frames and hands them out again when the size and type match, so a
+ *        steady stream of frames stops allocating after the first few. Buffers are
+ *        taken through a FrameScope and all come back when the scope closes. One scope
+ *        per frame is opened as the frame scope and closes the frame, however many
+ *        threads work on it. The pool counts requests, allocations and bytes per frame
+ *        and the most storage in use at once.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+typedef std::vector<std::vector<cv::Point>> ContourSet;
+
+class FrameScope;
+
+struct FramePoolStats {
+  uint64_t frames = 0;              // frame scopes closed
+  uint64_t requests = 0;            // buffers handed out
+  uint64_t allocations = 0;         // requests that needed new storage
+  uint64_t allocated_bytes = 0;     // Mat storage allocated, contour sets are not sized
+  double requests_per_frame = 0;
+  double allocations_per_frame = 0;
+  double bytes_per_frame = 0;
+  size_t buffers = 0;               // Mats held by the pool, in use or free
+  size_t pooled_bytes = 0;
+  size_t in_use_bytes = 0;
+  size_t high_water_bytes = 0;      // most Mat storage in use at once
+};
+
+class FramePool
+{
+public:
+  /**
+   * @brief Construct a new Frame Pool
+   *
+   * @param keep_frames free buffers unused for this many frames are released,
+   *        so storage of an old resolution does not stay around
+   */
+  explicit FramePool(uint64_t keep_frames = 120);
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // pool used by default, shared by every thread
+  static FramePool& shared();
+
+  /**
+   * @brief acquire a buffer of this size and type, its contents are undefined.
+   *        Storage still referenced by a header from an earlier frame is never
+   *        handed out again.
+   *
+   * @param size buffer size
+   * @param type buffer type
+   * @return cv::Mat buffer backed by pool storage
+   */
+  cv::Mat acquire(cv::Size size, int type);
+
+  // give a buffer from acquire back
+  void release(const cv::Mat& buffer);
+
+  /**
+   * @brief acquireContours a contour set whose inner vectors keep their capacity,
+   *        contents are left over from the last user: findContours and resize
+   *        overwrite them
+   */
+  ContourSet& acquireContours();
+  void releaseContours(ContourSet& contours);
+
+  // drop every free buffer
+  void trim();
+
+  FramePoolStats stats() const;
+
+private:
+  friend class FrameScope;
+
+  struct Slot {
+    cv::Mat buffer;
+    size_t bytes = 0;
+    bool in_use = false;
+    const FrameScope* owner = nullptr;
+    uint64_t last_used = 0;
+  };
+
+  struct ContourSlot {
+    ContourSet contours;
+    bool in_use = false;
+    const FrameScope* owner = nullptr;
+  };
+
+  cv::Mat acquire(cv::Size size, int type, const FrameScope* owner);
+  ContourSet& acquireContours(const FrameScope* owner);
+
+  // give back everything the scope took, a frame scope also closes the frame
+  void releaseScope(const FrameScope* scope, bool frame);
+
+  uint64_t keep_frames_;
+  uint64_t frame_requests_ = 0;     // totals when the last frame closed
+  uint64_t frame_allocations_ = 0;
+  uint64_t frame_bytes_ = 0;
+
+  mutable std::mutex mutex_;
+  std::vector<Slot> slots_;
+  std::vector<std::unique_ptr<ContourSlot>> contour_slots_;   // stable addresses
+  FramePoolStats stats_;
+};
+
+class FrameScope
+{
+public:
+  /**
+   * @brief Construct a new Frame Scope
+   *
+   * @param frame this scope spans a whole frame and closes it, open exactly one
+   *        per frame: the main loop's, or one stage's in a pipeline
+   * @param pool pool the buffers come from
+   */
+  explicit FrameScope(bool frame = false, FramePool& pool = FramePool::shared());
+  ~FrameScope();
+
+  FrameScope(const FrameScope&) = delete;
+  FrameScope& operator=(const FrameScope&) = delete;
+
+  // buffer returned to the pool when the scope closes, do not keep it longer
+  cv::Mat mat(cv::Size size, int type);
+
+  // contour set returned to the pool when the scope closes
+  ContourSet& contours();
+
+private:
+  friend class FramePool;
+
+  FramePool& pool_;
+  bool frame_;
+};
+
+/**
+ * @brief printFramePoolStats print the allocation counters of a pool
+ *
+ * @param stats pool statistics
+ */
+void printFramePoolStats(const FramePoolStats& stats);
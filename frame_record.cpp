@@ -0,0 +1,249 @@
+/**
+ * @file frame_record.cpp
+ * @brief Raw frame recording and memory-mapped replay.
+ *
+ */
+
+#include "frame_record.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+  #define NOMINMAX
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+static const char RECORD_MAGIC[8] = {'C', 'V', 'F', 'R', 'A', 'M', 'E', 'S'};
+static const uint32_t RECORD_VERSION = 1;
+
+// frames start on a page boundary so the mapped pixels are suitably aligned
+static const uint64_t RECORD_ALIGNMENT = 4096;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+FrameRecorder::FrameRecorder(const string& path, FrameCompression compression)
+  : compression_(compression)
+{
+  file_ = fopen(path.c_str(), "wb");
+  if ( !file_ ) {
+    cerr << "Could not create recording: " << path << endl;
+    return;
+  }
+
+  // placeholder, the real header is written once the frame count is known
+  vector<char> padding(RECORD_ALIGNMENT, 0);
+  fwrite(padding.data(), 1, padding.size(), file_);
+  offset_ = RECORD_ALIGNMENT;
+}
+
+FrameRecorder::~FrameRecorder()
+{
+  close();
+}
+
+bool FrameRecorder::write(const Mat& frame, int64_t timestamp_ns)
+{
+  if ( !file_ || frame.empty() )
+    return false;
+
+  static const char zeros[RECORD_ALIGNMENT] = {0};
+  uint64_t aligned = alignUp(offset_, RECORD_ALIGNMENT);
+  fwrite(zeros, 1, aligned - offset_, file_);
+  offset_ = aligned;
+
+  RecordIndexEntry entry = {};
+  entry.offset = offset_;
+  entry.timestamp_ns = timestamp_ns;
+  entry.rows = frame.rows;
+  entry.cols = frame.cols;
+  entry.type = frame.type();
+
+  if (compression_ == FrameCompression::PNG) {
+    static const vector<int> fast_png = {IMWRITE_PNG_COMPRESSION, 1};
+    imencode(".png", frame, encoded_, fast_png);
+    entry.size = encoded_.size();
+    if (fwrite(encoded_.data(), 1, encoded_.size(), file_) != encoded_.size())
+      return false;
+  } else {
+    size_t row_bytes = frame.cols * frame.elemSize();
+    entry.step = (uint32_t)row_bytes;
+    entry.size = (uint64_t)row_bytes * frame.rows;
+    for (int row = 0; row < frame.rows; row++)
+      if (fwrite(frame.ptr(row), 1, row_bytes, file_) != row_bytes)
+        return false;
+  }
+
+  offset_ += entry.size;
+  index_.push_back(entry);
+  return true;
+}
+
+void FrameRecorder::close()
+{
+  if ( !file_ )
+    return;
+
+  static const char zeros[8] = {0};
+  uint64_t aligned = alignUp(offset_, 8);
+  fwrite(zeros, 1, aligned - offset_, file_);
+
+  fwrite(index_.data(), sizeof(RecordIndexEntry), index_.size(), file_);
+
+  RecordHeader header = {};
+  memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+  header.version = RECORD_VERSION;
+  header.frame_count = (uint32_t)index_.size();
+  header.index_offset = aligned;
+  header.compression = (uint32_t)compression_;
+
+  fseek(file_, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, file_);
+  fclose(file_);
+  file_ = nullptr;
+}
+
+FrameReplay::FrameReplay(const string& path, ReplayTiming timing)
+  : timing_(timing)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    cerr << "Could not open recording: " << path << endl;
+    return;
+  }
+  file_handle_ = file;
+
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file, &file_size);
+  length_ = (size_t)file_size.QuadPart;
+
+  // copy-on-write, a caller drawing on a raw frame gets private pages instead of a crash
+  mapping_handle_ = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  if (mapping_handle_)
+    data_ = (uchar*)MapViewOfFile(mapping_handle_, FILE_MAP_COPY, 0, 0, 0);
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "Could not open recording: " << path << endl;
+    return;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    length_ = (size_t)file_stat.st_size;
+    // copy-on-write, a caller drawing on a raw frame gets private pages instead of a crash
+    void* mapped = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      data_ = (uchar*)mapped;
+      madvise(mapped, length_, MADV_SEQUENTIAL);
+    }
+  }
+  ::close(fd);
+#endif
+
+  if ( !data_ ) {
+    cerr << "Could not map recording: " << path << endl;
+    unmap();
+    return;
+  }
+
+  header_ = (const RecordHeader*)data_;
+  bool valid = length_ >= sizeof(RecordHeader)
+    && memcmp(header_->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) == 0
+    && header_->version == RECORD_VERSION
+    && header_->index_offset + (uint64_t)header_->frame_count * sizeof(RecordIndexEntry) <= length_;
+
+  if ( !valid ) {
+    cerr << "Not a frame recording: " << path << endl;
+    unmap();
+    return;
+  }
+
+  index_ = (const RecordIndexEntry*)(data_ + header_->index_offset);
+}
+
+FrameReplay::~FrameReplay()
+{
+  unmap();
+}
+
+void FrameReplay::unmap()
+{
+#ifdef _WIN32
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_handle_)
+    CloseHandle(mapping_handle_);
+  if (file_handle_)
+    CloseHandle(file_handle_);
+  mapping_handle_ = file_handle_ = nullptr;
+#else
+  if (data_)
+    munmap(data_, length_);
+#endif
+
+  data_ = nullptr;
+  header_ = nullptr;
+  index_ = nullptr;
+}
+
+Mat FrameReplay::frame(size_t i)
+{
+  if (i >= size())
+    return Mat();
+
+  const RecordIndexEntry& entry = index_[i];
+  if (entry.offset + entry.size > length_)
+    return Mat();
+
+  uchar* pixels = data_ + entry.offset;
+
+  if (header_->compression == (uint32_t)FrameCompression::PNG) {
+    imdecode(Mat(1, (int)entry.size, CV_8UC1, pixels), IMREAD_UNCHANGED, &decoded_);
+    return decoded_;
+  }
+
+  // header only, the pixels stay in the mapped pages
+  return Mat(entry.rows, entry.cols, entry.type, pixels, entry.step);
+}
+
+bool FrameReplay::read(Mat& frame, int64_t* timestamp_ns)
+{
+  if (next_ >= size())
+    return false;
+
+  const int64_t recorded = index_[next_].timestamp_ns;
+
+  if (timing_ == ReplayTiming::ORIGINAL) {
+    if ( !started_ ) {
+      start_ns_ = trace::now();
+      origin_ns_ = recorded;
+      started_ = true;
+    }
+
+    int64_t wait_ns = start_ns_ + (recorded - origin_ns_) - trace::now();
+    if (wait_ns > 0)
+      this_thread::sleep_for(chrono::nanoseconds(wait_ns));
+  }
+
+  frame = this->frame(next_++);
+  if (timestamp_ns)
+    *timestamp_ns = recorded;
+
+  return !frame.empty();
+}
@@ -0,0 +1,138 @@
+/**
+ * @file frame_record.hpp
+ * @brief Raw frame recording and memory-mapped replay.
+ *        A recording is a header, the frames, each starting on a page boundary, and
+ *        a per-frame index with capture timestamps at the end of the file. Replay maps
+ *        the file and wraps Mat headers around the mapped pages, so raw frames are
+ *        handed out without a copy or a decode.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum class FrameCompression : uint32_t {
+  RAW,        // pixels as they are in the Mat, replayed zero-copy
+  PNG         // fast PNG, smaller files but decoded on replay
+};
+
+enum class ReplayTiming {
+  NATIVE,     // as fast as the reader asks for frames
+  ORIGINAL    // frames are held back until their recorded time
+};
+
+#pragma pack(push, 1)
+struct RecordHeader {
+  char magic[8];                // "CVFRAMES"
+  uint32_t version;
+  uint32_t frame_count;
+  uint64_t index_offset;        // file offset of the frame index
+  uint32_t compression;
+  uint32_t reserved;
+};
+
+struct RecordIndexEntry {
+  uint64_t offset;              // file offset of the frame data
+  uint64_t size;                // bytes of frame data
+  int64_t timestamp_ns;         // monotonic capture time
+  int32_t rows;
+  int32_t cols;
+  int32_t type;
+  uint32_t step;                // row stride of raw frames
+};
+#pragma pack(pop)
+
+class FrameRecorder
+{
+public:
+  FrameRecorder(const std::string& path, FrameCompression compression = FrameCompression::RAW);
+  ~FrameRecorder();
+
+  FrameRecorder(const FrameRecorder&) = delete;
+  FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+  bool isOpened() const { return file_ != nullptr; }
+
+  /**
+   * @brief append a frame
+   *
+   * @param frame frame to record
+   * @param timestamp_ns capture time, e.g. from FrameCapture::read
+   * @return false when the frame could not be written
+   */
+  bool write(const cv::Mat& frame, int64_t timestamp_ns);
+
+  // write the index and finish the file, called by the destructor
+  void close();
+
+  size_t size() const { return index_.size(); }
+
+private:
+  FILE* file_ = nullptr;
+  FrameCompression compression_;
+  std::vector<RecordIndexEntry> index_;
+  std::vector<uchar> encoded_;
+  uint64_t offset_ = 0;
+};
+
+class FrameReplay
+{
+public:
+  FrameReplay(const std::string& path, ReplayTiming timing = ReplayTiming::NATIVE);
+  ~FrameReplay();
+
+  FrameReplay(const FrameReplay&) = delete;
+  FrameReplay& operator=(const FrameReplay&) = delete;
+
+  bool isOpened() const { return data_ != nullptr; }
+  size_t size() const { return index_ ? header_->frame_count : 0; }
+  bool compressed() const { return header_ && header_->compression != (uint32_t)FrameCompression::RAW; }
+
+  /**
+   * @brief frame i of the recording. Raw frames point into the mapping and stay
+   *        valid as long as the replay is open. The mapping is copy-on-write, drawing
+   *        on a raw frame never reaches the file but shows in later reads of it.
+   *        Compressed frames are decoded into one reused buffer.
+   *
+   * @param i frame index
+   * @return cv::Mat the frame
+   */
+  cv::Mat frame(size_t i);
+
+  int64_t timestamp(size_t i) const { return index_[i].timestamp_ns; }
+
+  /**
+   * @brief read the next frame, honouring the replay timing
+   *
+   * @param frame output frame
+   * @param timestamp_ns optional recorded capture time of the frame
+   * @return false at the end of the recording
+   */
+  bool read(cv::Mat& frame, int64_t* timestamp_ns = nullptr);
+
+  void seek(size_t i) { next_ = i; started_ = false; }
+
+private:
+  void unmap();
+
+  ReplayTiming timing_;
+  uchar* data_ = nullptr;
+  size_t length_ = 0;
+  const RecordHeader* header_ = nullptr;
+  const RecordIndexEntry* index_ = nullptr;
+#ifdef _WIN32
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+#endif
+
+  size_t next_ = 0;
+  bool started_ = false;
+  int64_t start_ns_ = 0;        // replay clock at the first read frame
+  int64_t origin_ns_ = 0;       // recorded timestamp of that frame
+  cv::Mat decoded_;
+};
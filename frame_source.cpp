@@ -0,0 +1,247 @@
+/**
+ * @file frame_source.cpp
+ * @brief Pluggable frame sources and sinks.
+ *
+ */
+
+#include "frame_source.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+#include "doc_batch.hpp"
+#include "frame_capture.hpp"
+#include "shm_ring.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+namespace fs = std::filesystem;
+
+static bool startsWith(const string& text, const string& prefix)
+{
+  return text.compare(0, prefix.size(), prefix) == 0;
+}
+
+static bool endsWith(const string& text, const string& suffix)
+{
+  return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool isNumber(const string& text)
+{
+  return !text.empty() && all_of(text.begin(), text.end(), [](char c) { return isdigit((unsigned char)c); });
+}
+
+// sleeps until the frame is due, the schedule restarts when the reader falls behind
+static void pace(double fps, int64_t& next_due_ns)
+{
+  if (fps <= 0)
+    return;
+
+  const int64_t period = (int64_t)(1e9 / fps);
+  int64_t now = trace::now();
+  if (next_due_ns > now)
+    this_thread::sleep_for(chrono::nanoseconds(next_due_ns - now));
+  else
+    next_due_ns = now;
+  next_due_ns += period;
+}
+
+VideoCaptureSource::VideoCaptureSource(int camera_index) : cap_(camera_index)
+{
+}
+
+VideoCaptureSource::VideoCaptureSource(const string& path) : cap_(path)
+{
+}
+
+bool VideoCaptureSource::read(Mat& frame, int64_t* capture_ns)
+{
+  cap_.read(frame);
+  if (capture_ns)
+    *capture_ns = trace::now();
+  return !frame.empty();
+}
+
+ImageSequenceSource::ImageSequenceSource(const string& input, double fps, bool loop)
+  : fps_(fps), loop_(loop)
+{
+  if (input.find('*') != string::npos) {
+    vector<String> matches;
+    glob(input, matches, false);
+    paths_.assign(matches.begin(), matches.end());
+    sort(paths_.begin(), paths_.end());
+  } else {
+    paths_ = listPages(input);
+  }
+
+  if (paths_.empty())
+    cout << "No images found in: " << input << endl;
+}
+
+bool ImageSequenceSource::read(Mat& frame, int64_t* capture_ns)
+{
+  // unreadable files are skipped
+  while (true) {
+    if (next_ == paths_.size()) {
+      if ( !loop_ || paths_.empty() )
+        return false;
+      next_ = 0;
+    }
+
+    frame = imread(paths_[next_++]);
+    if ( !frame.empty() )
+      break;
+  }
+
+  pace(fps_, next_due_ns_);
+  if (capture_ns)
+    *capture_ns = trace::now();
+  return true;
+}
+
+SyntheticSource::SyntheticSource(Size size, double fps, size_t frames)
+  : size_(size), fps_(fps), frames_(frames)
+{
+  // dark diagonal gradient, so the page has an edge on every side
+  background_.create(size_, CV_8UC3);
+  for (int y = 0; y < size_.height; y++) {
+    Vec3b* row = background_.ptr<Vec3b>(y);
+    for (int x = 0; x < size_.width; x++) {
+      uchar value = (uchar)(40 + 60 * (x + y) / (size_.width + size_.height));
+      row[x] = Vec3b(value, value, (uchar)(value / 2));
+    }
+  }
+}
+
+bool SyntheticSource::read(Mat& frame, int64_t* capture_ns)
+{
+  if (frames_ > 0 && index_ == frames_)
+    return false;
+
+  const double t = index_ / 30.0;
+  const int w = size_.width;
+  const int h = size_.height;
+  background_.copyTo(frame);
+
+  // the page drifts and turns a little
+  Point2f center(w * (0.5f + 0.1f * (float)sin(t * 0.7)), h * (0.5f + 0.05f * (float)cos(t * 0.5)));
+  RotatedRect page(center, Size2f(w * 0.45f, h * 0.6f), (float)(10 * sin(t * 0.4)));
+  Point2f corners[4];
+  page.points(corners);
+  vector<Point> polygon;
+  for (const Point2f& corner : corners)
+    polygon.push_back(Point(cvRound(corner.x), cvRound(corner.y)));
+  fillConvexPoly(frame, polygon, Scalar(235, 235, 235), LINE_AA);
+
+  // text lines on the page, u runs along the width and v down the height
+  auto onPage = [&corners](double u, double v) {
+    Point2f across = corners[3] - corners[0];
+    Point2f down = corners[1] - corners[0];
+    return Point(cvRound(corners[0].x + u * across.x + v * down.x), cvRound(corners[0].y + u * across.y + v * down.y));
+  };
+  for (int i = 1; i < 6; i++)
+    line(frame, onPage(0.15, i / 6.0), onPage(0.85, i / 6.0), Scalar(60, 60, 60), 2);
+
+  // orange marker tracing a figure of eight
+  Point marker(cvRound(w * (0.5 + 0.35 * sin(t * 1.3))), cvRound(h * (0.5 + 0.3 * sin(t * 2.6))));
+  circle(frame, marker, max(6, w / 40), Scalar(0, 140, 255), FILLED);
+
+  putText(frame, to_string(index_), Point(10, 30), FONT_HERSHEY_PLAIN, 2, Scalar(255, 255, 255), 2);
+  index_++;
+
+  pace(fps_, next_due_ns_);
+  if (capture_ns)
+    *capture_ns = trace::now();
+  return true;
+}
+
+bool VideoFileSink::write(const Mat& frame, int64_t capture_ns)
+{
+  if (frame.empty())
+    return false;
+
+  if ( !writer_.isOpened() ) {
+    writer_.open(path_, VideoWriter::fourcc('m', 'p', '4', 'v'), fps_, frame.size());
+    if ( !writer_.isOpened() ) {
+      cerr << "Could not open video file for writing: " << path_ << endl;
+      return false;
+    }
+  }
+
+  writer_.write(frame);
+  return true;
+}
+
+/**
+ * @brief parse WxH[@fps] of a synthetic source spec
+ */
+static unique_ptr<FrameSource> openSynthetic(const string& options)
+{
+  Size size(640, 480);
+  double fps = 30;
+
+  if ( !options.empty() ) {
+    int width = 0, height = 0;
+    size_t x = options.find('x');
+    size_t at = options.find('@');
+    if (x != string::npos) {
+      width = atoi(options.substr(0, x).c_str());
+      height = atoi(options.substr(x + 1, at == string::npos ? string::npos : at - x - 1).c_str());
+    }
+    if (width > 0 && height > 0)
+      size = Size(width, height);
+    if (at != string::npos)
+      fps = atof(options.substr(at + 1).c_str());
+  }
+
+  return make_unique<SyntheticSource>(size, fps);
+}
+
+unique_ptr<FrameSource> openSource(const string& spec)
+{
+  string kind, value = spec;
+  size_t colon = spec.find(':');
+  // a single letter before the colon is a drive, not a source kind
+  if (colon != string::npos && colon > 1) {
+    kind = spec.substr(0, colon);
+    value = spec.substr(colon + 1);
+  }
+
+  if (kind == "camera" || (kind.empty() && isNumber(value)))
+    // live feeds never queue up, the reader sees the newest frame
+    return make_unique<FrameCapture>(isNumber(value) ? stoi(value) : 0, DropPolicy::LATEST);
+  if (kind == "synthetic" || (kind.empty() && value == "synthetic"))
+    return openSynthetic(kind.empty() ? "" : value);
+  if (kind == "shm")
+    return make_unique<ShmSource>(value);
+  if (kind == "replay" || (kind.empty() && endsWith(value, ".cvraw")))
+    return make_unique<ReplaySource>(value);
+  if (kind == "images" || (kind.empty() && value.find('*') != string::npos))
+    return make_unique<ImageSequenceSource>(value);
+  if (kind == "file")
+    return make_unique<FrameCapture>(value, DropPolicy::BLOCK);
+
+  if ( !kind.empty() )
+    cout << "Unknown source kind " << kind << ", opening as a video file" << endl;
+
+  // a directory of pages reads like a video
+  if (fs::is_directory(value))
+    return make_unique<ImageSequenceSource>(value);
+  return make_unique<FrameCapture>(spec, DropPolicy::BLOCK);
+}
+
+unique_ptr<FrameSink> openSink(const string& spec)
+{
+  if (startsWith(spec, "shm:"))
+    return make_unique<ShmSink>(spec.substr(4));
+  if (endsWith(spec, ".cvraw"))
+    return make_unique<RecordSink>(spec);
+  return make_unique<VideoFileSink>(spec);
+}
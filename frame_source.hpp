@@ -0,0 +1,214 @@
+/**
+ * @file frame_source.hpp
+ * @brief Pluggable frame sources and sinks.
+ *        Every pipeline reads from a FrameSource, so cameras, video files, image
+ *        sequences, a synthetic test pattern, recordings and the shared memory ring
+ *        are interchangeable. openSource and openSink build them from a spec string.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "frame_record.hpp"
+
+class FrameSource
+{
+public:
+  virtual ~FrameSource() = default;
+
+  virtual bool isOpened() const = 0;
+
+  /**
+   * @brief read the next frame, blocks until one is available
+   *
+   * @param frame output frame
+   * @param capture_ns optional monotonic capture timestamp (trace::now)
+   * @return false once the source is exhausted
+   */
+  virtual bool read(cv::Mat& frame, int64_t* capture_ns = nullptr) = 0;
+
+  /**
+   * @brief read without waiting, sources that never wait just read
+   *
+   * @return false when no frame is ready, check exhausted to tell the end apart
+   */
+  virtual bool tryRead(cv::Mat& frame, int64_t* capture_ns = nullptr)
+  {
+    ended_ = !read(frame, capture_ns);
+    return !ended_;
+  }
+
+  virtual bool exhausted() const { return ended_; }
+
+  /**
+   * @brief setReadyCallback have the source call back when a frame becomes ready for
+   *        tryRead or the source ends, from the thread that reads ahead
+   *
+   * @param callback called without any lock of the source held, empty to clear
+   * @return false when the source cannot call back and readers have to poll tryRead;
+   *         sources read on the calling thread always have a frame or have ended
+   */
+  virtual bool setReadyCallback(std::function<void()> callback) { return true; }
+
+protected:
+  bool ended_ = false;
+};
+
+/**
+ * @brief makeWritable give a frame its own buffer if it points into a mapping: zero-copy
+ *        frames from shared memory are read only, and drawing on a raw recording frame
+ *        would show again when the replay loops
+ *
+ * @param frame frame about to be modified
+ */
+inline void makeWritable(cv::Mat& frame)
+{
+  if ( !frame.empty() && !frame.u )
+    frame = frame.clone();
+}
+
+class FrameSink
+{
+public:
+  virtual ~FrameSink() = default;
+
+  virtual bool isOpened() const = 0;
+
+  /**
+   * @brief write a frame
+   *
+   * @param frame frame to write
+   * @param capture_ns capture timestamp of the frame
+   * @return false when the frame could not be written
+   */
+  virtual bool write(const cv::Mat& frame, int64_t capture_ns) = 0;
+};
+
+// camera or video file read on the calling thread, wrap it in a FrameCapture to decode ahead
+class VideoCaptureSource : public FrameSource
+{
+public:
+  explicit VideoCaptureSource(int camera_index);
+  explicit VideoCaptureSource(const std::string& path);
+
+  bool isOpened() const override { return cap_.isOpened(); }
+  bool read(cv::Mat& frame, int64_t* capture_ns = nullptr) override;
+
+private:
+  cv::VideoCapture cap_;
+};
+
+class ImageSequenceSource : public FrameSource
+{
+public:
+  /**
+   * @brief Construct a new Image Sequence Source
+   *
+   * @param input directory, glob pattern, list file or single image
+   * @param fps frames per second, 0 reads as fast as asked
+   * @param loop start over after the last image
+   */
+  ImageSequenceSource(const std::string& input, double fps = 0, bool loop = false);
+
+  bool isOpened() const override { return !paths_.empty(); }
+  bool read(cv::Mat& frame, int64_t* capture_ns = nullptr) override;
+
+private:
+  std::vector<std::string> paths_;
+  size_t next_ = 0;
+  double fps_;
+  bool loop_;
+  int64_t next_due_ns_ = 0;
+};
+
+/**
+ * @brief Deterministic moving test pattern: a white page turning over a gradient and
+ *        an orange marker blob, enough for the doc scanner and the paint pipeline
+ */
+class SyntheticSource : public FrameSource
+{
+public:
+  SyntheticSource(cv::Size size = cv::Size(640, 480), double fps = 30, size_t frames = 0);
+
+  bool isOpened() const override { return true; }
+  bool read(cv::Mat& frame, int64_t* capture_ns = nullptr) override;
+
+private:
+  cv::Size size_;
+  double fps_;
+  size_t frames_;                 // 0 never ends
+  size_t index_ = 0;
+  cv::Mat background_;
+  int64_t next_due_ns_ = 0;
+};
+
+class ReplaySource : public FrameSource
+{
+public:
+  ReplaySource(const std::string& path, ReplayTiming timing = ReplayTiming::NATIVE) : replay_(path, timing) {}
+
+  bool isOpened() const override { return replay_.isOpened(); }
+  bool read(cv::Mat& frame, int64_t* capture_ns = nullptr) override { return replay_.read(frame, capture_ns); }
+
+private:
+  FrameReplay replay_;
+};
+
+class RecordSink : public FrameSink
+{
+public:
+  RecordSink(const std::string& path, FrameCompression compression = FrameCompression::RAW) : recorder_(path, compression) {}
+
+  bool isOpened() const override { return recorder_.isOpened(); }
+  bool write(const cv::Mat& frame, int64_t capture_ns) override { return recorder_.write(frame, capture_ns); }
+
+private:
+  FrameRecorder recorder_;
+};
+
+// video file, opened with the size of the first frame
+class VideoFileSink : public FrameSink
+{
+public:
+  VideoFileSink(const std::string& path, double fps = 30) : path_(path), fps_(fps) {}
+
+  bool isOpened() const override { return true; }
+  bool write(const cv::Mat& frame, int64_t capture_ns) override;
+
+private:
+  std::string path_;
+  double fps_;
+  cv::VideoWriter writer_;
+};
+
+/**
+ * @brief openSource build a source from a spec
+ *        camera:N or N        camera N, decoded ahead, newest frame wins
+ *        synthetic[:WxH[@fps]] synthetic test pattern
+ *        shm:name             frames published in shared memory by cv_publish
+ *        replay:path, *.cvraw recording made with cv_read --record
+ *        images:path, directory or glob pattern  image sequence
+ *        anything else        video file, decoded ahead, lossless
+ *
+ * @param spec source spec
+ * @return std::unique_ptr<FrameSource> the source, check isOpened
+ */
+std::unique_ptr<FrameSource> openSource(const std::string& spec);
+
+/**
+ * @brief openSink build a sink from a spec
+ *        shm:name             publish into shared memory
+ *        *.cvraw              recording
+ *        anything else        video file
+ *
+ * @param spec sink spec
+ * @return std::unique_ptr<FrameSink> the sink
+ */
+std::unique_ptr<FrameSink> openSink(const std::string& spec);
@@ -0,0 +1,160 @@
+/**
+ * @file hsv_tuner.cpp
+ * @brief HSV range tuner for static images.
+ *
+ */
+
+#include "hsv_tuner.hpp"
+
+#include <opencv2/highgui.hpp>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+void hsvMask(const Mat& hsv, const HsvRange& range, Mat& mask)
+{
+  if (range.h_min <= range.h_max) {
+    inRange(hsv, range.lower(), range.upper(), mask);
+    return;
+  }
+
+  // hue wraps around, e.g. reds from 170 to 10
+  Mat upper_hues;
+  inRange(hsv, Scalar(range.h_min, range.s_min, range.v_min), Scalar(179, range.s_max, range.v_max), upper_hues);
+  inRange(hsv, Scalar(0, range.s_min, range.v_min), Scalar(range.h_max, range.s_max, range.v_max), mask);
+  bitwise_or(mask, upper_hues, mask);
+}
+
+HsvTuner::HsvTuner(const string& window, int preview_pixels, int settle_ms)
+  : window_(window), preview_pixels_(preview_pixels), settle_ms_(settle_ms)
+{
+}
+
+void HsvTuner::createTrackbars()
+{
+  createTrackbar("Hue_min", window_, &range_.h_min, 179);
+  createTrackbar("Hue_max", window_, &range_.h_max, 179);
+  createTrackbar("Sat_min", window_, &range_.s_min, 255);
+  createTrackbar("Sat_max", window_, &range_.s_max, 255);
+  createTrackbar("Val_min", window_, &range_.v_min, 255);
+  createTrackbar("Val_max", window_, &range_.v_max, 255);
+}
+
+void HsvTuner::setImage(const Mat& img)
+{
+  // Conver RGB to HSV once per image
+  cvtColor(img, hsv_, COLOR_BGR2HSV);
+  total_pixels_ = (long long)hsv_.total();
+
+  if (total_pixels_ > preview_pixels_) {
+    Mat preview;
+    double ratio = sqrt(preview_pixels_ / (double)total_pixels_);
+    resize(img, preview, Size(), ratio, ratio, INTER_AREA);
+    cvtColor(preview, preview_hsv_, COLOR_BGR2HSV);
+  } else {
+    preview_hsv_.release();
+  }
+
+  buildHistogram();
+  has_mask_ = false;
+}
+
+void HsvTuner::buildHistogram()
+{
+  summed_.assign((size_t)(H_BINS + 1) * (SV_BINS + 1) * (SV_BINS + 1), 0);
+
+  // histogram, shifted by one in every axis to leave room for the zero border of the table
+  for (int y = 0; y < hsv_.rows; y++) {
+    const Vec3b* row = hsv_.ptr<Vec3b>(y);
+    for (int x = 0; x < hsv_.cols; x++)
+      table(row[x][0] + 1, row[x][1] / SV_BIN + 1, row[x][2] / SV_BIN + 1)++;
+  }
+
+  // prefix sums along each axis turn the histogram into a summed volume table
+  for (int h = 1; h <= H_BINS; h++)
+    for (int s = 1; s <= SV_BINS; s++)
+      for (int v = 1; v <= SV_BINS; v++)
+        table(h, s, v) += table(h, s, v - 1);
+
+  for (int h = 1; h <= H_BINS; h++)
+    for (int s = 1; s <= SV_BINS; s++)
+      for (int v = 1; v <= SV_BINS; v++)
+        table(h, s, v) += table(h, s - 1, v);
+
+  for (int h = 1; h <= H_BINS; h++)
+    for (int s = 1; s <= SV_BINS; s++)
+      for (int v = 1; v <= SV_BINS; v++)
+        table(h, s, v) += table(h - 1, s, v);
+}
+
+/**
+ * @brief countBox number of pixels in an inclusive box of histogram bins
+ */
+long long HsvTuner::countBox(int h0, int h1, int s0, int s1, int v0, int v1) const
+{
+  if (h0 > h1 || s0 > s1 || v0 > v1)
+    return 0;
+
+  h1++; s1++; v1++;
+  return (long long)table(h1, s1, v1)
+    - table(h0, s1, v1) - table(h1, s0, v1) - table(h1, s1, v0)
+    + table(h0, s0, v1) + table(h0, s1, v0) + table(h1, s0, v0)
+    - table(h0, s0, v0);
+}
+
+/**
+ * @brief coverage is exact in hue and rounded to whole bins of SV_BIN levels
+ *        in saturation and value
+ */
+double HsvTuner::coverage(const HsvRange& range) const
+{
+  if (total_pixels_ == 0)
+    return 0;
+
+  int s0 = range.s_min / SV_BIN, s1 = range.s_max / SV_BIN;
+  int v0 = range.v_min / SV_BIN, v1 = range.v_max / SV_BIN;
+
+  long long count;
+  if (range.h_min <= range.h_max)
+    count = countBox(range.h_min, range.h_max, s0, s1, v0, v1);
+  else
+    count = countBox(range.h_min, H_BINS - 1, s0, s1, v0, v1) + countBox(0, range.h_max, s0, s1, v0, v1);
+
+  return count / (double)total_pixels_;
+}
+
+bool HsvTuner::update()
+{
+  if (hsv_.empty())
+    return false;
+
+  auto now = chrono::steady_clock::now();
+
+  if ( !has_mask_ || range_ != computed_range_ ) {
+    computed_range_ = range_;
+    has_mask_ = true;
+    last_change_ = now;
+
+    if (preview_hsv_.empty()) {
+      hsvMask(hsv_, range_, mask_);
+      showing_preview_ = false;
+      full_pending_ = false;
+    } else {
+      hsvMask(preview_hsv_, range_, preview_mask_);
+      showing_preview_ = true;
+      full_pending_ = true;
+    }
+    return true;
+  }
+
+  // trackbars settled, replace the preview with the full resolution mask
+  if (full_pending_ && chrono::duration_cast<chrono::milliseconds>(now - last_change_).count() >= settle_ms_) {
+    hsvMask(hsv_, range_, mask_);
+    showing_preview_ = false;
+    full_pending_ = false;
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file hsv_tuner.hpp
+ * @brief HSV range tuner for static images.
+ *        The HSV conversion is cached, the mask is only recomputed when a trackbar moves,
+ *        large images get a low resolution preview while the trackbars are moving and
+ *        the full resolution mask once they settle. A 3-D H/S/V histogram gives the
+ *        pixel coverage of any range without touching the image.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct HsvRange {
+  int h_min = 0, s_min = 0, v_min = 0;
+  int h_max = 179, s_max = 255, v_max = 255;    // a hue min above the hue max wraps around 180
+
+  cv::Scalar lower() const { return cv::Scalar(h_min, s_min, v_min); }
+  cv::Scalar upper() const { return cv::Scalar(h_max, s_max, v_max); }
+
+  bool operator==(const HsvRange& other) const
+  {
+    return h_min == other.h_min && s_min == other.s_min && v_min == other.v_min
+        && h_max == other.h_max && s_max == other.s_max && v_max == other.v_max;
+  }
+  bool operator!=(const HsvRange& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief hsvMask inRange on an HSV image with hue wrap-around
+ *
+ * @param hsv HSV image
+ * @param range HSV range
+ * @param mask output mask
+ */
+void hsvMask(const cv::Mat& hsv, const HsvRange& range, cv::Mat& mask);
+
+class HsvTuner
+{
+public:
+  /**
+   * @brief Construct a new Hsv Tuner
+   *
+   * @param window window the trackbars are created in
+   * @param preview_pixels images larger than this get a low resolution preview
+   * @param settle_ms time the trackbars have to stay still before the full resolution mask is computed
+   */
+  explicit HsvTuner(const std::string& window, int preview_pixels = 1000000, int settle_ms = 150);
+
+  void setImage(const cv::Mat& img);
+  void createTrackbars();
+
+  /**
+   * @brief update recomputes the mask if the range changed or a pending full
+   *        resolution mask is due, otherwise does nothing
+   *
+   * @return true when mask() changed
+   */
+  bool update();
+
+  const cv::Mat& mask() const { return showing_preview_ ? preview_mask_ : mask_; }
+  const cv::Mat& hsv() const { return hsv_; }
+  bool showingPreview() const { return showing_preview_; }
+
+  HsvRange range() const { return range_; }
+  void setRange(const HsvRange& range) { range_ = range; }
+
+  // fraction of pixels inside a range, from the histogram
+  double coverage(const HsvRange& range) const;
+  double coverage() const { return coverage(range_); }
+
+private:
+  static const int SV_BIN = 4;                    // saturation and value levels per histogram bin
+  static const int H_BINS = 180;
+  static const int SV_BINS = 256 / SV_BIN;
+
+  void buildHistogram();
+  long long countBox(int h0, int h1, int s0, int s1, int v0, int v1) const;
+  int& table(int h, int s, int v) { return summed_[((size_t)h * (SV_BINS + 1) + s) * (SV_BINS + 1) + v]; }
+  int table(int h, int s, int v) const { return summed_[((size_t)h * (SV_BINS + 1) + s) * (SV_BINS + 1) + v]; }
+
+  std::string window_;
+  int preview_pixels_;
+  int settle_ms_;
+
+  HsvRange range_;
+  HsvRange computed_range_;
+  bool has_mask_ = false;
+  bool full_pending_ = false;
+  bool showing_preview_ = false;
+  std::chrono::steady_clock::time_point last_change_;
+
+  cv::Mat hsv_, preview_hsv_;
+  cv::Mat mask_, preview_mask_;
+  std::vector<int> summed_;                       // summed volume table of the H/S/V histogram
+  long long total_pixels_ = 0;
+};
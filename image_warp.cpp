@@ -3,6 +3,8 @@
 #include <opencv2/highgui.hpp>
 #include <iostream>
 
+#include "warp_engine.hpp"
+
 
 using namespace std;
 using namespace cv;
@@ -14,25 +16,18 @@ int main()
   Mat img = imread(path);
 
   float width = 250, height = 350;
-  Mat matrix, img_warp;
+  Mat img_warp;
 
-  Point2f src_coord[4] = {
+  vector<Point2f> src_coord = {
     {529, 142},
     {771, 190},
     {405, 395},
     {674, 457}
   };
 
-  Point2f dest_coord[4] = {
-    {0.0f, 0.0f},
-    {width, 0.0f},
-    {0.0f, height},
-    {width, height}
-  };
-  
-  // get transformation matrix
-  matrix = getPerspectiveTransform(src_coord, dest_coord);
-  warpPerspective(img, img_warp, matrix, Point(width, height));
+  // transformation matrix and remap tables are computed by the warp engine
+  WarpEngine warp_engine;
+  warp_engine.warp(img, src_coord, Size((int)width, (int)height), 0, img_warp);
 
   for (int i = 0; i < 4; i++) {
     circle(img, src_coord[i], 10, Scalar(0, 0, 255), FILLED);
@@ -0,0 +1,129 @@
+/**
+ * @file marker_classifier.cpp
+ * @brief Single pass multi-marker color classifier.
+ *
+ */
+
+#include "marker_classifier.hpp"
+
+#include <climits>
+#include <mutex>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+const int LUT_SHIFT = 8 - MarkerClassifier::LUT_BITS;
+const int LUT_LEVELS = 1 << MarkerClassifier::LUT_BITS;
+
+/**
+ * @brief inHsvRange check a HSV value against a marker range, hue wraps when min > max
+ */
+static bool inHsvRange(const Vec3b& hsv, const Scalar& lower, const Scalar& upper)
+{
+  bool hue_ok;
+  if (lower[0] <= upper[0])
+    hue_ok = hsv[0] >= lower[0] && hsv[0] <= upper[0];
+  else
+    hue_ok = hsv[0] >= lower[0] || hsv[0] <= upper[0];
+
+  return hue_ok
+    && hsv[1] >= lower[1] && hsv[1] <= upper[1]
+    && hsv[2] >= lower[2] && hsv[2] <= upper[2];
+}
+
+void MarkerClassifier::build(const vector<Marker>& markers)
+{
+  num_markers_ = min<size_t>(markers.size(), MAX_MARKERS);
+  bounds_.assign(num_markers_, Rect());
+
+  // HSV value at the center of every quantized BGR cell
+  Mat cells(1, LUT_LEVELS * LUT_LEVELS * LUT_LEVELS, CV_8UC3);
+  Vec3b* cell = cells.ptr<Vec3b>();
+  const int center = (1 << LUT_SHIFT) / 2;
+  for (int b = 0; b < LUT_LEVELS; b++)
+    for (int g = 0; g < LUT_LEVELS; g++)
+      for (int r = 0; r < LUT_LEVELS; r++)
+        *cell++ = Vec3b((b << LUT_SHIFT) + center, (g << LUT_SHIFT) + center, (r << LUT_SHIFT) + center);
+
+  Mat cells_hsv;
+  cvtColor(cells, cells_hsv, COLOR_BGR2HSV);
+
+  lut_.assign(cells.total(), 0);
+  const Vec3b* hsv = cells_hsv.ptr<Vec3b>();
+  for (size_t i = 0; i < lut_.size(); i++) {
+    for (size_t m = 0; m < num_markers_; m++) {
+      if (inHsvRange(hsv[i], markers[m].min_color_range, markers[m].max_color_range)) {
+        lut_[i] = (uchar)(m + 1);
+        break;
+      }
+    }
+  }
+}
+
+void MarkerClassifier::classify(const Mat& frame)
+{
+  TRACE_SPAN("paint.classify");
+  CV_Assert(frame.type() == CV_8UC3);
+
+  labels_.create(frame.size(), CV_8UC1);
+  bounds_.assign(num_markers_, Rect());
+  if (num_markers_ == 0) {
+    labels_.setTo(Scalar(0));
+    return;
+  }
+
+  mutex bounds_mutex;
+  const uchar* lut = lut_.data();
+
+  parallel_for_(Range(0, frame.rows), [&](const Range& rows) {
+    // per stripe bounding boxes, merged once at the end of the stripe
+    vector<int> min_x(num_markers_, INT_MAX), max_x(num_markers_, -1);
+    vector<int> min_y(num_markers_, INT_MAX), max_y(num_markers_, -1);
+
+    for (int y = rows.start; y < rows.end; y++) {
+      const uchar* src = frame.ptr<uchar>(y);
+      uchar* dst = labels_.ptr<uchar>(y);
+
+      for (int x = 0; x < frame.cols; x++, src += 3) {
+        int index = ((src[0] >> LUT_SHIFT) << (2 * LUT_BITS))
+                  | ((src[1] >> LUT_SHIFT) << LUT_BITS)
+                  |  (src[2] >> LUT_SHIFT);
+        uchar label = lut[index];
+        dst[x] = label;
+
+        if (label) {
+          int m = label - 1;
+          min_x[m] = min(min_x[m], x);
+          max_x[m] = max(max_x[m], x);
+          min_y[m] = min(min_y[m], y);
+          max_y[m] = max(max_y[m], y);
+        }
+      }
+    }
+
+    lock_guard<mutex> lock(bounds_mutex);
+    for (size_t m = 0; m < num_markers_; m++) {
+      if (max_x[m] < 0)
+        continue;
+      Rect stripe_bounds(Point(min_x[m], min_y[m]), Point(max_x[m] + 1, max_y[m] + 1));
+      bounds_[m] = bounds_[m].empty() ? stripe_bounds : (bounds_[m] | stripe_bounds);
+    }
+  });
+}
+
+void MarkerClassifier::findBlobs(size_t marker_index, vector<vector<Point>>& contours)
+{
+  // findContours resizes the set in place, a pooled set keeps its capacity
+  if (marker_index >= num_markers_ || bounds_[marker_index].empty()) {
+    contours.clear();
+    return;
+  }
+
+  // only the region the marker was seen in needs a mask
+  Rect roi = bounds_[marker_index];
+  compare(labels_(roi), Scalar((double)(marker_index + 1)), mask_, CMP_EQ);
+
+  findContours(mask_, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, roi.tl());
+}
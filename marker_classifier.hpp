@@ -0,0 +1,62 @@
+/**
+ * @file marker_classifier.hpp
+ * @brief Labels every pixel of a frame with the marker whose HSV range it falls in,
+ *        using a quantized BGR lookup table built once from the marker ranges.
+ *        One pass over the frame serves all markers, so the cost per frame does
+ *        not grow with the number of markers.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+typedef struct marker {
+  cv::Scalar color;
+  cv::Scalar min_color_range;     // HSV, a hue min above the hue max wraps around 180 (reds)
+  cv::Scalar max_color_range;
+  std::vector<cv::Point> pen_tip;
+} Marker;
+
+class MarkerClassifier
+{
+public:
+  static const int LUT_BITS = 6;                          // bits kept per BGR channel
+  static const int MAX_MARKERS = 254;                     // label 0 is background, 255 is reserved
+
+  /**
+   * @brief build the BGR to label lookup table. A pixel takes the label of the
+   *        first marker whose range contains it.
+   *
+   * @param markers markers to classify
+   */
+  void build(const std::vector<Marker>& markers);
+
+  /**
+   * @brief classify label a BGR frame, marker i is stored as label i + 1
+   *
+   * @param frame BGR frame
+   */
+  void classify(const cv::Mat& frame);
+
+  /**
+   * @brief findBlobs extract the outer contours of one marker from the label image
+   *
+   * @param marker_index index of the marker
+   * @param contours contours in frame coordinates
+   */
+  void findBlobs(size_t marker_index, std::vector<std::vector<cv::Point>>& contours);
+
+  size_t size() const { return num_markers_; }
+  const cv::Mat& labels() const { return labels_; }
+  cv::Rect markerBounds(size_t marker_index) const { return bounds_[marker_index]; }
+
+private:
+  std::vector<uchar> lut_;
+  size_t num_markers_ = 0;
+
+  cv::Mat labels_;
+  cv::Mat mask_;
+  std::vector<cv::Rect> bounds_;    // bounding box of every label in the last classified frame
+};
@@ -0,0 +1,214 @@
+/**
+ * @file multi_cascade.cpp
+ * @brief Several cascades evaluated over one shared image pyramid.
+ *
+ */
+
+#include "multi_cascade.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+// same grouping epsilon CascadeClassifier::detectMultiScale uses internally
+const double GROUP_EPS = 0.2;
+
+// detectMultiScale tries every position instead of every other one from this scale
+// on, a single scale scan of a prebuilt level always runs at scale 1 and would skip
+// half the rows and columns there
+const double DENSE_STEP_FACTOR = 2.0;
+
+static bool denseLevel(double factor)
+{
+  return factor >= DENSE_STEP_FACTOR;
+}
+
+MultiCascadeDetector::MultiCascadeDetector(const vector<CascadeSpec>& specs, const MultiCascadeParams& params)
+  : specs_(specs), params_(params)
+{
+  if (specs_.empty())
+    return;
+
+  size_t num_workers = params_.num_threads > 0 ? params_.num_threads : max(1u, thread::hardware_concurrency());
+  vector<Worker> workers(num_workers);
+
+  for (const CascadeSpec& spec : specs_) {
+    for (Worker& worker : workers) {
+      CascadeClassifier cascade;
+      if ( !cascade.load(spec.path) ) {
+        cout << "Could not load cascade: " << spec.path << endl;
+        return;
+      }
+      worker.cascades.push_back(cascade);
+    }
+    windows_.push_back(workers[0].cascades.back().getOriginalWindowSize());
+  }
+
+  for (Worker& worker : workers)
+    worker.hits.resize(specs_.size());
+
+  workers_ = move(workers);
+  pool_ = make_unique<ThreadPool>(num_workers);
+}
+
+/**
+ * @brief planLevels enumerates the shared pyramid the way detectMultiScale does and
+ *        hands the (cascade, level) pairs to the workers, largest scan first to the
+ *        least loaded worker
+ *
+ * @param image_size size of the image the cascades run on
+ */
+void MultiCascadeDetector::planLevels(Size image_size)
+{
+  levels_.clear();
+  planned_size_ = image_size;
+  planned_to_frame_ = to_frame_;
+  for (Worker& worker : workers_)
+    worker.jobs.clear();
+
+  Size smallest = windows_[0];
+  for (const Size& window : windows_)
+    smallest = Size(min(smallest.width, window.width), min(smallest.height, window.height));
+
+  for (double factor = 1; ; factor *= params_.scale_factor) {
+    Size size(cvRound(image_size.width / factor), cvRound(image_size.height / factor));
+    if (size.width < smallest.width || size.height < smallest.height)
+      break;
+    levels_.push_back({factor, size, Mat()});
+  }
+
+  vector<Job> jobs;
+  const double to_detection = 1.0 / to_frame_;
+  for (size_t c = 0; c < specs_.size(); c++) {
+    const Size& window = windows_[c];
+    Size min_size = window;
+    Size max_size = image_size;
+    if (specs_[c].min_size.area() > 0)
+      min_size = Size(cvRound(specs_[c].min_size.width * to_detection), cvRound(specs_[c].min_size.height * to_detection));
+    if (specs_[c].max_size.area() > 0)
+      max_size = Size(cvRound(specs_[c].max_size.width * to_detection), cvRound(specs_[c].max_size.height * to_detection));
+
+    for (size_t l = 0; l < levels_.size(); l++) {
+      const Level& level = levels_[l];
+      Size scaled(cvRound(window.width * level.factor), cvRound(window.height * level.factor));
+      if (scaled.width > max_size.width || scaled.height > max_size.height)
+        break;
+      if (window.width > level.size.width || window.height > level.size.height)
+        break;
+      if (scaled.width < min_size.width || scaled.height < min_size.height)
+        continue;
+
+      // windows tried, every other position below the dense scales
+      double step = denseLevel(level.factor) ? 1 : 2;
+      double cost = (double)(level.size.width - window.width + 1) * (level.size.height - window.height + 1) / (step * step);
+      jobs.push_back({c, l, cost});
+    }
+  }
+
+  sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.cost > b.cost; });
+
+  vector<double> load(workers_.size(), 0);
+  for (const Job& job : jobs) {
+    size_t w = min_element(load.begin(), load.end()) - load.begin();
+    workers_[w].jobs.push_back(job);
+    load[w] += job.cost;
+  }
+}
+
+void MultiCascadeDetector::detect(const Mat& frame, vector<vector<Rect>>& hits)
+{
+  TRACE_SPAN("multi.detect");
+  auto start = chrono::steady_clock::now();
+  hits.assign(specs_.size(), vector<Rect>());
+
+  if (empty() || frame.empty())
+    return;
+
+  if (frame.channels() == 1)
+    frame.copyTo(gray_);
+  else
+    cvtColor(frame, gray_, COLOR_BGR2GRAY);
+
+  Mat detection = gray_;
+  if (params_.detection_width > 0 && params_.detection_width < gray_.cols) {
+    double ratio = params_.detection_width / (double) gray_.cols;
+    resize(gray_, small_, Size(), ratio, ratio, INTER_AREA);
+    detection = small_;
+  }
+  to_frame_ = gray_.cols / (double) detection.cols;
+
+  // the size limits of the cascades depend on the downscale too
+  if (detection.size() != planned_size_ || to_frame_ != planned_to_frame_)
+    planLevels(detection.size());
+
+  // build every fine level once, all cascades read from the same buffers, with the
+  // interpolation detectMultiScale resizes its own levels with
+  {
+    TRACE_SPAN("multi.pyramid");
+    parallel_for_(Range(0, (int)levels_.size()), [&](const Range& range) {
+      for (int l = range.start; l < range.end; l++) {
+        if (l == 0)
+          levels_[l].image = detection;
+        else if ( !denseLevel(levels_[l].factor) )
+          resize(detection, levels_[l].image, levels_[l].size, 0, 0, INTER_LINEAR_EXACT);
+      }
+    });
+  }
+
+  vector<future<void>> pending;
+  for (Worker& worker : workers_) {
+    for (vector<Rect>& cascade_hits : worker.hits)
+      cascade_hits.clear();
+
+    if (worker.jobs.empty())
+      continue;
+
+    pending.push_back(pool_->submit([this, &worker]() {
+      vector<Rect> raw;
+      for (const Job& job : worker.jobs) {
+        TRACE_SPAN("multi.level");
+        const Level& level = levels_[job.level];
+        const Size& window = windows_[job.cascade];
+
+        double to_frame = level.factor * to_frame_;
+        if (denseLevel(level.factor)) {
+          // min and max size pick this one scale out of the full pyramid, so the scan
+          // steps every pixel like the separate call; the level is small at this scale
+          Size scaled(cvRound(window.width * level.factor), cvRound(window.height * level.factor));
+          worker.cascades[job.cascade].detectMultiScale(levels_[0].image, raw, params_.scale_factor, 0, 0, scaled, scaled);
+          to_frame = to_frame_;
+        } else {
+          // a single scale: min and max size are both the native window
+          worker.cascades[job.cascade].detectMultiScale(level.image, raw, params_.scale_factor, 0, 0, window, window);
+        }
+
+        for (const Rect& r : raw) {
+          worker.hits[job.cascade].push_back(Rect(
+            cvRound(r.x * to_frame),
+            cvRound(r.y * to_frame),
+            cvRound(r.width * to_frame),
+            cvRound(r.height * to_frame)
+          ));
+        }
+      }
+    }));
+  }
+  for (future<void>& job : pending)
+    job.get();
+
+  for (size_t c = 0; c < specs_.size(); c++) {
+    for (const Worker& worker : workers_)
+      hits[c].insert(hits[c].end(), worker.hits[c].begin(), worker.hits[c].end());
+
+    groupRectangles(hits[c], specs_[c].min_neighbors, GROUP_EPS);
+  }
+
+  last_latency_ms_ = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  double current_fps = 1000.0 / max(last_latency_ms_, 1e-3);
+  fps_ = fps_ > 0 ? 0.9 * fps_ + 0.1 * current_fps : current_fps;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file multi_cascade.hpp
+ * @brief Several cascades (e.g. faces and license plates) evaluated over one shared
+ *        image pyramid. The frame is converted to grayscale and downscaled once for
+ *        all cascades. The fine levels (scale below 2) are resized once as well and
+ *        every cascade scans them at its native window size, stepping every other
+ *        pixel like detectMultiScale does at those scales.
+ *        The coarse levels (scale 2 and up) are not shared: detectMultiScale steps
+ *        every pixel there, which a single scale scan of a prebuilt level cannot do,
+ *        so each cascade resizes the detection image and builds its integral image
+ *        for every coarse level it scans. They are small, a quarter of the detection
+ *        image or less.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+struct CascadeSpec {
+  std::string name;
+  std::string path;
+  int min_neighbors = 1;
+  cv::Size min_size;            // in full resolution pixels
+  cv::Size max_size;            // in full resolution pixels
+};
+
+struct MultiCascadeParams {
+  double scale_factor = 1.1;
+  int detection_width = 0;      // width frames are downscaled to before detection, 0 keeps full resolution
+  int num_threads = 0;          // 0 uses the hardware concurrency
+};
+
+class MultiCascadeDetector
+{
+public:
+  MultiCascadeDetector(const std::vector<CascadeSpec>& specs, const MultiCascadeParams& params = MultiCascadeParams());
+
+  // true when any cascade failed to load
+  bool empty() const { return workers_.empty(); }
+
+  /**
+   * @brief detect objects of every cascade in a BGR or grayscale frame
+   *
+   * @param frame input frame
+   * @param hits boxes per cascade, in the order of the specs, full resolution frame coordinates
+   */
+  void detect(const cv::Mat& frame, std::vector<std::vector<cv::Rect>>& hits);
+
+  size_t size() const { return specs_.size(); }
+  const CascadeSpec& spec(size_t cascade) const { return specs_[cascade]; }
+  size_t levels() const { return levels_.size(); }
+  double fps() const { return fps_; }
+  double lastLatencyMs() const { return last_latency_ms_; }
+
+private:
+  struct Level {
+    double factor;
+    cv::Size size;
+    cv::Mat image;                // empty for the coarse levels, each cascade's detectMultiScale resizes those itself
+  };
+
+  // one cascade evaluated on one pyramid level
+  struct Job {
+    size_t cascade;
+    size_t level;
+    double cost;
+  };
+
+  struct Worker {
+    std::vector<cv::CascadeClassifier> cascades;  // own instances, a classifier is not safe to share between threads
+    std::vector<Job> jobs;
+    std::vector<std::vector<cv::Rect>> hits;      // raw candidates per cascade, full resolution
+  };
+
+  void planLevels(cv::Size image_size);
+
+  std::vector<CascadeSpec> specs_;
+  MultiCascadeParams params_;
+  std::vector<cv::Size> windows_;
+  std::vector<Worker> workers_;
+  std::unique_ptr<ThreadPool> pool_;
+
+  std::vector<Level> levels_;
+  cv::Size planned_size_;
+  double planned_to_frame_ = 0;   // to_frame_ the size limits were planned with
+  double to_frame_ = 1.0;
+
+  cv::Mat gray_, small_;
+
+  double fps_ = 0;
+  double last_latency_ms_ = 0;
+};
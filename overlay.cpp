@@ -0,0 +1,389 @@
+/**
+ * @file overlay.cpp
+ * @brief Batched frame annotation.
+ *
+ */
+
+#include "overlay.hpp"
+
+#include <algorithm>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+void OverlayBuffer::addLine(Point from, Point to, const Scalar& color, int thickness)
+{
+  Point points[2] = {from, to};
+  addPolyline(points, 2, false, color, thickness);
+}
+
+void OverlayBuffer::addRect(const Rect& rect, const Scalar& color, int thickness)
+{
+  if (rect.width <= 0 || rect.height <= 0)
+    return;
+
+  // the outline rectangle() draws, br() is one past the last pixel
+  Point points[4] = {
+    rect.tl(),
+    Point(rect.x + rect.width - 1, rect.y),
+    Point(rect.x + rect.width - 1, rect.y + rect.height - 1),
+    Point(rect.x, rect.y + rect.height - 1)
+  };
+  addPolyline(points, 4, true, color, thickness);
+}
+
+void OverlayBuffer::addPolyline(const Point* points, int count, bool closed, const Scalar& color, int thickness)
+{
+  if (count <= 0)
+    return;
+
+  Command command;
+  command.text = false;
+  command.closed = closed;
+  command.thickness = thickness;
+  command.font = 0;
+  command.scale = 0;
+  command.color = color;
+  command.first = (int)points_.size();
+  command.count = count;
+
+  points_.insert(points_.end(), points, points + count);
+  commands_.push_back(command);
+}
+
+void OverlayBuffer::addPolyline(const vector<Point>& points, bool closed, const Scalar& color, int thickness)
+{
+  addPolyline(points.data(), (int)points.size(), closed, color, thickness);
+}
+
+void OverlayBuffer::addText(const string& text, Point origin, const Scalar& color, double scale, int thickness, int font)
+{
+  if (text.empty())
+    return;
+
+  Command command;
+  command.text = true;
+  command.closed = false;
+  command.thickness = thickness;
+  command.font = font;
+  command.scale = scale;
+  command.color = color;
+  command.origin = origin;
+  command.first = (int)text_.size();
+  command.count = (int)text.size();
+
+  text_ += text;
+  commands_.push_back(command);
+}
+
+void OverlayBuffer::clear()
+{
+  commands_.clear();
+  points_.clear();
+  text_.clear();
+}
+
+void OverlayBuffer::swap(OverlayBuffer& other)
+{
+  commands_.swap(other.commands_);
+  points_.swap(other.points_);
+  text_.swap(other.text_);
+}
+
+LabelCache::LabelCache(size_t capacity, bool antialias)
+  : capacity_(max<size_t>(capacity, 1)), antialias_(antialias)
+{
+}
+
+LabelCache& LabelCache::shared()
+{
+  static LabelCache cache;
+  return cache;
+}
+
+/**
+ * @brief rasterizeLabel render the text once into a coverage mask cropped to the
+ *        pixels it touches. Rendering is independent of what is underneath, so
+ *        blitting the mask sets the same pixels putText would.
+ */
+static shared_ptr<const OverlayLabel> rasterizeLabel(const string& text, int font, double scale, int thickness, bool antialias)
+{
+  int baseline = 0;
+  Size size = getTextSize(text, font, scale, thickness, &baseline);
+
+  // strokes reach past the text box by the line thickness, and some glyphs rise
+  // above the cap height or start left of the origin
+  int pad = max(2 * thickness, size.height / 2) + 2;
+  Mat canvas = Mat::zeros(size.height + baseline + 2 * pad, size.width + 2 * pad, CV_8UC1);
+  Point origin(pad, pad + size.height);
+  putText(canvas, text, origin, font, scale, Scalar(255), thickness, antialias ? LINE_AA : LINE_8);
+
+  auto label = make_shared<OverlayLabel>();
+  vector<Point> covered;
+  findNonZero(canvas, covered);
+  if (covered.empty())
+    return label;
+
+  Rect bounds = boundingRect(covered);
+  label->alpha = canvas(bounds).clone();
+  label->offset = bounds.tl() - origin;
+
+  return label;
+}
+
+shared_ptr<const OverlayLabel> LabelCache::get(const string& text, int font, double scale, int thickness)
+{
+  string key = text;
+  key += '\0';
+  key += to_string(font) + ":" + to_string(cvRound(scale * 1000)) + ":" + to_string(thickness);
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    auto found = labels_.find(key);
+    if (found != labels_.end()) {
+      recent_.splice(recent_.begin(), recent_, found->second.recent);
+      hits_++;
+      return found->second.label;
+    }
+    misses_++;
+  }
+
+  // rasterized without the lock, two threads may race to add the same label
+  shared_ptr<const OverlayLabel> label = rasterizeLabel(text, font, scale, thickness, antialias_);
+
+  lock_guard<mutex> lock(mutex_);
+  if (labels_.count(key))
+    return labels_[key].label;
+
+  recent_.push_front(key);
+  labels_[key] = {label, recent_.begin()};
+
+  if (labels_.size() > capacity_) {
+    labels_.erase(recent_.back());
+    recent_.pop_back();
+  }
+
+  return label;
+}
+
+size_t LabelCache::size() const
+{
+  lock_guard<mutex> lock(mutex_);
+  return labels_.size();
+}
+
+uint64_t LabelCache::hits() const
+{
+  lock_guard<mutex> lock(mutex_);
+  return hits_;
+}
+
+uint64_t LabelCache::misses() const
+{
+  lock_guard<mutex> lock(mutex_);
+  return misses_;
+}
+
+/**
+ * @brief blitLabel blend the label's coverage mask into the frame in the text color
+ */
+static void blitLabel(Mat& frame, const OverlayLabel& label, Point origin, const Scalar& color)
+{
+  if (label.alpha.empty())
+    return;
+
+  Rect target(origin + label.offset, label.alpha.size());
+  Rect visible = target & Rect(0, 0, frame.cols, frame.rows);
+  if (visible.empty())
+    return;
+
+  const int channels = frame.channels();
+  uchar ink[4];
+  for (int c = 0; c < 4; c++)
+    ink[c] = saturate_cast<uchar>(color[c]);
+
+  for (int y = 0; y < visible.height; y++) {
+    const uchar* alpha = label.alpha.ptr<uchar>(visible.y - target.y + y) + (visible.x - target.x);
+    uchar* dst = frame.ptr<uchar>(visible.y + y) + visible.x * channels;
+
+    for (int x = 0; x < visible.width; x++, dst += channels) {
+      const int a = alpha[x];
+      if (a == 0)
+        continue;
+
+      if (a == 255) {
+        for (int c = 0; c < channels; c++)
+          dst[c] = ink[c];
+      } else {
+        for (int c = 0; c < channels; c++)
+          dst[c] = (uchar)((dst[c] * (255 - a) + ink[c] * a + 127) / 255);
+      }
+    }
+  }
+}
+
+void renderOverlay(const OverlayBuffer& overlay, Mat& frame, LabelCache& cache)
+{
+  TRACE_SPAN("overlay.render");
+  if (overlay.empty() || frame.empty())
+    return;
+
+  const vector<OverlayBuffer::Command>& commands = overlay.commands_;
+
+  // shapes: runs of the same color, thickness and closure are one polylines call
+  thread_local vector<const Point*> starts;
+  thread_local vector<int> counts;
+
+  for (size_t i = 0; i < commands.size(); ) {
+    const OverlayBuffer::Command& first = commands[i];
+    if (first.text) {
+      i++;
+      continue;
+    }
+
+    starts.clear();
+    counts.clear();
+    size_t j = i;
+    for (; j < commands.size(); j++) {
+      const OverlayBuffer::Command& next = commands[j];
+      if (next.text)
+        continue;
+      if (next.closed != first.closed || next.thickness != first.thickness || next.color != first.color)
+        break;
+
+      starts.push_back(&overlay.points_[next.first]);
+      counts.push_back(next.count);
+    }
+
+    // filled shapes one by one, overlapping ones would cancel out in a single call
+    if (first.thickness < 0)
+      for (size_t k = 0; k < starts.size(); k++)
+        fillPoly(frame, &starts[k], &counts[k], 1, first.color);
+    else
+      polylines(frame, starts.data(), counts.data(), (int)starts.size(), first.closed, first.color, first.thickness);
+    i = j;
+  }
+
+  // labels on top, only the frame's 8 bit layout is blitted directly
+  const bool blit = frame.depth() == CV_8U && frame.channels() <= 4;
+
+  for (const OverlayBuffer::Command& command : commands) {
+    if ( !command.text )
+      continue;
+
+    thread_local string text;
+    text.assign(overlay.text_, command.first, command.count);
+    if ( !blit ) {
+      putText(frame, text, command.origin, command.font, command.scale, command.color, command.thickness);
+      continue;
+    }
+
+    shared_ptr<const OverlayLabel> label = cache.get(text, command.font, command.scale, command.thickness);
+    blitLabel(frame, *label, command.origin, command.color);
+  }
+}
+
+bool parseOverlayMode(const string& text, OverlayMode& mode)
+{
+  if (text == "inline") mode = OverlayMode::INLINE;
+  else if (text == "thread") mode = OverlayMode::THREAD;
+  else if (text == "off") mode = OverlayMode::HEADLESS;
+  else return false;
+
+  return true;
+}
+
+OverlayRenderer::OverlayRenderer(OverlayMode mode, LabelCache& cache)
+  : mode_(mode), cache_(cache)
+{
+  if (mode_ == OverlayMode::THREAD)
+    thread_ = thread(&OverlayRenderer::renderLoop, this);
+}
+
+OverlayRenderer::~OverlayRenderer()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  job_ready_.notify_all();
+
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void OverlayRenderer::submit(const Mat& frame, OverlayBuffer& overlay)
+{
+  if (mode_ != OverlayMode::THREAD) {
+    if (mode_ == OverlayMode::INLINE) {
+      Mat target = frame;
+      renderOverlay(overlay, target, cache_);
+    }
+    overlay.clear();
+    rendered_.push_back(frame);
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    queued_.emplace_back();
+    queued_.back().frame = frame;
+    queued_.back().overlay.swap(overlay);
+
+    // the caller keeps appending into a buffer that already has capacity
+    if ( !spares_.empty() ) {
+      overlay.swap(spares_.back());
+      spares_.pop_back();
+    }
+  }
+  job_ready_.notify_one();
+}
+
+bool OverlayRenderer::collect(Mat& frame, bool drain)
+{
+  if (mode_ != OverlayMode::THREAD) {
+    if (rendered_.empty())
+      return false;
+    frame = rendered_.front();
+    rendered_.pop_front();
+    return true;
+  }
+
+  unique_lock<mutex> lock(mutex_);
+  size_t outstanding = queued_.size() + (busy_ ? 1 : 0) + rendered_.size();
+  if (outstanding == 0 || (outstanding == 1 && !drain))
+    return false;
+
+  job_done_.wait(lock, [&]() { return !rendered_.empty(); });
+  frame = rendered_.front();
+  rendered_.pop_front();
+
+  return true;
+}
+
+void OverlayRenderer::renderLoop()
+{
+  unique_lock<mutex> lock(mutex_);
+
+  while (true) {
+    job_ready_.wait(lock, [&]() { return stopping_ || !queued_.empty(); });
+    if (queued_.empty())
+      break;
+
+    Job job = move(queued_.front());
+    queued_.pop_front();
+    busy_ = true;
+    lock.unlock();
+
+    renderOverlay(job.overlay, job.frame, cache_);
+    job.overlay.clear();
+
+    lock.lock();
+    busy_ = false;
+    rendered_.push_back(job.frame);
+    spares_.push_back(move(job.overlay));
+    job_done_.notify_all();
+  }
+}
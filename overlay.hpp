@@ -0,0 +1,186 @@
+/**
+ * @file overlay.hpp
+ * @brief Batched frame annotation.
+ *        Detectors append lines, rectangles, polygons and labels to an OverlayBuffer
+ *        instead of drawing on the frame, and the buffer is rendered in one pass:
+ *        consecutive shapes of the same style go out as a single polylines call and
+ *        labels are blitted from alpha masks rasterized once per distinct text.
+ *        Rendering can run inline, on its own thread, or be skipped when headless.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class LabelCache;
+
+class OverlayBuffer
+{
+public:
+  void addLine(cv::Point from, cv::Point to, const cv::Scalar& color, int thickness = 1);
+  void addRect(const cv::Rect& rect, const cv::Scalar& color, int thickness = 1);
+  void addPolyline(const cv::Point* points, int count, bool closed, const cv::Scalar& color, int thickness = 1);
+  void addPolyline(const std::vector<cv::Point>& points, bool closed, const cv::Scalar& color, int thickness = 1);
+
+  // same arguments as putText, origin is the bottom left corner of the text
+  void addText(const std::string& text, cv::Point origin, const cv::Scalar& color,
+               double scale = 1, int thickness = 1, int font = cv::FONT_HERSHEY_PLAIN);
+
+  void clear();
+  bool empty() const { return commands_.empty(); }
+  size_t size() const { return commands_.size(); }
+  void swap(OverlayBuffer& other);
+
+private:
+  friend void renderOverlay(const OverlayBuffer& overlay, cv::Mat& frame, LabelCache& cache);
+
+  struct Command {
+    bool text;
+    bool closed;                  // polygons only
+    int thickness;
+    int font;                     // text only
+    double scale;                 // text only
+    cv::Scalar color;
+    cv::Point origin;             // text only
+    int first;                    // offset into points_ or text_
+    int count;
+  };
+
+  std::vector<Command> commands_;
+  std::vector<cv::Point> points_;   // vertices of every shape
+  std::string text_;                // characters of every label
+};
+
+struct OverlayLabel {
+  cv::Mat alpha;                    // coverage of the rendered text, CV_8UC1
+  cv::Point offset;                 // top left of alpha relative to the text origin
+};
+
+class LabelCache
+{
+public:
+  /**
+   * @brief Construct a new Label Cache
+   *
+   * @param capacity labels kept, the least recently used one is dropped beyond that
+   * @param antialias rasterize with LINE_AA, otherwise the labels match putText exactly
+   */
+  explicit LabelCache(size_t capacity = 4096, bool antialias = false);
+
+  // cache used by default, shared by every renderer
+  static LabelCache& shared();
+
+  /**
+   * @brief get the label for this text and style, rasterized on first use
+   *
+   * @return std::shared_ptr<const OverlayLabel> stays valid after eviction
+   */
+  std::shared_ptr<const OverlayLabel> get(const std::string& text, int font, double scale, int thickness);
+
+  size_t size() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+private:
+  struct Entry {
+    std::shared_ptr<const OverlayLabel> label;
+    std::list<std::string>::iterator recent;
+  };
+
+  size_t capacity_;
+  bool antialias_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> labels_;
+  std::list<std::string> recent_;   // most recently used first
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+/**
+ * @brief renderOverlay draw a buffer on a frame in one pass, shapes first in the order
+ *        they were added and the labels on top
+ *
+ * @param overlay commands to draw
+ * @param frame 8 bit frame to draw on
+ * @param cache label cache
+ */
+void renderOverlay(const OverlayBuffer& overlay, cv::Mat& frame, LabelCache& cache = LabelCache::shared());
+
+enum class OverlayMode {
+  INLINE,       // render on the calling thread
+  THREAD,       // render on a thread of its own, one frame behind
+  HEADLESS      // skip rendering
+};
+
+/**
+ * @brief parseOverlayMode inline, thread or off
+ *
+ * @return false for an unknown mode
+ */
+bool parseOverlayMode(const std::string& text, OverlayMode& mode);
+
+class OverlayRenderer
+{
+public:
+  explicit OverlayRenderer(OverlayMode mode = OverlayMode::INLINE, LabelCache& cache = LabelCache::shared());
+  ~OverlayRenderer();
+
+  OverlayRenderer(const OverlayRenderer&) = delete;
+  OverlayRenderer& operator=(const OverlayRenderer&) = delete;
+
+  OverlayMode mode() const { return mode_; }
+  bool headless() const { return mode_ == OverlayMode::HEADLESS; }
+
+  /**
+   * @brief submit a frame and its annotations. In THREAD mode the frame is drawn on
+   *        while the caller goes on, so do not write to it before it is collected.
+   *
+   * @param frame frame to annotate, shared
+   * @param overlay commands, taken and left empty
+   */
+  void submit(const cv::Mat& frame, OverlayBuffer& overlay);
+
+  /**
+   * @brief collect the next annotated frame in submission order. THREAD mode keeps
+   *        the latest submission rendering while the caller works on the next frame,
+   *        so right after the first submit there is nothing to collect.
+   *
+   * @param frame receives the annotated frame
+   * @param drain also wait for the latest submission
+   * @return false when there is no frame to collect
+   */
+  bool collect(cv::Mat& frame, bool drain = false);
+
+private:
+  struct Job {
+    cv::Mat frame;
+    OverlayBuffer overlay;
+  };
+
+  void renderLoop();
+
+  OverlayMode mode_;
+  LabelCache& cache_;
+
+  std::mutex mutex_;
+  std::condition_variable job_ready_;
+  std::condition_variable job_done_;
+  std::deque<Job> queued_;
+  std::deque<cv::Mat> rendered_;
+  std::vector<OverlayBuffer> spares_;   // rendered buffers handed back to submit, they keep their capacity
+  bool busy_ = false;
+  bool stopping_ = false;
+  std::thread thread_;
+};
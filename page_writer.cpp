@@ -0,0 +1,448 @@
+/**
+ * @file page_writer.cpp
+ * @brief Output stage for rectified pages.
+ *
+ */
+
+#include "page_writer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+namespace fs = std::filesystem;
+
+bool parsePageFormat(const string& text, PageFormat& format)
+{
+  if (text == "png") format = PageFormat::PNG;
+  else if (text == "jpg" || text == "jpeg") format = PageFormat::JPEG;
+  else if (text == "tif" || text == "tiff") format = PageFormat::TIFF;
+  else return false;
+
+  return true;
+}
+
+bool parsePageColor(const string& text, PageColor& color)
+{
+  if (text == "color") color = PageColor::COLOR;
+  else if (text == "gray") color = PageColor::GRAY;
+  else if (text == "binary") color = PageColor::BINARY;
+  else return false;
+
+  return true;
+}
+
+static uint32_t readBigEndian(const uchar* bytes)
+{
+  return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+}
+
+/**
+ * @brief PdfStream multi-page PDF written one page at a time. Every page is one
+ *        image: JPEG data is embedded as is, PNG data is unwrapped to its zlib stream,
+ *        which PDF reads with the same predictors, so neither is decoded again.
+ *        Catalog and page tree are the first two objects but are written last.
+ */
+class PageWriter::PdfStream
+{
+public:
+  PdfStream(const string& path, size_t buffer_bytes, double dpi)
+    : buffer_(max<size_t>(buffer_bytes, 4096)), dpi_(dpi > 0 ? dpi : 150)
+  {
+    // the buffer has to be installed before the file is opened
+    out_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+    out_.open(path, ios::binary | ios::trunc);
+
+    out_ << "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n";
+    offsets_.resize(2, 0);
+  }
+
+  bool isOpened() const { return out_.is_open() && out_.good(); }
+
+  bool addPage(const EncodedPage& page)
+  {
+    vector<uchar> png_data;
+    const vector<uchar>* data = &page.bytes;
+    int bits = page.bits;
+    int colors = page.channels;
+
+    if ( !page.jpeg ) {
+      if ( !unwrapPng(page.bytes, png_data, bits, colors) ) {
+        cout << "Cannot embed page " << page.name << " in the container" << endl;
+        return false;
+      }
+      data = &png_data;
+    }
+
+    int image = beginObject();
+    out_ << "<< /Type /XObject /Subtype /Image /Width " << page.width << " /Height " << page.height
+         << " /ColorSpace " << (colors == 1 ? "/DeviceGray" : "/DeviceRGB") << " /BitsPerComponent " << bits;
+    if (page.jpeg)
+      out_ << " /Filter /DCTDecode";
+    else
+      out_ << " /Filter /FlateDecode /DecodeParms << /Predictor 15 /Colors " << colors
+           << " /BitsPerComponent " << bits << " /Columns " << page.width << " >>";
+    out_ << " /Length " << data->size() << " >>\nstream\n";
+    out_.write((const char*)data->data(), data->size());
+    out_ << "\nendstream\nendobj\n";
+
+    // page size follows from the resolution, the image fills the page
+    ostringstream content;
+    content << fixed << setprecision(2);
+    double width = page.width * 72.0 / dpi_;
+    double height = page.height * 72.0 / dpi_;
+    content << "q " << width << " 0 0 " << height << " 0 0 cm /Im0 Do Q";
+    string text = content.str();
+
+    int contents = beginObject();
+    out_ << "<< /Length " << text.size() << " >>\nstream\n" << text << "\nendstream\nendobj\n";
+
+    int page_object = beginObject();
+    out_ << fixed << setprecision(2)
+         << "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 " << width << " " << height << "]"
+         << " /Resources << /XObject << /Im0 " << image << " 0 R >> >> /Contents " << contents << " 0 R >>\nendobj\n";
+    out_ << defaultfloat;
+    pages_.push_back(page_object);
+
+    return out_.good();
+  }
+
+  void finish()
+  {
+    beginObject(1);
+    out_ << "<< /Type /Catalog /Pages 2 0 R >>\nendobj\n";
+
+    beginObject(2);
+    out_ << "<< /Type /Pages /Kids [";
+    for (int page : pages_)
+      out_ << page << " 0 R ";
+    out_ << "] /Count " << pages_.size() << " >>\nendobj\n";
+
+    uint64_t xref = out_.tellp();
+    out_ << "xref\n0 " << offsets_.size() + 1 << "\n0000000000 65535 f \n";
+    char entry[32];
+    for (uint64_t offset : offsets_) {
+      snprintf(entry, sizeof(entry), "%010llu 00000 n \n", (unsigned long long)offset);
+      out_ << entry;
+    }
+    out_ << "trailer\n<< /Size " << offsets_.size() + 1 << " /Root 1 0 R >>\nstartxref\n" << xref << "\n%%EOF\n";
+    out_.close();
+  }
+
+  size_t pages() const { return pages_.size(); }
+
+private:
+  // start object number, or the next free number, at the current offset
+  int beginObject(int number = 0)
+  {
+    if (number == 0) {
+      offsets_.push_back(0);
+      number = offsets_.size();
+    }
+    offsets_[number - 1] = out_.tellp();
+    out_ << number << " 0 obj\n";
+    return number;
+  }
+
+  // concatenated IDAT data of a non-interlaced gray or RGB PNG
+  static bool unwrapPng(const vector<uchar>& png, vector<uchar>& data, int& bits, int& colors)
+  {
+    size_t at = 8;
+    bool header = false;
+
+    while (at + 12 <= png.size()) {
+      uint32_t length = readBigEndian(&png[at]);
+      const uchar* type = &png[at + 4];
+      const uchar* chunk = &png[at + 8];
+      if (at + 12 + length > png.size())
+        return false;
+
+      if (memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+        int color_type = chunk[9];
+        int interlace = chunk[12];
+        if (interlace != 0 || (color_type != 0 && color_type != 2))
+          return false;
+        bits = chunk[8];
+        colors = color_type == 0 ? 1 : 3;
+        header = true;
+      } else if (memcmp(type, "IDAT", 4) == 0) {
+        data.insert(data.end(), chunk, chunk + length);
+      } else if (memcmp(type, "IEND", 4) == 0) {
+        break;
+      }
+
+      at += 12 + length;
+    }
+
+    return header && !data.empty();
+  }
+
+  vector<char> buffer_;
+  ofstream out_;
+  double dpi_;
+  vector<uint64_t> offsets_;        // file offset of object i + 1
+  vector<int> pages_;
+};
+
+PageWriter::PageWriter(const PageWriterOptions& options)
+  : options_(options), format_(options.format)
+{
+  if (options_.max_pending == 0)
+    options_.max_pending = 1;
+
+  if ( !options_.container.empty() && format_ == PageFormat::TIFF ) {
+    cout << "TIFF pages cannot go into a PDF container, writing PNG instead" << endl;
+    format_ = PageFormat::PNG;
+  }
+  extension_ = format_ == PageFormat::JPEG ? ".jpg" : format_ == PageFormat::TIFF ? ".tif" : ".png";
+
+  error_code error;
+  fs::create_directories(options_.output_dir, error);
+
+  if ( !options_.container.empty() ) {
+    pdf_ = make_unique<PdfStream>(outputPath(""), options_.write_buffer, options_.dpi);
+    if ( !pdf_->isOpened() ) {
+      cout << "Cannot open " << outputPath("") << endl;
+      pdf_.reset();
+      return;
+    }
+  }
+
+  // encoding runs next to scanning, leave a core to the caller
+  size_t encoders = options_.encoders > 0 ? options_.encoders : max(2u, thread::hardware_concurrency()) - 1;
+  encoders_ = make_unique<ThreadPool>(encoders);
+  writer_ = thread(&PageWriter::writerLoop, this);
+  opened_ = true;
+}
+
+PageWriter::~PageWriter()
+{
+  close();
+}
+
+string PageWriter::outputPath(const string& name) const
+{
+  if ( !options_.container.empty() )
+    return (fs::path(options_.output_dir) / options_.container).string();
+
+  return (fs::path(options_.output_dir) / (name + extension_)).string();
+}
+
+bool PageWriter::trySubmit(const Mat& page, const string& name)
+{
+  size_t index;
+  {
+    lock_guard<mutex> lock(mutex_);
+    if ( !opened_ || closing_ )
+      return false;
+
+    // a live caller never waits for the encoders
+    if (pending_ >= options_.max_pending) {
+      stats_.dropped++;
+      return false;
+    }
+
+    index = next_index_++;
+    pending_++;
+    stats_.submitted++;
+    stats_.max_pending = max(stats_.max_pending, pending_);
+  }
+
+  enqueue(index, page, name);
+  return true;
+}
+
+void PageWriter::submit(size_t index, const Mat& page, const string& name)
+{
+  {
+    unique_lock<mutex> lock(mutex_);
+    if ( !opened_ || closing_ )
+      return;
+
+    // the page the writer waits for always gets in, or a full queue of later pages
+    // would wait for it forever
+    slot_free_.wait(lock, [&]() { return pending_ < options_.max_pending || index == next_write_ || closing_; });
+
+    pending_++;
+    stats_.max_pending = max(stats_.max_pending, pending_);
+
+    if (page.empty()) {
+      done_[index].name = name;
+      page_done_.notify_one();
+      return;
+    }
+    stats_.submitted++;
+  }
+
+  enqueue(index, page, name);
+}
+
+void PageWriter::enqueue(size_t index, const Mat& page, const string& name)
+{
+  // the caller reuses its buffer as soon as this returns. Rectified pages differ
+  // in size from page to page, so the copy is a plain one freed after encoding
+  Mat copy = page.clone();
+
+  encoders_->submit([this, index, copy, name]() {
+    EncodedPage encoded = encode(copy, name);
+    {
+      lock_guard<mutex> lock(mutex_);
+      done_[index] = move(encoded);
+    }
+    page_done_.notify_one();
+  });
+}
+
+PageWriter::EncodedPage PageWriter::encode(const Mat& page, const string& name)
+{
+  TRACE_SPAN("pages.encode");
+  const int64_t start = trace::now();
+
+  EncodedPage encoded;
+  encoded.name = name;
+
+  Mat converted;
+  if (options_.color == PageColor::COLOR) {
+    if (page.channels() == 4)
+      cvtColor(page, converted, COLOR_BGRA2BGR);
+    else
+      converted = page;
+  } else {
+    Mat gray;
+    if (page.channels() == 1)
+      gray = page;
+    else
+      cvtColor(page, gray, page.channels() == 4 ? COLOR_BGRA2GRAY : COLOR_BGR2GRAY);
+
+    // a local threshold keeps text readable under uneven lighting
+    if (options_.color == PageColor::BINARY)
+      adaptiveThreshold(gray, converted, 255, ADAPTIVE_THRESH_GAUSSIAN_C, THRESH_BINARY, 31, 15);
+    else
+      converted = gray;
+  }
+
+  vector<int> params;
+  if (format_ == PageFormat::JPEG) {
+    params = {IMWRITE_JPEG_QUALITY, options_.jpeg_quality};
+    encoded.jpeg = true;
+  } else if (format_ == PageFormat::PNG && options_.color == PageColor::BINARY) {
+    // one bit per pixel
+    params = {IMWRITE_PNG_BILEVEL, 1};
+    encoded.bits = 1;
+  }
+
+  if ( !imencode(extension_, converted, encoded.bytes, params) ) {
+    cout << "Cannot encode page " << name << endl;
+    encoded.bytes.clear();
+  }
+  encoded.width = converted.cols;
+  encoded.height = converted.rows;
+  encoded.channels = converted.channels();
+
+  double ms = (trace::now() - start) / 1e6;
+  {
+    lock_guard<mutex> lock(mutex_);
+    encoded_++;
+    encode_ms_total_ += ms;
+  }
+
+  return encoded;
+}
+
+/**
+ * @brief writerLoop store the pages in index order, encoders finish in any order
+ *        and their pages wait in done_ until it is their turn
+ */
+void PageWriter::writerLoop()
+{
+  unique_lock<mutex> lock(mutex_);
+
+  while (true) {
+    page_done_.wait(lock, [&]() { return done_.count(next_write_) > 0 || (closing_ && pending_ == 0); });
+
+    auto ready = done_.find(next_write_);
+    if (ready == done_.end())
+      break;
+
+    EncodedPage page = move(ready->second);
+    done_.erase(ready);
+    lock.unlock();
+
+    bool written = false;
+    if ( !page.bytes.empty() )
+      written = writePage(page);
+
+    lock.lock();
+    if (written) {
+      stats_.written++;
+      stats_.bytes += page.bytes.size();
+    }
+    next_write_++;
+    pending_--;
+    slot_free_.notify_all();
+  }
+}
+
+bool PageWriter::writePage(const EncodedPage& page)
+{
+  TRACE_SPAN("pages.write");
+
+  if (pdf_)
+    return pdf_->addPage(page);
+
+  string path = outputPath(page.name);
+  ofstream out(path, ios::binary | ios::trunc);
+  out.write((const char*)page.bytes.data(), page.bytes.size());
+  if ( !out ) {
+    cout << "Cannot write " << path << endl;
+    return false;
+  }
+
+  return true;
+}
+
+void PageWriter::close()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    if ( !opened_ || closing_ )
+      return;
+    closing_ = true;
+  }
+  page_done_.notify_all();
+  slot_free_.notify_all();
+
+  // the writer leaves once every page is written, which means the encoders are idle
+  writer_.join();
+  encoders_.reset();
+
+  if (pdf_)
+    pdf_->finish();
+}
+
+PageWriterStats PageWriter::stats() const
+{
+  lock_guard<mutex> lock(mutex_);
+  PageWriterStats all = stats_;
+  if (encoded_ > 0)
+    all.encode_ms = encode_ms_total_ / encoded_;
+
+  return all;
+}
+
+void printPageWriterStats(const PageWriterStats& stats)
+{
+  cout << "Pages written: " << stats.written << " of " << stats.submitted
+       << " (" << stats.dropped << " dropped, " << stats.max_pending << " pending at most)" << endl;
+  cout << "Encoded: " << fixed << setprecision(2) << stats.bytes / 1048576.0 << " MB, "
+       << stats.encode_ms << " ms per page" << endl;
+}
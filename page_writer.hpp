@@ -0,0 +1,159 @@
+/**
+ * @file page_writer.hpp
+ * @brief Output stage for rectified pages.
+ *        Pages are encoded on a bounded pool of encoder threads, optionally as
+ *        grayscale or binarized images to cut their size, and a single writer thread
+ *        stores them in page order: one file per page, or all pages of a batch
+ *        appended to one multi-page PDF as they arrive. Encoding overlaps with
+ *        scanning, and trySubmit drops a page rather than blocking a live capture.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+enum class PageFormat {
+  PNG,
+  JPEG,
+  TIFF        // per-page files only, the container falls back to PNG
+};
+
+enum class PageColor {
+  COLOR,
+  GRAY,
+  BINARY      // adaptive threshold, bilevel when stored as PNG
+};
+
+struct PageWriterOptions {
+  std::string output_dir = "scans";
+  PageFormat format = PageFormat::PNG;
+  PageColor color = PageColor::COLOR;
+  int jpeg_quality = 90;
+  int encoders = 0;                 // encoder threads, 0 leaves one core to the caller
+  size_t max_pending = 16;          // pages submitted but not yet written
+  std::string container;            // PDF file in output_dir taking every page, empty writes one file per page
+  double dpi = 150;                 // page size in the container
+  size_t write_buffer = 1 << 20;    // bytes the writer buffers before it flushes
+};
+
+struct PageWriterStats {
+  uint64_t submitted = 0;
+  uint64_t dropped = 0;             // pages trySubmit turned away because the encoders were behind
+  uint64_t written = 0;
+  uint64_t bytes = 0;               // encoded bytes written
+  double encode_ms = 0;             // mean color conversion and encoding time per page
+  size_t max_pending = 0;
+};
+
+/**
+ * @brief parsePageFormat png, jpg or jpeg, tif or tiff
+ *
+ * @return false for an unknown format
+ */
+bool parsePageFormat(const std::string& text, PageFormat& format);
+
+/**
+ * @brief parsePageColor color, gray or binary
+ *
+ * @return false for an unknown mode
+ */
+bool parsePageColor(const std::string& text, PageColor& color);
+
+class PageWriter
+{
+public:
+  explicit PageWriter(const PageWriterOptions& options = PageWriterOptions());
+  ~PageWriter();
+
+  PageWriter(const PageWriter&) = delete;
+  PageWriter& operator=(const PageWriter&) = delete;
+
+  bool isOpened() const { return opened_; }
+
+  /**
+   * @brief trySubmit queue the next page without waiting, for live capture
+   *
+   * @param page rectified page, copied
+   * @param name file name without extension
+   * @return false if the page was dropped because max_pending pages are queued
+   */
+  bool trySubmit(const cv::Mat& page, const std::string& name);
+
+  /**
+   * @brief submit page number index of a batch, waits while max_pending pages are
+   *        queued. Pages are written in index order, so every index from 0 up has to
+   *        be submitted once, with an empty page for pages without output. Do not
+   *        mix with trySubmit.
+   *
+   * @param index position of the page in the output
+   * @param page rectified page, copied, empty to skip the index
+   * @param name file name without extension
+   */
+  void submit(size_t index, const cv::Mat& page, const std::string& name);
+
+  // where a page of this name ends up
+  std::string outputPath(const std::string& name) const;
+
+  // wait until every submitted page is written and finish the container
+  void close();
+
+  PageWriterStats stats() const;
+
+private:
+  struct EncodedPage {
+    std::string name;
+    std::vector<uchar> bytes;       // empty when the index is skipped
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int bits = 8;
+    bool jpeg = false;
+  };
+
+  void enqueue(size_t index, const cv::Mat& page, const std::string& name);
+  EncodedPage encode(const cv::Mat& page, const std::string& name);
+  void writerLoop();
+  bool writePage(const EncodedPage& page);
+
+  PageWriterOptions options_;
+  PageFormat format_;               // format actually encoded, see PageFormat::TIFF
+  std::string extension_;
+  bool opened_ = false;
+
+  std::unique_ptr<ThreadPool> encoders_;
+  std::thread writer_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable page_done_;
+  std::condition_variable slot_free_;
+  std::map<size_t, EncodedPage> done_;  // encoded pages waiting for their turn
+  size_t next_index_ = 0;           // next index trySubmit hands out
+  size_t next_write_ = 0;           // index the writer waits for
+  size_t pending_ = 0;
+  bool closing_ = false;
+  PageWriterStats stats_;
+  uint64_t encoded_ = 0;
+  double encode_ms_total_ = 0;
+
+  // multi-page container, only touched by the writer thread
+  class PdfStream;
+  std::unique_ptr<PdfStream> pdf_;
+};
+
+/**
+ * @brief printPageWriterStats print what the writer stored
+ *
+ * @param stats writer statistics
+ */
+void printPageWriterStats(const PageWriterStats& stats);
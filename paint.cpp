@@ -0,0 +1,280 @@
+/**
+ * @file paint.cpp
+ * @brief Pen tip tracking and stroke drawing for the virtual paint application
+ * 
+ */
+
+#include "paint.hpp"
+#include "frame_pool.hpp"
+#include "trace.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief getPenTip function to get pen tip from image
+ * 
+ * @param classifier classifier holding the labels of the current frame
+ * @param marker_index index of the marker in the classifier
+ * @param marker marker object, its pen_tip is replaced by the tips of this frame
+ * @param overlay overlay the crossairs are added to
+ * @param debug also add the marker polygons
+ */
+void getPenTip(MarkerClassifier& classifier, size_t marker_index, Marker *marker, OverlayBuffer& overlay, bool debug)
+{
+  TRACE_SPAN("paint.getPenTip");
+  FrameScope scope;
+  ContourSet& contours = scope.contours();
+
+  // the history lives in the paint canvas, only this frame's tips are kept here
+  marker->pen_tip.clear();
+
+  // contours of the marker's pixels, the frame was labelled once for all markers
+  classifier.findBlobs(marker_index, contours);
+  if (contours.size() == 0) return;
+
+  ContourSet& min_polygon = scope.contours();   // Minimum bounding box poligon, used to predict shape
+  min_polygon.resize(contours.size());
+  Rect bounding_rect;
+  
+  Point pen_tip(0, 0);
+
+  for (int i = 0; i < contours.size(); i++) {
+
+    double area = contourArea(contours[i]);
+    double perimeter = arcLength(contours[i], true);
+
+    // skip small contours
+    if (area < 1000)
+      continue;
+    
+    // Find minimum polygon
+    approxPolyDP(contours[i], min_polygon[i], 0.02*perimeter, true);
+    
+    // find minimum bounding rect; can be gotten from contour directly too
+    bounding_rect = boundingRect(min_polygon[i]);
+
+    if (debug) overlay.addPolyline(min_polygon[i], true, Scalar(0, 0, 255), 2);
+
+    // get pen tip from bounding rect
+    pen_tip.x = bounding_rect.x + bounding_rect.width / 2;  // center of bounding rect width
+    pen_tip.y = bounding_rect.y;                            // top of bounding rect
+
+    // draw crossair at pen tip
+    overlay.addLine(Point(pen_tip.x - 10, pen_tip.y), Point(pen_tip.x + 10, pen_tip.y), Scalar(0, 255, 0), 1);
+    overlay.addLine(Point(pen_tip.x, pen_tip.y - 10), Point(pen_tip.x, pen_tip.y + 10), Scalar(0, 255, 0), 1);
+
+    marker->pen_tip.push_back(pen_tip);
+  }
+}
+
+/**
+ * @brief drawPaint function to draw the marker's current pen tips
+ * 
+ * @param marker marker object
+ * @param img frame to draw on
+ */
+void drawPaint(const Marker& marker, Mat& img)
+{
+  TRACE_SPAN("paint.drawPaint");
+
+  for (size_t i = 1; i < marker.pen_tip.size(); i++) {
+    // skip empty pen tips
+    if (marker.pen_tip[i-1] == Point(0, 0) || marker.pen_tip[i] == Point(0, 0))
+      continue;
+
+    // draw line from previous pen tip to current pen tip
+    line(img, marker.pen_tip[i-1], marker.pen_tip[i], marker.color, 2);
+  }
+}
+
+// stroke log records
+enum : uint8_t {
+  LOG_START = 1,      // marker, x, y: start point of the following segments
+  LOG_ABSOLUTE = 2,   // marker, x, y: segment to an absolute point
+  LOG_DELTA = 3       // marker, dx, dy: segment to a point at most 127 px away
+};
+
+static void put16(vector<uint8_t>& data, int value)
+{
+  int16_t v = saturate_cast<short>(value);
+  data.push_back((uint8_t)(v & 0xff));
+  data.push_back((uint8_t)((v >> 8) & 0xff));
+}
+
+static int get16(const uint8_t* data)
+{
+  return (int16_t)(data[0] | (data[1] << 8));
+}
+
+StrokeLog::StrokeLog(size_t max_bytes, bool compress)
+  : max_bytes_(max<size_t>(max_bytes, CHUNK_BYTES)), compress_(compress)
+{
+}
+
+void StrokeLog::clear()
+{
+  chunks_.clear();
+  segments_ = 0;
+  dropped_ = 0;
+  bytes_ = 0;
+}
+
+void StrokeLog::append(uint8_t marker, Point from, Point to)
+{
+  // worst case is a start and an absolute record, 6 bytes each
+  if (chunks_.empty() || chunks_.back().data.size() + 12 > CHUNK_BYTES) {
+    chunks_.emplace_back();
+    chunks_.back().data.reserve(CHUNK_BYTES);
+  }
+
+  Chunk& chunk = chunks_.back();
+  size_t before = chunk.data.size();
+
+  if ( !chunk.started[marker] || last_[marker] != from ) {
+    chunk.data.push_back(LOG_START);
+    chunk.data.push_back(marker);
+    put16(chunk.data, from.x);
+    put16(chunk.data, from.y);
+    chunk.started[marker] = true;
+  }
+
+  Point delta = to - from;
+  if (compress_ && abs(delta.x) <= 127 && abs(delta.y) <= 127) {
+    chunk.data.push_back(LOG_DELTA);
+    chunk.data.push_back(marker);
+    chunk.data.push_back((uint8_t)(int8_t)delta.x);
+    chunk.data.push_back((uint8_t)(int8_t)delta.y);
+  } else {
+    chunk.data.push_back(LOG_ABSOLUTE);
+    chunk.data.push_back(marker);
+    put16(chunk.data, to.x);
+    put16(chunk.data, to.y);
+  }
+
+  last_[marker] = to;
+  chunk.segments++;
+  segments_++;
+  bytes_ += chunk.data.size() - before;
+
+  // over budget: forget the oldest strokes
+  while (bytes_ > max_bytes_ && chunks_.size() > 1) {
+    bytes_ -= chunks_.front().data.size();
+    segments_ -= chunks_.front().segments;
+    dropped_ += chunks_.front().segments;
+    chunks_.pop_front();
+  }
+}
+
+void StrokeLog::forEach(const function<void(uint8_t marker, Point from, Point to)>& visit) const
+{
+  for (const Chunk& chunk : chunks_) {
+    array<Point, 256> position{};
+    const uint8_t* data = chunk.data.data();
+    size_t i = 0;
+
+    while (i < chunk.data.size()) {
+      uint8_t record = data[i];
+      uint8_t marker = data[i + 1];
+
+      if (record == LOG_DELTA) {
+        Point to = position[marker] + Point((int8_t)data[i + 2], (int8_t)data[i + 3]);
+        visit(marker, position[marker], to);
+        position[marker] = to;
+        i += 4;
+        continue;
+      }
+
+      Point point(get16(data + i + 2), get16(data + i + 4));
+      if (record == LOG_ABSOLUTE)
+        visit(marker, position[marker], point);
+      position[marker] = point;
+      i += 6;
+    }
+  }
+}
+
+PaintCanvas::PaintCanvas(int thickness, size_t log_bytes, bool compress_log)
+  : thickness_(max(thickness, 1)), log_(log_bytes, compress_log)
+{
+}
+
+void PaintCanvas::ensureSize(Size size)
+{
+  if (layer_.size() == size)
+    return;
+
+  layer_ = Mat::zeros(size, CV_8UC3);
+  mask_ = Mat::zeros(size, CV_8UC1);
+  dirty_ = Rect();
+
+  // redraw what the log still holds at the new size
+  log_.forEach([&](uint8_t marker, Point from, Point to) {
+    rasterize(from, to, marker < colors_.size() ? colors_[marker] : Scalar::all(255));
+  });
+}
+
+void PaintCanvas::rasterize(Point from, Point to, const Scalar& color)
+{
+  line(layer_, from, to, color, thickness_);
+  line(mask_, from, to, Scalar(255), thickness_);
+
+  Rect segment(Point(min(from.x, to.x) - thickness_, min(from.y, to.y) - thickness_),
+               Point(max(from.x, to.x) + thickness_ + 1, max(from.y, to.y) + thickness_ + 1));
+  segment &= Rect(0, 0, layer_.cols, layer_.rows);
+  dirty_ = dirty_.area() > 0 ? (dirty_ | segment) : segment;
+}
+
+void PaintCanvas::addStrokes(size_t marker_index, const Marker& marker, Size size)
+{
+  TRACE_SPAN("paint.addStrokes");
+  ensureSize(size);
+
+  if (marker_index >= colors_.size()) {
+    colors_.resize(marker_index + 1);
+    last_tip_.resize(marker_index + 1);
+    has_tip_.resize(marker_index + 1, false);
+  }
+  colors_[marker_index] = marker.color;
+
+  // only the new segments are drawn, earlier strokes are already in the layer
+  for (const Point& tip : marker.pen_tip) {
+    if (tip == Point(0, 0))
+      continue;
+
+    if (has_tip_[marker_index]) {
+      rasterize(last_tip_[marker_index], tip, marker.color);
+      log_.append((uint8_t)marker_index, last_tip_[marker_index], tip);
+    }
+
+    last_tip_[marker_index] = tip;
+    has_tip_[marker_index] = true;
+  }
+}
+
+void PaintCanvas::penUp(size_t marker_index)
+{
+  if (marker_index < has_tip_.size())
+    has_tip_[marker_index] = false;
+}
+
+void PaintCanvas::composite(Mat& img) const
+{
+  TRACE_SPAN("paint.composite");
+  if (dirty_.area() == 0 || img.size() != layer_.size())
+    return;
+
+  Mat target = img(dirty_);
+  layer_(dirty_).copyTo(target, mask_(dirty_));
+}
+
+void PaintCanvas::clear()
+{
+  if ( !layer_.empty() ) {
+    layer_.setTo(Scalar::all(0));
+    mask_.setTo(Scalar::all(0));
+  }
+  dirty_ = Rect();
+  log_.clear();
+  has_tip_.assign(has_tip_.size(), false);
+}
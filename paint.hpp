@@ -0,0 +1,121 @@
+/**
+ * @file paint.hpp
+ * @brief Pen tip tracking and stroke drawing for the virtual paint application
+ *        Strokes are rasterized once into a persistent canvas layer that is composited
+ *        onto every frame, and kept in a bounded stroke log.
+ * 
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "marker_classifier.hpp"
+#include "overlay.hpp"
+
+/**
+ * @brief getPenTip find the pen tips of a marker in the current frame
+ *
+ * @param classifier classifier holding the labels of the current frame
+ * @param marker_index index of the marker in the classifier
+ * @param marker marker, its pen_tip is replaced by the tips of this frame
+ * @param overlay overlay the crossairs are added to
+ * @param debug also add the marker polygons
+ */
+void getPenTip(MarkerClassifier& classifier, size_t marker_index, Marker *marker, OverlayBuffer& overlay, bool debug = false);
+
+/**
+ * @brief drawPaint draw the marker's current pen tips as a polyline
+ *
+ * @param marker marker object
+ * @param img frame to draw on
+ */
+void drawPaint(const Marker& marker, cv::Mat& img);
+
+/**
+ * @brief Bounded log of stroke segments. Segments are packed into fixed size chunks,
+ *        as small deltas when compressed; once the log is over its budget the oldest
+ *        chunk is dropped. Every chunk can be decoded on its own.
+ */
+class StrokeLog
+{
+public:
+  StrokeLog(size_t max_bytes = 1 << 20, bool compress = true);
+
+  void append(uint8_t marker, cv::Point from, cv::Point to);
+  void clear();
+
+  // calls visit(marker, from, to) for every logged segment, oldest first
+  void forEach(const std::function<void(uint8_t marker, cv::Point from, cv::Point to)>& visit) const;
+
+  size_t segments() const { return segments_; }
+  size_t dropped() const { return dropped_; }
+  size_t bytes() const { return bytes_; }
+
+private:
+  struct Chunk {
+    std::vector<uint8_t> data;
+    size_t segments = 0;
+    std::array<bool, 256> started{};  // markers with a known start point in this chunk
+  };
+
+  static constexpr size_t CHUNK_BYTES = 4096;
+
+  size_t max_bytes_;
+  bool compress_;
+  std::deque<Chunk> chunks_;
+  std::array<cv::Point, 256> last_{};  // end of the last logged segment per marker
+  size_t segments_ = 0;
+  size_t dropped_ = 0;
+  size_t bytes_ = 0;
+};
+
+/**
+ * @brief Persistent paint layer of a session. New segments are drawn into the layer
+ *        and its mask once, compositing is one masked copy over the painted area.
+ */
+class PaintCanvas
+{
+public:
+  PaintCanvas(int thickness = 2, size_t log_bytes = 1 << 20, bool compress_log = true);
+
+  /**
+   * @brief connect the marker's new pen tips to its previous tip
+   *
+   * @param marker_index index of the marker
+   * @param marker marker holding the pen tips of this frame
+   * @param size frame size, the layer is rebuilt from the log when it changes
+   */
+  void addStrokes(size_t marker_index, const Marker& marker, cv::Size size);
+
+  // lift the pen, the next tip of the marker starts a new stroke
+  void penUp(size_t marker_index);
+
+  /**
+   * @brief composite the painted layer onto a frame
+   *
+   * @param img frame of the canvas size
+   */
+  void composite(cv::Mat& img) const;
+
+  void clear();
+  const StrokeLog& log() const { return log_; }
+
+private:
+  void ensureSize(cv::Size size);
+  void rasterize(cv::Point from, cv::Point to, const cv::Scalar& color);
+
+  int thickness_;
+  cv::Mat layer_;               // BGR strokes
+  cv::Mat mask_;                // painted pixels of the layer
+  cv::Rect dirty_;              // bounding box of everything painted
+  std::vector<cv::Scalar> colors_;
+  std::vector<cv::Point> last_tip_;
+  std::vector<bool> has_tip_;
+  StrokeLog log_;
+};
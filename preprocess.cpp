@@ -0,0 +1,138 @@
+/**
+ * @file preprocess.cpp
+ * @brief Shared gray -> blur -> canny -> dilate edge preprocessing.
+ *
+ */
+
+#include "preprocess.hpp"
+
+#include <iostream>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+void preprocessReference(const Mat& input, Mat& output, const PreprocessParams& params)
+{
+  Mat gray, blur, canny;
+  Mat kernel = getStructuringElement(MORPH_RECT, Size(params.dilate_size, params.dilate_size));
+
+  if (input.channels() == 1)
+    gray = input;
+  else
+    cvtColor(input, gray, COLOR_BGR2GRAY);                                              // rgb to grayscale
+  GaussianBlur(gray, blur, Size(params.blur_size, params.blur_size), params.blur_sigma);  // blur
+  Canny(blur, canny, params.canny_low, params.canny_high);                              // edge detection
+  dilate(canny, output, kernel);                                                        // dilation
+}
+
+Preprocessor::Preprocessor(const PreprocessParams& params)
+  : params_(params)
+{
+  kernel_ = getStructuringElement(MORPH_RECT, Size(params_.dilate_size, params_.dilate_size));
+}
+
+string Preprocessor::simdPath()
+{
+  if ( !useOptimized() )
+    return "scalar";
+  if (checkHardwareSupport(CV_CPU_AVX2))
+    return "avx2";
+  if (checkHardwareSupport(CV_CPU_SSE4_1))
+    return "sse4";
+  if (checkHardwareSupport(CV_CPU_NEON))
+    return "neon";
+
+  return "baseline";
+}
+
+/**
+ * @brief run walks the image in bands of rows. Each stage only runs as far as the
+ *        next stage needs: a blurred band needs blur_size / 2 extra gray rows below it
+ *        and a gradient band needs one extra blurred row. Stages work on ROIs of the
+ *        full frame buffers, so OpenCV reads the real neighbouring rows instead of
+ *        inventing a border at band edges and the result is identical to whole frame calls.
+ *        Hysteresis in Canny follows edges across the whole image, so it runs once on
+ *        the precomputed gradients.
+ */
+const Mat& Preprocessor::run(const Mat& input)
+{
+  TRACE_SPAN("preprocess");
+  const int rows = input.rows;
+  const int blur_radius = params_.blur_size / 2;
+  const int band_rows = max(params_.band_rows, 1);
+
+  gray_.create(input.size(), CV_8UC1);
+  blur_.create(input.size(), CV_8UC1);
+  dx_.create(input.size(), CV_16SC1);
+  dy_.create(input.size(), CV_16SC1);
+
+  int gray_done = 0, blur_done = 0, gradient_done = 0;
+
+  for (int band_start = 0; band_start < rows; band_start += band_rows) {
+    int gradient_target = min(rows, band_start + band_rows);
+    int blur_target = min(rows, gradient_target + 1);
+    int gray_target = min(rows, blur_target + blur_radius);
+
+    // rgb to grayscale
+    if (gray_target > gray_done) {
+      Mat gray_band = gray_.rowRange(gray_done, gray_target);
+      if (input.channels() == 1)
+        input.rowRange(gray_done, gray_target).copyTo(gray_band);
+      else
+        cvtColor(input.rowRange(gray_done, gray_target), gray_band, COLOR_BGR2GRAY);
+      gray_done = gray_target;
+    }
+
+    // blur
+    if (blur_target > blur_done) {
+      Mat blur_band = blur_.rowRange(blur_done, blur_target);
+      GaussianBlur(
+        gray_.rowRange(blur_done, blur_target),
+        blur_band,
+        Size(params_.blur_size, params_.blur_size),
+        params_.blur_sigma
+      );
+      blur_done = blur_target;
+    }
+
+    // gradients, same aperture and border Canny uses internally
+    if (gradient_target > gradient_done) {
+      Mat dx_band = dx_.rowRange(gradient_done, gradient_target);
+      Mat dy_band = dy_.rowRange(gradient_done, gradient_target);
+      Sobel(blur_.rowRange(gradient_done, gradient_target), dx_band, CV_16S, 1, 0, 3, 1, 0, BORDER_REPLICATE);
+      Sobel(blur_.rowRange(gradient_done, gradient_target), dy_band, CV_16S, 0, 1, 3, 1, 0, BORDER_REPLICATE);
+      gradient_done = gradient_target;
+    }
+  }
+
+  Canny(dx_, dy_, edges_, params_.canny_low, params_.canny_high);   // edge detection
+  dilate(edges_, dilated_, kernel_);                                // dilation
+
+  if (params_.verify)
+    compareWithReference(input);
+
+  return dilated_;
+}
+
+int Preprocessor::verify(const Mat& input)
+{
+  bool verify_each_run = params_.verify;
+  params_.verify = false;
+  run(input);
+  params_.verify = verify_each_run;
+
+  return compareWithReference(input);
+}
+
+int Preprocessor::compareWithReference(const Mat& input)
+{
+  preprocessReference(input, reference_, params_);
+  last_mismatch_ = countNonZero(reference_ != dilated_);
+
+  if (last_mismatch_ > 0)
+    cerr << "Preprocess mismatch: " << last_mismatch_ << " pixels differ from the reference chain" << endl;
+
+  return last_mismatch_;
+}
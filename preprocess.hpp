@@ -0,0 +1,75 @@
+/**
+ * @file preprocess.hpp
+ * @brief Shared gray -> blur -> canny -> dilate edge preprocessing.
+ *        Stages run band by band over the rows so the intermediate results are
+ *        still in cache when the next stage reads them, and all stage buffers
+ *        are kept between calls.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+struct PreprocessParams {
+  int blur_size = 3;
+  double blur_sigma = 3;
+  double canny_low = 25;
+  double canny_high = 75;
+  int dilate_size = 3;        // MORPH_RECT kernel size
+  int band_rows = 32;         // rows per band of the fused pass
+  bool verify = false;        // compare every run against the reference OpenCV chain
+};
+
+/**
+ * @brief preprocessReference the plain OpenCV chain, used as ground truth
+ *
+ * @param input BGR input image
+ * @param output dilated edges
+ * @param params preprocessing parameters
+ */
+void preprocessReference(const cv::Mat& input, cv::Mat& output, const PreprocessParams& params = PreprocessParams());
+
+class Preprocessor
+{
+public:
+  explicit Preprocessor(const PreprocessParams& params = PreprocessParams());
+
+  /**
+   * @brief run the fused chain
+   *
+   * @param input BGR input image
+   * @return const cv::Mat& dilated edges, overwritten by the next call
+   */
+  const cv::Mat& run(const cv::Mat& input);
+
+  /**
+   * @brief verify compares the fused chain against preprocessReference
+   *
+   * @param input BGR input image
+   * @return number of mismatching pixels, 0 when bit exact
+   */
+  int verify(const cv::Mat& input);
+
+  const cv::Mat& gray() const { return gray_; }
+  const cv::Mat& blurred() const { return blur_; }
+  const cv::Mat& edges() const { return edges_; }
+  const cv::Mat& dilated() const { return dilated_; }
+
+  int lastMismatch() const { return last_mismatch_; }
+  const PreprocessParams& params() const { return params_; }
+
+  // instruction set the OpenCV kernels dispatch to at runtime on this machine
+  static std::string simdPath();
+
+private:
+  int compareWithReference(const cv::Mat& input);
+
+  PreprocessParams params_;
+  cv::Mat kernel_;
+
+  cv::Mat gray_, blur_, dx_, dy_, edges_, dilated_;
+  cv::Mat reference_;
+  int last_mismatch_ = 0;
+};
@@ -0,0 +1,96 @@
+/**
+ * @file publish.cpp
+ * @brief Publishes the frames of one source into a shared memory ring, so several
+ *        processes (doc scanner, face detector, painter) can read one camera at once.
+ *      Usage:
+ *      cv_publish [--source spec] [--name cv_frames] [--slots 8] [--frames N] [--preview]
+ *      then start the consumers with --source shm:cv_frames
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/highgui.hpp>
+#include <csignal>
+#include <iostream>
+
+#include "frame_source.hpp"
+#include "shm_ring.hpp"
+#include "trace.hpp"
+
+using namespace std;
+using namespace cv;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// Ctrl-C ends the loop so the sink closes the ring and removes the segment, a
+// second one kills the process
+static void requestStop(int signal_number)
+{
+  stop_requested = 1;
+  std::signal(signal_number, SIG_DFL);
+}
+
+int main(int argc, char** argv)
+{
+  string source = "0";
+  string name = "cv_frames";
+  int slots = 8;
+  int max_frames = 0;
+  bool preview = false;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--source" && has_value) source = argv[++i];
+    else if (arg == "--name" && has_value) name = argv[++i];
+    else if (arg == "--slots" && has_value) slots = atoi(argv[++i]);
+    else if (arg == "--frames" && has_value) max_frames = atoi(argv[++i]);
+    else if (arg == "--preview") preview = true;
+    else {
+      cout << "Usage: cv_publish [--source spec] [--name cv_frames] [--slots 8] [--frames N] [--preview]" << endl;
+      return -1;
+    }
+  }
+
+  unique_ptr<FrameSource> cap = openSource(source);
+  if ( !cap->isOpened() )
+    return -1;
+
+  ShmSink sink(name, max(slots, 2));
+  if ( !sink.isOpened() )
+    return -1;
+
+  cout << "Publishing " << source << " as shm:" << name << endl;
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  Mat img;
+  int64_t captured_at = 0;
+  int64_t report_at = trace::now();
+  uint64_t reported = 0;
+
+  while( !stop_requested && cap->read(img, &captured_at) ) {
+    if ( !sink.write(img, captured_at) )
+      break;
+
+    if (preview) {
+      imshow("Publisher", img);
+      if (waitKey(1) == 'q')
+        break;
+    }
+
+    if (max_frames > 0 && (int)sink.published() >= max_frames)
+      break;
+
+    int64_t now = trace::now();
+    if (now - report_at > 1000000000) {
+      cout << "fps: " << (sink.published() - reported) * 1e9 / (now - report_at) << endl;
+      reported = sink.published();
+      report_at = now;
+    }
+  }
+
+  cout << "Published " << sink.published() << " frames" << endl;
+  trace::flush();
+  return 0;
+}
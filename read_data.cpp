@@ -3,6 +3,11 @@
 #include <opencv2/highgui.hpp>
 #include <iostream>
 
+#include "frame_capture.hpp"
+#include "face_detector.hpp"
+#include "frame_record.hpp"
+#include "video_job.hpp"
+
 
 using namespace std;
 using namespace cv;
@@ -14,43 +19,188 @@ void readImage(string path)
   waitKey(0);
 }
 
+void printCaptureStats(const CaptureStats& stats)
+{
+  cout << "captured: " << stats.captured
+       << " delivered: " << stats.delivered
+       << " dropped: " << stats.dropped
+       << " queued: " << stats.queued << endl;
+}
+
 void readVideo(string path)
 {
-  VideoCapture cap(path);
+  // file playback is lossless, decoding waits while the ring is full
+  FrameCapture cap(path, DropPolicy::BLOCK);
   Mat img;
   
-  while(1) {
-    cap.read(img);
-
-    if (img.empty())
-      return;
-    
+  while(cap.read(img)) {
     imshow("Video", img);
     waitKey(1);
   }
 
+  printCaptureStats(cap.stats());
 }
 
 void readCamera(int camera_index)
 {
-  VideoCapture cap(camera_index);
+  // latest frame wins, stale frames are dropped instead of queued
+  FrameCapture cap(camera_index, DropPolicy::LATEST);
   Mat img;
   
-  while(1) {
-    cap.read(img);
-
-    if (img.empty())
-      return;
-    
+  while(cap.read(img)) {
     imshow("Camera", img);
-    waitKey(1);
+    if (waitKey(1) == 'q')
+      break;
+  }
+
+  printCaptureStats(cap.stats());
+}
+
+/**
+ * @brief recordFrames dump the frames of a capture into a recording
+ *
+ * @param cap capture source
+ * @param path recording to create
+ * @param compression raw or png frames
+ * @param max_frames stop after this many frames, 0 records until the source ends or q is pressed
+ */
+void recordFrames(FrameCapture& cap, string path, FrameCompression compression, int max_frames)
+{
+  FrameRecorder recorder(path, compression);
+  if ( !recorder.isOpened() )
+    return;
+
+  Mat img;
+  int64_t captured_at = 0;
+
+  while(cap.read(img, &captured_at)) {
+    recorder.write(img, captured_at);
+    imshow("Recording", img);
+    if (waitKey(1) == 'q' || (max_frames > 0 && (int)recorder.size() >= max_frames))
+      break;
+  }
+
+  cout << "Recorded " << recorder.size() << " frames to " << path << endl;
+  printCaptureStats(cap.stats());
+}
+
+/**
+ * @brief replayFrames play back a recording
+ *
+ * @param path recording
+ * @param timing native speed or the original frame timing
+ */
+void replayFrames(string path, ReplayTiming timing)
+{
+  FrameReplay replay(path, timing);
+  if ( !replay.isOpened() )
+    return;
+
+  Mat img;
+  size_t frames = 0;
+  auto start = chrono::steady_clock::now();
+  while(replay.read(img)) {
+    frames++;
+    imshow("Replay", img);
+    if (waitKey(1) == 'q')
+      break;
   }
 
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "Replayed " << frames << " frames at " << frames / seconds << " fps" << endl;
 }
 
+/**
+ * @brief detectFacesInVideo offline face detection over a video file, split across workers
+ *
+ * @param path video file
+ * @param cascade_path face cascade
+ * @param options workers and frame stride
+ */
+void detectFacesInVideo(string path, string cascade_path, const VideoJobOptions& options)
+{
+  vector<pair<size_t, vector<Rect>>> results;
+
+  VideoJobStats stats = runVideoJob(path, options, [&](size_t) {
+    // one detector per worker, the job runner already keeps every core busy
+    FaceDetectorParams params;
+    params.num_threads = 1;
+    auto detector = make_shared<FaceDetector>(cascade_path, params);
+
+    return [detector](const Mat& frame) {
+      vector<Rect> faces;
+      detector->detect(frame, faces);
+      return faces;
+    };
+  }, results);
+
+  size_t total_faces = 0;
+  for (const auto& [frame_index, faces] : results) {
+    if ( !faces.empty() )
+      cout << "frame " << frame_index << ": " << faces.size() << " faces" << endl;
+    total_faces += faces.size();
+  }
+
+  cout << "Frames: " << stats.frames << " (" << stats.processed << " processed, stride " << options.stride << ")" << endl;
+  cout << "Workers: " << stats.workers << ", segments: " << stats.segments << endl;
+  cout << "Faces: " << total_faces << endl;
+  cout << "Frames per second: " << stats.fps() << " (" << stats.fps() / max<size_t>(stats.workers, 1) << " per core)" << endl;
+}
 
-int main()
+int main(int argc, char** argv)
 {
+  // --record <file.cvraw> records the camera (or --video <path>), --replay <file> plays it back,
+  // --timed keeps the recorded frame timing, --png stores compressed frames,
+  // --faces <video> runs offline face detection with --workers N and --stride N
+  string record_path, replay_path, video_path, faces_path;
+  VideoJobOptions job_options;
+  FrameCompression compression = FrameCompression::RAW;
+  ReplayTiming timing = ReplayTiming::NATIVE;
+  int max_frames = 0;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--record" && i + 1 < argc)
+      record_path = argv[++i];
+    else if (arg == "--replay" && i + 1 < argc)
+      replay_path = argv[++i];
+    else if (arg == "--video" && i + 1 < argc)
+      video_path = argv[++i];
+    else if (arg == "--frames" && i + 1 < argc)
+      max_frames = atoi(argv[++i]);
+    else if (arg == "--png")
+      compression = FrameCompression::PNG;
+    else if (arg == "--timed")
+      timing = ReplayTiming::ORIGINAL;
+    else if (arg == "--faces" && i + 1 < argc)
+      faces_path = argv[++i];
+    else if (arg == "--workers" && i + 1 < argc)
+      job_options.workers = atoi(argv[++i]);
+    else if (arg == "--stride" && i + 1 < argc)
+      job_options.stride = max(1, atoi(argv[++i]));
+  }
+
+  if ( !faces_path.empty() ) {
+    detectFacesInVideo(faces_path, "./Resources/haarcascade_frontalface_default.xml", job_options);
+    return 0;
+  }
+
+  if ( !record_path.empty() ) {
+    if ( !video_path.empty() ) {
+      FrameCapture cap(video_path, DropPolicy::BLOCK);
+      recordFrames(cap, record_path, compression, max_frames);
+    } else {
+      FrameCapture cap(0, DropPolicy::BLOCK);
+      recordFrames(cap, record_path, compression, max_frames);
+    }
+    return 0;
+  }
+
+  if ( !replay_path.empty() ) {
+    replayFrames(replay_path, timing);
+    return 0;
+  }
+
   // readImage("Resources/test.png");
   // readVideo("Resources/test_video.mp4");
   readCamera(0);
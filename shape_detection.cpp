@@ -0,0 +1,135 @@
+/**
+ * @file shape_detection.cpp
+ * @brief Shape classification of the outer contours of an edge image
+ *
+ */
+
+#include "shape_detection.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+const char* shapeName(ShapeType type)
+{
+  switch (type) {
+    case ShapeType::TRIANGLE:   return "triangle";
+    case ShapeType::SQUARE:     return "square";
+    case ShapeType::RECTANGLE:  return "rectangle";
+    case ShapeType::CIRCLE:     return "circle";
+    default:                    return "";
+  }
+}
+
+ShapeClassifier::ShapeClassifier(const ShapeParams& params)
+  : params_(params), contour_finder_(params.contours)
+{
+}
+
+const vector<ShapeResult>& ShapeClassifier::classify(const Mat& edges)
+{
+  contour_finder_.find(edges, contours_);
+  return classify(contours_);
+}
+
+const vector<ShapeResult>& ShapeClassifier::classify(const vector<vector<Point>>& contours)
+{
+  const int count = (int)contours.size();
+
+  // a polygon never has more vertices than its contour, so every contour gets a
+  // fixed slice of the arena and the workers never grow shared storage
+  offsets_.resize(count + 1);
+  offsets_[0] = 0;
+  for (int i = 0; i < count; i++)
+    offsets_[i + 1] = offsets_[i] + (int)contours[i].size();
+  if (arena_.size() < (size_t)offsets_[count])
+    arena_.resize(offsets_[count]);
+
+  slots_.resize(count);
+
+  parallel_for_(Range(0, count), [&](const Range& range) {
+    thread_local vector<Point> approx;
+
+    for (int i = range.start; i < range.end; i++) {
+      const vector<Point>& contour = contours[i];
+      ShapeResult& slot = slots_[i];
+      slot.vertex_count = 0;
+
+      // cheap rejects first: the bounding box bounds the area from above
+      Rect box = boundingRect(contour);
+      if (box.area() < params_.min_area)
+        continue;
+      if (contourArea(contour) < params_.min_area)
+        continue;
+
+      double perimeter = arcLength(contour, true);
+      approxPolyDP(contour, approx, params_.epsilon * perimeter, true);
+
+      copy(approx.begin(), approx.end(), arena_.begin() + offsets_[i]);
+
+      slot.contour = i;
+      slot.polygon = offsets_[i];
+      slot.vertex_count = (int)approx.size();
+      slot.rect = boundingRect(approx);
+
+      if (slot.vertex_count == 3) {
+        slot.type = ShapeType::TRIANGLE;
+      } else if (slot.vertex_count == 4) {
+        float aspect_ratio = (float) slot.rect.width / (float) slot.rect.height;
+        bool square = abs(aspect_ratio - 1.0f) < params_.square_tolerance;
+        slot.type = square ? ShapeType::SQUARE : ShapeType::RECTANGLE;
+      } else if (slot.vertex_count > 4) {
+        slot.type = ShapeType::CIRCLE;
+      } else {
+        slot.type = ShapeType::UNKNOWN;
+      }
+    }
+  });
+
+  // keep the kept shapes in contour order
+  results_.clear();
+  for (const ShapeResult& slot : slots_)
+    if (slot.vertex_count > 0)
+      results_.push_back(slot);
+
+  return results_;
+}
+
+void ShapeClassifier::annotate(OverlayBuffer& overlay) const
+{
+  // grouped by style, so each group is a single polylines call
+  for (const ShapeResult& shape : results_)
+    overlay.addPolyline(polygon(shape), shape.vertex_count, true, Scalar(0, 0, 255), 2);
+  for (const ShapeResult& shape : results_)
+    overlay.addRect(shape.rect, Scalar(255, 0, 255), 1);
+  for (const ShapeResult& shape : results_)
+    overlay.addText(shapeName(shape.type), { shape.rect.x, shape.rect.y - 2 }, Scalar(255, 0, 0), 1, 1);
+}
+
+void ShapeClassifier::draw(Mat& output) const
+{
+  // labels repeat from frame to frame, so they come out of the label cache
+  thread_local OverlayBuffer overlay;
+  overlay.clear();
+  annotate(overlay);
+  renderOverlay(overlay, output);
+}
+
+void detectShapes(ShapeClassifier& classifier, Mat input, Mat output)
+{
+  TRACE_SPAN("shapes.detect");
+
+  {
+    TRACE_SPAN("shapes.classify");
+    classifier.classify(input);
+  }
+
+  TRACE_SPAN("shapes.draw");
+  classifier.draw(output);
+}
+
+void detectShapes(Mat input, Mat output)
+{
+  ShapeClassifier classifier;
+  detectShapes(classifier, input, output);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file shape_detection.hpp
+ * @brief Shape classification of the outer contours of an edge image
+ *        Contours are classified in parallel into compact results, polygons live in
+ *        one arena reused between calls, and drawing is a separate step.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "overlay.hpp"
+#include "tiled_contours.hpp"
+
+enum class ShapeType : uint8_t {
+  UNKNOWN,      // fewer than 3 vertices
+  TRIANGLE,
+  SQUARE,
+  RECTANGLE,
+  CIRCLE
+};
+
+const char* shapeName(ShapeType type);
+
+struct ShapeResult {
+  ShapeType type;
+  int vertex_count;
+  cv::Rect rect;          // bounding rect of the polygon
+  int contour;            // index into the contours
+  int polygon;            // offset of the vertices in the polygon arena
+};
+
+struct ShapeParams {
+  double min_area = 1000;         // contours with a smaller area are skipped
+  double epsilon = 0.02;          // polygon approximation accuracy, fraction of the perimeter
+  float square_tolerance = 0.1f;  // aspect ratio distance from 1 still counted as a square
+  TiledContourParams contours;    // outer contour extraction, tiled on large edge images
+};
+
+class ShapeClassifier
+{
+public:
+  explicit ShapeClassifier(const ShapeParams& params = ShapeParams());
+
+  /**
+   * @brief classify the outer contours of an edge image
+   *
+   * @param edges binary edge image
+   * @return const std::vector<ShapeResult>& shapes, valid until the next call
+   */
+  const std::vector<ShapeResult>& classify(const cv::Mat& edges);
+
+  /**
+   * @brief classify already extracted contours
+   *
+   * @param contours contours to classify
+   * @return const std::vector<ShapeResult>& shapes, valid until the next call
+   */
+  const std::vector<ShapeResult>& classify(const std::vector<std::vector<cv::Point>>& contours);
+
+  /**
+   * @brief annotate append polygon, bounding rect and label of the last classified
+   *        shapes to an overlay
+   *
+   * @param overlay overlay the shapes are added to
+   */
+  void annotate(OverlayBuffer& overlay) const;
+
+  /**
+   * @brief draw the annotations of the last classified shapes in one render pass
+   *
+   * @param output image the shapes are drawn on
+   */
+  void draw(cv::Mat& output) const;
+
+  const std::vector<ShapeResult>& results() const { return results_; }
+  const cv::Point* polygon(const ShapeResult& shape) const { return &arena_[shape.polygon]; }
+  const std::vector<std::vector<cv::Point>>& contours() const { return contours_; }
+
+private:
+  ShapeParams params_;
+  TiledContourFinder contour_finder_;
+  std::vector<std::vector<cv::Point>> contours_;
+  std::vector<ShapeResult> slots_;      // one per contour, filled in parallel
+  std::vector<int> offsets_;            // arena offset reserved per contour
+  std::vector<cv::Point> arena_;        // polygon vertices of every contour
+  std::vector<ShapeResult> results_;
+};
+
+/**
+ * @brief detectShapes label triangles, squares, rectangles and circles
+ *
+ * @param classifier classifier holding the reusable buffers
+ * @param input edge image
+ * @param output image the shapes are drawn on
+ */
+void detectShapes(ShapeClassifier& classifier, cv::Mat input, cv::Mat output);
+
+/**
+ * @brief detectShapes label triangles, squares, rectangles and circles
+ *
+ * @param input edge image
+ * @param output image the shapes are drawn on
+ */
+void detectShapes(cv::Mat input, cv::Mat output);
@@ -0,0 +1,325 @@
+/**
+ * @file shm_ring.cpp
+ * @brief Shared memory frame ring between processes.
+ *
+ */
+
+#include "shm_ring.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#ifndef _WIN32
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs address free atomics");
+
+static const char SHM_MAGIC[8] = {'C', 'V', 'S', 'H', 'M', 'R', 'N', 'G'};
+static const size_t SHM_ALIGNMENT = 4096;
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// the slot table follows the header
+static ShmSlot* slotTable(ShmRingHeader* header)
+{
+  return reinterpret_cast<ShmSlot*>(reinterpret_cast<uint8_t*>(header) + alignUp(sizeof(ShmRingHeader), 64));
+}
+
+ShmSink::ShmSink(const string& name, uint32_t slots)
+  : name_("/" + name), slots_(max(slots, 2u))
+{
+#ifdef _WIN32
+  supported_ = false;
+  cerr << "The shared memory transport needs POSIX shared memory" << endl;
+#else
+  supported_ = true;
+#endif
+}
+
+ShmSink::~ShmSink()
+{
+#ifndef _WIN32
+  if ( !header_ )
+    return;
+
+  // consumers drain what is left and then see the end of the stream
+  header_->closed.store(1, memory_order_release);
+  munmap(base_, size_);
+  close(fd_);
+  shm_unlink(name_.c_str());
+#endif
+}
+
+bool ShmSink::create(const Mat& frame)
+{
+#ifdef _WIN32
+  (void)frame;
+  return false;
+#else
+  const size_t step = frame.cols * frame.elemSize();
+  const size_t slot_bytes = alignUp(step * frame.rows, SHM_ALIGNMENT);
+  const size_t data_offset = alignUp(alignUp(sizeof(ShmRingHeader), 64) + slots_ * sizeof(ShmSlot), SHM_ALIGNMENT);
+  size_ = data_offset + slots_ * slot_bytes;
+
+  // a segment left over by a publisher that died is replaced
+  shm_unlink(name_.c_str());
+  fd_ = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd_ < 0 || ftruncate(fd_, size_) != 0) {
+    cerr << "Could not create shared memory segment: " << name_ << endl;
+    supported_ = false;
+    return false;
+  }
+
+  void* mapped = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (mapped == MAP_FAILED) {
+    cerr << "Could not map shared memory segment: " << name_ << endl;
+    close(fd_);
+    shm_unlink(name_.c_str());
+    supported_ = false;
+    return false;
+  }
+
+  base_ = static_cast<uint8_t*>(mapped);
+  header_ = new (base_) ShmRingHeader();
+  header_->version = SHM_RING_VERSION;
+  header_->slots = slots_;
+  header_->rows = frame.rows;
+  header_->cols = frame.cols;
+  header_->type = frame.type();
+  header_->step = (uint32_t)step;
+  header_->slot_bytes = slot_bytes;
+  header_->data_offset = data_offset;
+  header_->published.store(0, memory_order_relaxed);
+  header_->closed.store(0, memory_order_relaxed);
+  header_->publisher_pid = (int32_t)getpid();
+  header_->heartbeat_ns.store(trace::now(), memory_order_relaxed);
+
+  ShmSlot* table = slotTable(header_);
+  for (uint32_t i = 0; i < slots_; i++) {
+    new (&table[i]) ShmSlot();
+    table[i].sequence.store(0, memory_order_relaxed);
+    table[i].timestamp_ns = 0;
+  }
+
+  // the magic goes in last, consumers wait for it before they trust the header
+  atomic_thread_fence(memory_order_release);
+  memcpy(header_->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+  return true;
+#endif
+}
+
+bool ShmSink::write(const Mat& frame, int64_t capture_ns)
+{
+  if ( !supported_ || frame.empty() )
+    return false;
+  if ( !header_ && !create(frame) )
+    return false;
+
+  if (frame.rows != header_->rows || frame.cols != header_->cols || frame.type() != header_->type) {
+    cerr << "Frame does not match the shared memory ring: " << frame.cols << "x" << frame.rows << endl;
+    return false;
+  }
+
+  TRACE_SPAN("shm.publish");
+  const uint64_t index = header_->published.load(memory_order_relaxed);
+  const uint32_t slot = index % header_->slots;
+  ShmSlot& entry = slotTable(header_)[slot];
+
+  entry.sequence.store(2 * index + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  Mat target(header_->rows, header_->cols, header_->type, base_ + header_->data_offset + slot * header_->slot_bytes, header_->step);
+  frame.copyTo(target);
+  entry.timestamp_ns = capture_ns;
+
+  entry.sequence.store(2 * index + 2, memory_order_release);
+  header_->published.store(index + 1, memory_order_release);
+  header_->heartbeat_ns.store(trace::now(), memory_order_relaxed);
+  return true;
+}
+
+ShmSource::ShmSource(const string& name, bool zero_copy, int open_timeout_ms, int publisher_timeout_ms)
+  : name_("/" + name), zero_copy_(zero_copy), publisher_timeout_ns_(publisher_timeout_ms * (int64_t)1000000)
+{
+#ifdef _WIN32
+  (void)open_timeout_ms;
+  cerr << "The shared memory transport needs POSIX shared memory" << endl;
+#else
+  const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(open_timeout_ms);
+
+  // the publisher may still be starting, wait for a complete header
+  while (true) {
+    int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+    if (fd >= 0) {
+      struct stat info;
+      if (fstat(fd, &info) == 0 && (size_t)info.st_size > sizeof(ShmRingHeader)) {
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED) {
+          ShmRingHeader* header = static_cast<ShmRingHeader*>(mapped);
+          bool ready = memcmp(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) == 0;
+          atomic_thread_fence(memory_order_acquire);
+
+          if (ready && header->version == SHM_RING_VERSION) {
+            base_ = static_cast<uint8_t*>(mapped);
+            header_ = header;
+            size_ = info.st_size;
+          } else {
+            munmap(mapped, info.st_size);
+          }
+        }
+      }
+      // the mapping stays valid without the descriptor
+      close(fd);
+    }
+
+    if (header_ || chrono::steady_clock::now() > deadline)
+      break;
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+
+  if ( !header_ ) {
+    cerr << "Could not open shared memory segment: " << name_ << endl;
+    return;
+  }
+
+  // join at the newest frame
+  uint64_t published = header_->published.load(memory_order_acquire);
+  next_ = published > 0 ? published - 1 : 0;
+#endif
+}
+
+ShmSource::~ShmSource()
+{
+#ifndef _WIN32
+  if (base_)
+    munmap(base_, size_);
+#endif
+}
+
+bool ShmSource::take(Mat& frame, int64_t* capture_ns)
+{
+  if ( !header_ )
+    return false;
+
+  const uint32_t slots = header_->slots;
+  ShmSlot* table = slotTable(header_);
+
+  while (true) {
+    const uint64_t published = header_->published.load(memory_order_acquire);
+    if (next_ >= published)
+      return false;
+
+    // too far behind, the frames in between are gone or about to be
+    if (published - next_ > slots - 1) {
+      stats_.skipped += published - 1 - next_;
+      next_ = published - 1;
+    }
+
+    const uint32_t slot = next_ % slots;
+    const uint64_t sequence = table[slot].sequence.load(memory_order_acquire);
+    if (sequence != 2 * next_ + 2)
+      continue;
+
+    Mat view(header_->rows, header_->cols, header_->type, base_ + header_->data_offset + slot * header_->slot_bytes, header_->step);
+    const int64_t timestamp = table[slot].timestamp_ns;
+
+    if (zero_copy_) {
+      frame = view;
+    } else {
+      // never copy into a slot header handed out earlier
+      if ( !frame.u )
+        frame.release();
+      view.copyTo(frame);
+
+      atomic_thread_fence(memory_order_acquire);
+      if (table[slot].sequence.load(memory_order_relaxed) != sequence)
+        continue;
+    }
+
+    if (capture_ns)
+      *capture_ns = timestamp;
+
+    last_slot_ = slot;
+    last_sequence_ = sequence;
+    next_++;
+    stats_.frames++;
+    return true;
+  }
+}
+
+bool ShmSource::read(Mat& frame, int64_t* capture_ns)
+{
+  while (header_) {
+    if (take(frame, capture_ns))
+      return true;
+    if (exhausted())
+      return false;
+    this_thread::sleep_for(chrono::microseconds(200));
+  }
+  return false;
+}
+
+bool ShmSource::tryRead(Mat& frame, int64_t* capture_ns)
+{
+  return take(frame, capture_ns);
+}
+
+bool ShmSource::exhausted() const
+{
+  if ( !header_ )
+    return true;
+
+  bool closed = header_->closed.load(memory_order_acquire) != 0 || publisherGone();
+  return closed && next_ >= header_->published.load(memory_order_acquire);
+}
+
+/**
+ * @brief publisherGone a publisher killed before its sink closed the ring never sets
+ *        closed, its process is gone or it stopped writing
+ */
+bool ShmSource::publisherGone() const
+{
+  if (publisher_gone_)
+    return true;
+
+  const int64_t now = trace::now();
+  if (now - alive_checked_ns_ < 100000000)
+    return false;
+  alive_checked_ns_ = now;
+
+#ifndef _WIN32
+  // EPERM means the process exists under another user
+  if (kill(header_->publisher_pid, 0) != 0 && errno == ESRCH)
+    publisher_gone_ = true;
+#endif
+  if (publisher_timeout_ns_ > 0 && now - header_->heartbeat_ns.load(memory_order_relaxed) > publisher_timeout_ns_)
+    publisher_gone_ = true;
+
+  return publisher_gone_;
+}
+
+bool ShmSource::valid() const
+{
+  if ( !header_ || stats_.frames == 0 )
+    return false;
+
+  atomic_thread_fence(memory_order_acquire);
+  return slotTable(header_)[last_slot_].sequence.load(memory_order_relaxed) == last_sequence_;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file shm_ring.hpp
+ * @brief Shared memory frame ring between processes.
+ *        One publisher copies each frame into the next slot of a ring in a POSIX
+ *        shared memory segment, any number of consumers map the same segment and
+ *        wrap Mat headers around the slots, so a frame is copied once no matter how
+ *        many processes read it. Every slot carries a sequence number that is odd
+ *        while the slot is written, readers check it to spot a slot that was reused
+ *        under them. The publisher leaves its pid and a heartbeat in the header, so
+ *        readers also see the end of a publisher that died without closing the ring.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "frame_source.hpp"
+
+const uint32_t SHM_RING_VERSION = 2;
+
+struct ShmSlot {
+  std::atomic<uint64_t> sequence;   // 2 * (frame + 1) once written, odd while being written
+  int64_t timestamp_ns;
+  uint64_t reserved[6];             // keeps every slot on its own cache line
+};
+
+struct ShmRingHeader {
+  char magic[8];                    // "CVSHMRNG"
+  uint32_t version;
+  uint32_t slots;
+  int32_t rows;
+  int32_t cols;
+  int32_t type;
+  uint32_t step;
+  uint64_t slot_bytes;              // frame bytes rounded up to the page size
+  uint64_t data_offset;             // offset of the first slot from the segment start
+  std::atomic<uint64_t> published;  // frames published so far
+  std::atomic<uint32_t> closed;     // set once the publisher is gone
+  int32_t publisher_pid;            // process writing the ring
+  std::atomic<int64_t> heartbeat_ns;  // trace::now() of the publisher's last write
+};
+
+struct ShmReaderStats {
+  uint64_t frames = 0;              // frames handed out
+  uint64_t skipped = 0;             // frames overwritten before the reader got to them
+};
+
+/**
+ * @brief Publisher side, the segment is created with the size of the first frame
+ *        and removed again when the sink is destroyed
+ */
+class ShmSink : public FrameSink
+{
+public:
+  /**
+   * @brief Construct a new Shm Sink
+   *
+   * @param name segment name, without the leading slash
+   * @param slots ring length, a zero-copy frame stays valid for slots - 1 publishes
+   */
+  ShmSink(const std::string& name, uint32_t slots = 8);
+  ~ShmSink();
+
+  ShmSink(const ShmSink&) = delete;
+  ShmSink& operator=(const ShmSink&) = delete;
+
+  bool isOpened() const override { return supported_; }
+  bool write(const cv::Mat& frame, int64_t capture_ns) override;
+
+  uint64_t published() const { return header_ ? header_->published.load() : 0; }
+
+private:
+  bool create(const cv::Mat& frame);
+
+  std::string name_;
+  uint32_t slots_;
+  bool supported_;
+
+  ShmRingHeader* header_ = nullptr;
+  uint8_t* base_ = nullptr;
+  size_t size_ = 0;
+  int fd_ = -1;
+};
+
+/**
+ * @brief Consumer side, reads the frames in order and skips ahead when it falls more
+ *        than a ring behind the publisher
+ */
+class ShmSource : public FrameSource
+{
+public:
+  /**
+   * @brief Construct a new Shm Source
+   *
+   * @param name segment name, without the leading slash
+   * @param zero_copy hand out Mat headers around the slots, otherwise frames are copied out
+   * @param open_timeout_ms wait this long for the publisher to create the segment
+   * @param publisher_timeout_ms a publisher without a write for this long counts as
+   *        gone, 0 only ends the stream when its process exits or closes the ring
+   */
+  ShmSource(const std::string& name, bool zero_copy = true, int open_timeout_ms = 5000, int publisher_timeout_ms = 5000);
+  ~ShmSource();
+
+  ShmSource(const ShmSource&) = delete;
+  ShmSource& operator=(const ShmSource&) = delete;
+
+  bool isOpened() const override { return header_ != nullptr; }
+  bool read(cv::Mat& frame, int64_t* capture_ns = nullptr) override;
+  bool tryRead(cv::Mat& frame, int64_t* capture_ns = nullptr) override;
+  bool exhausted() const override;
+
+  // frames are published by another process, nothing here could call back
+  bool setReadyCallback(std::function<void()> callback) override { return false; }
+
+  /**
+   * @brief valid check that a zero-copy frame was not overwritten while it was used
+   *
+   * @return true if the last frame handed out is still intact
+   */
+  bool valid() const;
+
+  ShmReaderStats stats() const { return stats_; }
+
+private:
+  bool take(cv::Mat& frame, int64_t* capture_ns);
+  bool publisherGone() const;
+
+  std::string name_;
+  bool zero_copy_;
+
+  ShmRingHeader* header_ = nullptr;
+  uint8_t* base_ = nullptr;
+  size_t size_ = 0;
+
+  uint64_t next_ = 0;               // next frame to read
+  uint64_t last_sequence_ = 0;      // slot sequence of the last frame handed out
+  uint32_t last_slot_ = 0;
+  ShmReaderStats stats_;
+
+  int64_t publisher_timeout_ns_;
+  mutable int64_t alive_checked_ns_ = 0;  // the pid is looked up at most every 100 ms
+  mutable bool publisher_gone_ = false;
+};
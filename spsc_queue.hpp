@@ -0,0 +1,83 @@
+/**
+ * @file spsc_queue.hpp
+ * @brief Bounded lock-free queue between exactly one producer and one consumer thread.
+ *        Head and tail live on separate cache lines and each side only writes its
+ *        own index, so a push or pop is one acquire load and one release store.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <class T>
+class SpscQueue
+{
+public:
+  explicit SpscQueue(size_t capacity) : slots_(capacity + 1) {}
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // producer only, false when the queue is full
+  bool push(T&& item)
+  {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t next = (tail + 1) % slots_.size();
+    if (next == head_.load(std::memory_order_acquire))
+      return false;
+
+    slots_[tail] = std::move(item);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, false when the queue is empty
+  bool pop(T& item)
+  {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+      return false;
+
+    item = std::move(slots_[head]);
+    head_.store((head + 1) % slots_.size(), std::memory_order_release);
+    return true;
+  }
+
+  // exact on either side, a snapshot anywhere else
+  size_t size() const
+  {
+    const size_t head = head_.load(std::memory_order_acquire);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    return (tail + slots_.size() - head) % slots_.size();
+  }
+
+  size_t capacity() const { return slots_.size() - 1; }
+
+private:
+  std::vector<T> slots_;          // one slot stays empty to tell full from empty
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+/**
+ * @brief spscWait back off while a queue has nothing to offer: spin briefly, then yield,
+ *        then sleep, so an idle stage gives its core away without adding much latency
+ *
+ * @param attempt number of failed attempts so far, reset it after a success
+ */
+inline void spscWait(int& attempt)
+{
+  attempt++;
+  if (attempt < 64)
+    return;
+  if (attempt < 128)
+    std::this_thread::yield();
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
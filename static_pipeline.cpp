@@ -0,0 +1,21 @@
+/**
+ * @file static_pipeline.cpp
+ * @brief Processing pipelines assembled at compile time.
+ *
+ */
+
+#include "static_pipeline.hpp"
+
+using namespace cv;
+using namespace std;
+
+RuntimePipeline makeEdgePipeline(const PreprocessParams& params)
+{
+  RuntimePipeline pipeline;
+  pipeline.add(GrayStage<>())
+          .add(GaussianStage<>(params.blur_size, params.blur_sigma))
+          .add(CannyStage<>(cvRound(params.canny_low), cvRound(params.canny_high)))
+          .add(DilateStage<>(params.dilate_size));
+
+  return pipeline;
+}
@@ -0,0 +1,328 @@
+/**
+ * @file static_pipeline.hpp
+ * @brief Processing pipelines assembled at compile time.
+ *        Stage types and their constant parameters (channel count, kernel sizes,
+ *        thresholds) are template arguments, so the compiler sees fixed loop bounds,
+ *        unrolls the small kernels and calls the stages directly. A stage built with
+ *        RUNTIME arguments takes them from its constructor instead and runs the same
+ *        code with variable bounds; RuntimePipeline chains such stages behind virtual
+ *        calls, which is the generic build the specialized one is measured against.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "preprocess.hpp"
+#include "trace.hpp"
+
+// template argument taken from the constructor at runtime
+const int RUNTIME = -1;
+
+/**
+ * @brief StageParam a stage parameter that is a constant when Fixed is given
+ */
+template <int Fixed>
+struct StageParam {
+  int value = Fixed;
+  constexpr int get() const { return Fixed == RUNTIME ? value : Fixed; }
+};
+
+/**
+ * @brief GrayStage BGR(A) to gray with the fixed-point weights of cvtColor,
+ *        bit exact with COLOR_BGR2GRAY
+ */
+template <int Channels = RUNTIME>
+class GrayStage
+{
+public:
+  static_assert(Channels == RUNTIME || Channels == 1 || Channels == 3 || Channels == 4, "gray input has 1, 3 or 4 channels");
+
+  void apply(const cv::Mat& input, cv::Mat& output)
+  {
+    // an input that does not match the specialization still gets the right answer
+    if (Channels != RUNTIME && input.channels() != Channels) {
+      GrayStage<RUNTIME>().apply(input, output);
+      return;
+    }
+
+    if (input.channels() == 1) {
+      input.copyTo(output);
+      return;
+    }
+
+    output.create(input.size(), CV_8UC1);
+    for (int y = 0; y < input.rows; y++)
+      grayRow(input.ptr<uchar>(y), output.ptr<uchar>(y), input.cols, input.channels());
+  }
+
+private:
+  static void grayRow(const uchar* src, uchar* dst, int width, int channels)
+  {
+    const int step = Channels == RUNTIME ? channels : Channels;
+    for (int x = 0; x < width; x++, src += step)
+      dst[x] = (uchar)((src[0] * 1868 + src[1] * 9617 + src[2] * 4899 + (1 << 13)) >> 14);
+  }
+};
+
+/**
+ * @brief GaussianStage Gaussian blur, sigma in tenths so it can be a template argument
+ */
+template <int Size = RUNTIME, int SigmaTenths = RUNTIME>
+class GaussianStage
+{
+public:
+  static_assert(Size == RUNTIME || (Size > 0 && Size % 2 == 1), "blur size is odd");
+
+  GaussianStage() = default;
+  GaussianStage(int size, double sigma) { size_.value = size; sigma_tenths_.value = cvRound(sigma * 10); }
+
+  void apply(const cv::Mat& input, cv::Mat& output)
+  {
+    const int size = size_.get();
+    cv::GaussianBlur(input, output, cv::Size(size, size), sigma_tenths_.get() / 10.0);
+  }
+
+private:
+  StageParam<Size> size_;
+  StageParam<SigmaTenths> sigma_tenths_;
+};
+
+template <int Low = RUNTIME, int High = RUNTIME>
+class CannyStage
+{
+public:
+  CannyStage() = default;
+  CannyStage(int low, int high) { low_.value = low; high_.value = high; }
+
+  void apply(const cv::Mat& input, cv::Mat& output)
+  {
+    cv::Canny(input, output, low_.get(), high_.get());
+  }
+
+private:
+  StageParam<Low> low_;
+  StageParam<High> high_;
+};
+
+/**
+ * @brief DilateStage dilation with a Size x Size MORPH_RECT kernel as two separable
+ *        max passes, pixels outside the image are ignored like dilate does
+ */
+template <int Size = RUNTIME>
+class DilateStage
+{
+public:
+  static_assert(Size == RUNTIME || (Size > 0 && Size % 2 == 1), "kernel size is odd");
+
+  DilateStage() = default;
+  explicit DilateStage(int size) { size_.value = size; }
+
+  void apply(const cv::Mat& input, cv::Mat& output)
+  {
+    CV_Assert(input.type() == CV_8UC1);
+    const int size = size_.get();
+    const int radius = size / 2;
+    const int width = input.cols;
+
+    rows_.create(input.size(), CV_8UC1);
+    output.create(input.size(), CV_8UC1);
+
+    // horizontal max
+    for (int y = 0; y < input.rows; y++) {
+      const uchar* src = input.ptr<uchar>(y);
+      uchar* dst = rows_.ptr<uchar>(y);
+      const int inner_end = std::max(radius, width - radius);
+
+      for (int x = 0; x < std::min(radius, width); x++)
+        dst[x] = clippedMax(src, x - radius, x + radius, width);
+      for (int x = radius; x < inner_end; x++) {
+        uchar value = src[x - radius];
+        for (int k = 1; k < size; k++)
+          value = std::max(value, src[x - radius + k]);
+        dst[x] = value;
+      }
+      for (int x = inner_end; x < width; x++)
+        dst[x] = clippedMax(src, x - radius, x + radius, width);
+    }
+
+    // vertical max
+    for (int y = 0; y < input.rows; y++) {
+      uchar* dst = output.ptr<uchar>(y);
+      const int first = std::max(0, y - radius);
+      const int last = std::min(input.rows - 1, y + radius);
+
+      const uchar* src = rows_.ptr<uchar>(first);
+      std::copy(src, src + width, dst);
+      for (int row = first + 1; row <= last; row++) {
+        src = rows_.ptr<uchar>(row);
+        for (int x = 0; x < width; x++)
+          dst[x] = std::max(dst[x], src[x]);
+      }
+    }
+  }
+
+private:
+  static uchar clippedMax(const uchar* src, int from, int to, int width)
+  {
+    uchar value = 0;
+    for (int x = std::max(from, 0); x <= std::min(to, width - 1); x++)
+      value = std::max(value, src[x]);
+    return value;
+  }
+
+  StageParam<Size> size_;
+  cv::Mat rows_;
+};
+
+/**
+ * @brief ContourStage external contours of an edge image, simplified to polygons,
+ *        contours under MinArea pixels are skipped. Ends a pipeline, it does not
+ *        produce an image.
+ */
+template <int MinArea = RUNTIME, int EpsilonPermille = RUNTIME>
+class ContourStage
+{
+public:
+  ContourStage() = default;
+  ContourStage(int min_area, double epsilon) { min_area_.value = min_area; epsilon_permille_.value = cvRound(epsilon * 1000); }
+
+  void apply(const cv::Mat& edges, std::vector<std::vector<cv::Point>>& polygons)
+  {
+    const double min_area = min_area_.get();
+    const double epsilon = epsilon_permille_.get() / 1000.0;
+
+    cv::findContours(edges, contours_, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+    polygons.clear();
+    for (const std::vector<cv::Point>& contour : contours_) {
+      // the bounding box bounds the area from above and is much cheaper
+      if (cv::boundingRect(contour).area() < min_area || cv::contourArea(contour) < min_area)
+        continue;
+
+      polygons.emplace_back();
+      cv::approxPolyDP(contour, polygons.back(), epsilon * cv::arcLength(contour, true), true);
+    }
+  }
+
+private:
+  StageParam<MinArea> min_area_;
+  StageParam<EpsilonPermille> epsilon_permille_;
+  std::vector<std::vector<cv::Point>> contours_;
+};
+
+/**
+ * @brief StaticPipeline runs its stages in order, each stage writes into its own
+ *        buffer that is kept between calls
+ */
+template <class... Stages>
+class StaticPipeline
+{
+public:
+  static_assert(sizeof...(Stages) > 0, "a pipeline has at least one stage");
+
+  StaticPipeline() = default;
+  explicit StaticPipeline(Stages... stages) : stages_(std::move(stages)...) {}
+
+  /**
+   * @brief run the stages
+   *
+   * @param input input image
+   * @return const cv::Mat& output of the last stage, overwritten by the next call
+   */
+  const cv::Mat& run(const cv::Mat& input)
+  {
+    TRACE_SPAN("pipeline.static");
+    runFrom<0>(input);
+    return buffers_.back();
+  }
+
+  template <size_t I>
+  auto& stage() { return std::get<I>(stages_); }
+
+private:
+  template <size_t I>
+  void runFrom(const cv::Mat& input)
+  {
+    std::get<I>(stages_).apply(input, buffers_[I]);
+    if constexpr (I + 1 < sizeof...(Stages))
+      runFrom<I + 1>(buffers_[I]);
+  }
+
+  std::tuple<Stages...> stages_;
+  std::array<cv::Mat, sizeof...(Stages)> buffers_;
+};
+
+class PipelineStage
+{
+public:
+  virtual ~PipelineStage() = default;
+  virtual void apply(const cv::Mat& input, cv::Mat& output) = 0;
+};
+
+template <class Stage>
+class DynamicStage : public PipelineStage
+{
+public:
+  explicit DynamicStage(Stage stage) : stage_(std::move(stage)) {}
+  void apply(const cv::Mat& input, cv::Mat& output) override { stage_.apply(input, output); }
+
+private:
+  Stage stage_;
+};
+
+/**
+ * @brief RuntimePipeline stages chosen and configured at runtime
+ */
+class RuntimePipeline
+{
+public:
+  template <class Stage>
+  RuntimePipeline& add(Stage stage)
+  {
+    stages_.push_back(std::make_unique<DynamicStage<Stage>>(std::move(stage)));
+    buffers_.emplace_back();
+    return *this;
+  }
+
+  const cv::Mat& run(const cv::Mat& input)
+  {
+    TRACE_SPAN("pipeline.runtime");
+    const cv::Mat* current = &input;
+    for (size_t i = 0; i < stages_.size(); i++) {
+      stages_[i]->apply(*current, buffers_[i]);
+      current = &buffers_[i];
+    }
+    return *current;
+  }
+
+  size_t size() const { return stages_.size(); }
+
+private:
+  std::vector<std::unique_ptr<PipelineStage>> stages_;
+  std::vector<cv::Mat> buffers_;
+};
+
+// gray -> blur -> canny -> dilate with the PreprocessParams defaults
+typedef StaticPipeline<GrayStage<3>, GaussianStage<3, 30>, CannyStage<25, 75>, DilateStage<3>> EdgePipeline;
+
+// the same chain with the 7x7 blur of docPreprocessParams
+typedef StaticPipeline<GrayStage<3>, GaussianStage<7, 30>, CannyStage<25, 75>, DilateStage<3>> DocEdgePipeline;
+
+// the polygon filter of ShapeParams, 1000 px and 2% of the perimeter
+typedef ContourStage<1000, 20> ShapeContourStage;
+
+/**
+ * @brief makeEdgePipeline the edge chain configured at runtime
+ *
+ * @param params preprocessing parameters
+ * @return RuntimePipeline gray -> blur -> canny -> dilate
+ */
+RuntimePipeline makeEdgePipeline(const PreprocessParams& params = PreprocessParams());
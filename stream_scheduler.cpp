@@ -0,0 +1,289 @@
+/**
+ * @file stream_scheduler.cpp
+ * @brief Face detection over many streams sharing one work-stealing pool.
+ *
+ */
+
+#include "stream_scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "shm_ring.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+// latencies kept per stream for the percentiles
+const size_t LATENCY_WINDOW = 1024;
+
+// sources that cannot call back, the shared memory rings, are polled this often
+const int64_t POLL_NS = 1000000;
+
+StreamScheduler::StreamScheduler(const string& cascade_path, const SchedulerParams& params)
+  : cascade_path_(cascade_path),
+    params_(params),
+    pool_(max(params.workers, 0), params.pin_cores)
+{
+  max_queued_ = params_.max_queued > 0 ? params_.max_queued : 2 * pool_.size();
+
+  // streams run side by side, a single stream never spreads over several workers:
+  // with one band the detector runs inline on the worker that took the frame
+  params_.detector.num_threads = 1;
+}
+
+StreamScheduler::~StreamScheduler()
+{
+  stop();
+
+  // the pool must not outlive the streams its tasks point to
+  {
+    unique_lock<mutex> lock(mutex_);
+    frame_done_.wait(lock, [this]() { return in_flight_ == 0; });
+  }
+
+  // capture threads call back into the scheduler until their source is closed
+  streams_.clear();
+}
+
+bool StreamScheduler::addStream(const StreamSpec& spec)
+{
+  auto stream = make_unique<Stream>();
+  stream->spec = spec;
+  if (stream->spec.name.empty())
+    stream->spec.name = spec.source;
+  stream->spec.weight = spec.weight > 0 ? spec.weight : 1.0;
+
+  // cameras drop to the newest frame when the stream falls behind, files are lossless
+  stream->source = openSource(spec.source);
+  if ( !stream->source->isOpened() ) {
+    cout << "Could not open stream: " << spec.source << endl;
+    return false;
+  }
+
+  // the dispatcher sleeps until a source calls back with a frame
+  stream->polled = !stream->source->setReadyCallback([this]() {
+    lock_guard<mutex> lock(mutex_);
+    frame_done_.notify_all();
+  });
+
+  stream->detector = make_unique<FaceDetector>(cascade_path_, params_.detector);
+  if (stream->detector->empty())
+    return false;
+
+  // consecutive streams start on different workers
+  stream->home_worker = streams_.size() % pool_.size();
+  stream->latencies.reserve(LATENCY_WINDOW);
+
+  streams_.push_back(move(stream));
+  return true;
+}
+
+void StreamScheduler::stop()
+{
+  lock_guard<mutex> lock(mutex_);
+  stopping_ = true;
+  frame_done_.notify_all();
+}
+
+/**
+ * @brief pull takes the next frame of a stream without waiting for it
+ *
+ * @return true if the stream has a frame to process
+ */
+bool StreamScheduler::pull(Stream& stream)
+{
+  if (stream.source->tryRead(stream.frame, &stream.captured_at))
+    return true;
+
+  stream.done = stream.source->exhausted();
+  return false;
+}
+
+void StreamScheduler::run(double seconds, double report_seconds)
+{
+  const int64_t start = trace::now();
+  int64_t next_report = start + (int64_t)(report_seconds * 1e9);
+  vector<size_t> order(streams_.size());
+
+  // the pool workers are the parallelism, OpenCV's own threads would take the
+  // detection off the pinned cores and compete with the other streams
+  const int previous_threads = getNumThreads();
+  setNumThreads(1);
+
+  unique_lock<mutex> lock(mutex_);
+  stopping_ = false;
+
+  while ( !stopping_ ) {
+    const int64_t now = trace::now();
+    if (seconds > 0 && now - start > seconds * 1e9)
+      break;
+
+    if (report_seconds > 0 && now >= next_report) {
+      lock.unlock();
+      printStreamStats(stats());
+      lock.lock();
+      next_report = now + (int64_t)(report_seconds * 1e9);
+    }
+
+    // least served stream first
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return streams_[a]->virtual_time < streams_[b]->virtual_time;
+    });
+
+    bool active = false;
+    bool dispatched = false;
+    for (size_t index : order) {
+      Stream& stream = *streams_[index];
+      active = active || !stream.done || stream.in_flight;
+
+      if (stream.done || stream.in_flight)
+        continue;
+      if (in_flight_ >= max_queued_)
+        break;
+      if (stream.spec.max_fps > 0 && now < stream.next_due_ns)
+        continue;
+      if ( !pull(stream) )
+        continue;
+
+      stream.in_flight = true;
+      in_flight_++;
+      dispatched = true;
+      pool_.submit([this, index]() { process(index); }, stream.home_worker);
+    }
+
+    if ( !active )
+      break;
+
+    if (dispatched)
+      continue;
+
+    // nothing ready: sleep until a result comes back or a source calls back with a
+    // frame, waking up only for the time limit, the report, a capped stream coming
+    // due and the sources that have to be polled
+    int64_t wake = seconds > 0 ? start + (int64_t)(seconds * 1e9) : INT64_MAX;
+    if (report_seconds > 0)
+      wake = min(wake, next_report);
+    for (const unique_ptr<Stream>& stream : streams_) {
+      if (stream->done || stream->in_flight)
+        continue;
+      if (stream->spec.max_fps > 0 && now < stream->next_due_ns)
+        wake = min(wake, stream->next_due_ns);
+      else if (stream->polled)
+        wake = min(wake, now + POLL_NS);
+    }
+
+    if (wake == INT64_MAX)
+      frame_done_.wait(lock);
+    else
+      frame_done_.wait_for(lock, chrono::nanoseconds(max<int64_t>(wake - trace::now(), 0)));
+  }
+
+  frame_done_.wait(lock, [this]() { return in_flight_ == 0; });
+  lock.unlock();
+
+  setNumThreads(previous_threads);
+
+  printStreamStats(stats());
+  cout << "Tasks stolen between workers: " << pool_.stolen() << endl;
+}
+
+void StreamScheduler::process(size_t index)
+{
+  TRACE_SPAN("streams.detect");
+  Stream& stream = *streams_[index];
+
+  const int64_t start = trace::now();
+  vector<Rect> faces;
+  stream.detector->detect(stream.frame, faces);
+
+  if (callback_)
+    callback_(index, stream.frame, faces);
+
+  const int64_t end = trace::now();
+
+  lock_guard<mutex> lock(mutex_);
+  double cpu_ms = (end - start) / 1e6;
+  double latency_ms = (end - stream.captured_at) / 1e6;
+
+  if (stream.frames == 0)
+    stream.first_ns = start;
+  stream.last_ns = end;
+  stream.frames++;
+  stream.faces += faces.size();
+  stream.cpu_ms += cpu_ms;
+  stream.virtual_time += cpu_ms / stream.spec.weight;
+  if (stream.spec.max_fps > 0)
+    stream.next_due_ns = start + (int64_t)(1e9 / stream.spec.max_fps);
+
+  if (stream.latencies.size() < LATENCY_WINDOW)
+    stream.latencies.push_back(latency_ms);
+  else
+    stream.latencies[stream.latency_next] = latency_ms;
+  stream.latency_next = (stream.latency_next + 1) % LATENCY_WINDOW;
+
+  stream.in_flight = false;
+  in_flight_--;
+  frame_done_.notify_all();
+}
+
+vector<StreamStats> StreamScheduler::stats() const
+{
+  lock_guard<mutex> lock(mutex_);
+  vector<StreamStats> all;
+
+  for (const unique_ptr<Stream>& stream : streams_) {
+    StreamStats current;
+    current.name = stream->spec.name;
+    current.frames = stream->frames;
+    current.faces = stream->faces;
+    current.cpu_ms = stream->cpu_ms;
+    if (const FrameCapture* capture = dynamic_cast<const FrameCapture*>(stream->source.get()))
+      current.dropped = capture->stats().dropped;
+    else if (const ShmSource* shared = dynamic_cast<const ShmSource*>(stream->source.get()))
+      current.dropped = shared->stats().skipped;
+
+    double elapsed = (stream->last_ns - stream->first_ns) / 1e9;
+    if (stream->frames > 1 && elapsed > 0)
+      current.fps = (stream->frames - 1) / elapsed;
+
+    if ( !stream->latencies.empty() ) {
+      vector<double> sorted = stream->latencies;
+      sort(sorted.begin(), sorted.end());
+      double sum = 0;
+      for (double latency : sorted)
+        sum += latency;
+      current.latency_mean_ms = sum / sorted.size();
+      current.latency_p50_ms = sorted[sorted.size() / 2];
+      current.latency_p99_ms = sorted[min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    }
+
+    all.push_back(current);
+  }
+
+  return all;
+}
+
+void printStreamStats(const vector<StreamStats>& stats)
+{
+  cout << left << setw(24) << "stream" << right
+       << setw(8) << "frames" << setw(8) << "dropped" << setw(8) << "faces" << setw(8) << "fps"
+       << setw(10) << "cpu ms" << setw(10) << "mean ms" << setw(10) << "p50 ms" << setw(10) << "p99 ms" << endl;
+
+  double total_fps = 0;
+  for (const StreamStats& s : stats) {
+    cout << left << setw(24) << s.name << right
+         << setw(8) << s.frames << setw(8) << s.dropped << setw(8) << s.faces
+         << fixed << setprecision(1) << setw(8) << s.fps
+         << setw(10) << s.cpu_ms << setw(10) << s.latency_mean_ms
+         << setw(10) << s.latency_p50_ms << setw(10) << s.latency_p99_ms << endl;
+    total_fps += s.fps;
+  }
+
+  cout << "Total: " << fixed << setprecision(1) << total_fps << " fps over " << stats.size() << " streams" << endl;
+}
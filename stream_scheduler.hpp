@@ -0,0 +1,134 @@
+/**
+ * @file stream_scheduler.hpp
+ * @brief Face detection over many streams sharing one work-stealing pool.
+ *        Every stream keeps its own source and detector and has at most one frame in
+ *        flight. A dispatcher hands frames to the pool in weighted fair order: the
+ *        stream that has used the least CPU time for its weight goes first, and the
+ *        number of queued frames is bounded so a busy stream cannot flood the pool.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "face_detector.hpp"
+#include "frame_capture.hpp"
+#include "frame_source.hpp"
+#include "work_stealing_pool.hpp"
+
+struct StreamSpec {
+  std::string name;
+  std::string source;             // source spec, see openSource
+  double weight = 1.0;            // share of the CPU relative to the other streams
+  double max_fps = 0;             // frames per second cap, 0 processes every frame it gets
+};
+
+struct StreamStats {
+  std::string name;
+  uint64_t frames = 0;            // frames processed
+  uint64_t dropped = 0;           // frames the capture dropped because the stream fell behind
+  uint64_t faces = 0;
+  double fps = 0;
+  double cpu_ms = 0;              // detection time spent on the stream
+  double latency_mean_ms = 0;     // capture to result, over the recent frames
+  double latency_p50_ms = 0;
+  double latency_p99_ms = 0;
+};
+
+struct SchedulerParams {
+  int workers = 0;                // 0 uses the hardware concurrency
+  bool pin_cores = false;         // pin worker i to core i
+  int max_queued = 0;             // frames queued or running at once, 0 allows two per worker
+  FaceDetectorParams detector;
+};
+
+typedef std::function<void(size_t stream, const cv::Mat& frame, const std::vector<cv::Rect>& faces)> StreamResultCallback;
+
+class StreamScheduler
+{
+public:
+  StreamScheduler(const std::string& cascade_path, const SchedulerParams& params = SchedulerParams());
+  ~StreamScheduler();
+
+  StreamScheduler(const StreamScheduler&) = delete;
+  StreamScheduler& operator=(const StreamScheduler&) = delete;
+
+  /**
+   * @brief add a stream, only before run
+   *
+   * @param spec stream source and fairness settings
+   * @return false when the source could not be opened
+   */
+  bool addStream(const StreamSpec& spec);
+
+  // called on a pool worker for every processed frame, must be thread safe
+  void setResultCallback(StreamResultCallback callback) { callback_ = callback; }
+
+  /**
+   * @brief run until every source is exhausted, the time is up or stop is called
+   *
+   * @param seconds run time limit, 0 runs until the sources end
+   * @param report_seconds print the stream stats this often, 0 only at the end
+   */
+  void run(double seconds = 0, double report_seconds = 0);
+
+  void stop();
+
+  std::vector<StreamStats> stats() const;
+  size_t size() const { return streams_.size(); }
+  uint64_t stolen() const { return pool_.stolen(); }
+
+private:
+  struct Stream {
+    StreamSpec spec;
+    std::unique_ptr<FrameSource> source;
+    std::unique_ptr<FaceDetector> detector;
+    size_t home_worker = 0;
+    bool polled = false;          // the source cannot call back when a frame is ready
+
+    cv::Mat frame;                // owned by the pool while in flight
+    int64_t captured_at = 0;
+    bool in_flight = false;
+    bool done = false;
+    double virtual_time = 0;      // cpu time divided by the weight
+    int64_t next_due_ns = 0;
+
+    uint64_t frames = 0;
+    uint64_t faces = 0;
+    double cpu_ms = 0;
+    int64_t first_ns = 0;
+    int64_t last_ns = 0;
+    std::vector<double> latencies;  // ring of the recent latencies
+    size_t latency_next = 0;
+  };
+
+  bool pull(Stream& stream);
+  void process(size_t index);
+
+  std::string cascade_path_;
+  SchedulerParams params_;
+  WorkStealingPool pool_;
+  size_t max_queued_;
+
+  std::vector<std::unique_ptr<Stream>> streams_;
+  StreamResultCallback callback_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable frame_done_;   // a frame finished, a source has a frame ready or stop was called
+  size_t in_flight_ = 0;
+  bool stopping_ = false;
+};
+
+/**
+ * @brief printStreamStats print one line per stream
+ *
+ * @param stats stream statistics
+ */
+void printStreamStats(const std::vector<StreamStats>& stats);
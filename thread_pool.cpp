@@ -0,0 +1,52 @@
+/**
+ * @file thread_pool.cpp
+ * @brief Fixed size pool of worker threads shared by the detection engines
+ *
+ */
+
+#include "thread_pool.hpp"
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t num_threads)
+{
+  if (num_threads == 0)
+    num_threads = max(1u, thread::hardware_concurrency());
+
+  for (size_t i = 0; i < num_threads; i++)
+    workers_.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_ready_.notify_all();
+
+  for (thread& worker : workers_)
+    worker.join();
+}
+
+/**
+ * @brief workerLoop runs queued tasks until the pool is destroyed,
+ *        pending tasks are drained before the workers exit
+ */
+void ThreadPool::workerLoop()
+{
+  while (true) {
+    function<void()> task;
+    {
+      unique_lock<mutex> lock(mutex_);
+      task_ready_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+
+      if (tasks_.empty())
+        return;
+
+      task = move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
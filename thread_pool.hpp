@@ -0,0 +1,65 @@
+/**
+ * @file thread_pool.hpp
+ * @brief Fixed size pool of worker threads shared by the detection engines
+ *
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  /**
+   * @brief Construct a new Thread Pool
+   *
+   * @param num_threads number of workers, 0 uses the hardware concurrency
+   */
+  explicit ThreadPool(size_t num_threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * @brief submit a task to the pool
+   *
+   * @param task callable taking no arguments
+   * @return std::future holding the task result
+   */
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit(F&& task)
+  {
+    using Result = std::invoke_result_t<F>;
+
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+    std::future<Result> result = packaged->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace([packaged]() { (*packaged)(); });
+    }
+    task_ready_.notify_one();
+
+    return result;
+  }
+
+  size_t size() const { return workers_.size(); }
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable task_ready_;
+  bool stopping_ = false;
+};
@@ -0,0 +1,463 @@
+/**
+ * @file tiled_contours.cpp
+ * @brief Outer contour extraction for very large binary images.
+ *
+ */
+
+#include "tiled_contours.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+// a component crossing one or more seams, joined from its pieces in every tile
+struct SeamGroup {
+  Rect box;
+  Point first;                              // first pixel in raster order
+  int pieces = 0;
+  const vector<Point>* contour = nullptr;   // traced by its tile when there is one piece
+  vector<Point> traced;                     // followed across the seams otherwise
+  vector<vector<int>> crossings;            // per row of box: sorted x where the border crosses the row
+};
+
+// contour of the result with the pixel it starts at, findContours starts every
+// outer border at the first pixel of its component in raster order
+struct Traced {
+  Point first;
+  const vector<Point>* contour;
+};
+
+// chain code directions of findContours, counterclockwise from +x with y down
+static const Point CHAIN_DELTAS[8] = {
+  Point(1, 0), Point(1, -1), Point(0, -1), Point(-1, -1),
+  Point(-1, 0), Point(-1, 1), Point(0, 1), Point(1, 1)
+};
+
+static inline bool foreground(const Mat& binary, Point p)
+{
+  return (unsigned)p.x < (unsigned)binary.cols && (unsigned)p.y < (unsigned)binary.rows &&
+         binary.ptr<uchar>(p.y)[p.x] != 0;
+}
+
+static inline int64_t pointKey(Point p)
+{
+  return ((int64_t)p.y << 32) | (uint32_t)p.x;
+}
+
+/**
+ * @brief followOuterBorder the border following findContours runs from the first
+ *        pixel of a component, with CHAIN_APPROX_SIMPLE output. Every foreground
+ *        pixel next to the border belongs to the component, so the walk reads the
+ *        image in place and touches only the pixels along the border.
+ *
+ * @param binary CV_8UC1 image, outside is background
+ * @param start first pixel of the component in raster order
+ * @param contour receives the outer border
+ */
+static void followOuterBorder(const Mat& binary, Point start, vector<Point>& contour)
+{
+  contour.clear();
+
+  // clockwise from the left for the first neighbour, the pixels left of and
+  // above the first pixel are background
+  int s = 4;
+  do {
+    s = (s - 1) & 7;
+  } while (s != 4 && !foreground(binary, start + CHAIN_DELTAS[s]));
+
+  if (s == 4) {
+    contour.push_back(start);
+    return;
+  }
+
+  const Point second = start + CHAIN_DELTAS[s];
+  Point current = start;
+  int previous = s ^ 4;
+
+  while (true) {
+    // counterclockwise from the pixel the walk came from
+    Point next;
+    do {
+      s++;
+      next = current + CHAIN_DELTAS[s & 7];
+    } while ( !foreground(binary, next) );
+    s &= 7;
+
+    // only the corners of straight runs are kept
+    if (s != previous) {
+      contour.push_back(current);
+      previous = s;
+    }
+
+    if (next == start && current == second)
+      break;
+
+    current = next;
+    s = (s + 4) & 7;
+  }
+}
+
+/**
+ * @brief rowCrossings for every row of the box the x positions where the border
+ *        polygon crosses the line through the pixel centers. The vertices and every
+ *        point on the straight runs between them are pixels of the component, so a
+ *        pixel outside the component never lies on the polygon and the crossings
+ *        right of it tell whether it is inside.
+ */
+static void rowCrossings(const vector<Point>& contour, const Rect& box, vector<vector<int>>& crossings)
+{
+  crossings.assign(box.height, vector<int>());
+
+  const size_t count = contour.size();
+  for (size_t i = 0; i < count; i++) {
+    const Point& a = contour[i];
+    const Point& b = contour[(i + 1) % count];
+    if (a.y == b.y)
+      continue;
+
+    // half open in y, a vertex between two edges is counted once
+    const int y0 = min(a.y, b.y);
+    const int y1 = max(a.y, b.y);
+    for (int y = y0; y < y1; y++)
+      crossings[y - box.y].push_back(a.x + (b.x - a.x) * (y - a.y) / (b.y - a.y));
+  }
+
+  for (vector<int>& row : crossings)
+    sort(row.begin(), row.end());
+}
+
+static bool insideBorder(const SeamGroup& group, Point p)
+{
+  if ( !group.box.contains(p) )
+    return false;
+
+  const vector<int>& row = group.crossings[p.y - group.box.y];
+  size_t right = row.end() - upper_bound(row.begin(), row.end(), p.x);
+  return right % 2 == 1;
+}
+
+static int findRoot(vector<int>& parent, int i)
+{
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+static void unite(vector<int>& parent, int a, int b)
+{
+  a = findRoot(parent, a);
+  b = findRoot(parent, b);
+  if (a != b)
+    parent[max(a, b)] = min(a, b);
+}
+
+TiledContourFinder::TiledContourFinder(const TiledContourParams& params)
+  : params_(params)
+{
+}
+
+void TiledContourFinder::traceTile(const Mat& binary, Tile& tile)
+{
+  const Rect& rect = tile.rect;
+  Mat roi = binary(rect);
+
+  tile.contours.clear();
+  tile.cut.clear();
+  tile.pieces.clear();
+  tile.labels = 0;
+
+  // the sides shared with another tile, findContours sees a zero border there
+  const bool seam_left = rect.x > 0;
+  const bool seam_top = rect.y > 0;
+  const bool seam_right = rect.x + rect.width < binary.cols;
+  const bool seam_bottom = rect.y + rect.height < binary.rows;
+
+  auto touchesSeam = [&](const Rect& box) {
+    return (seam_left && box.x == 0) || (seam_top && box.y == 0) ||
+           (seam_right && box.x + box.width == rect.width) ||
+           (seam_bottom && box.y + box.height == rect.height);
+  };
+
+  // a contour nested in a component of this tile is nested in the whole image
+  // too, so only the outer ones of the tile can be in the result
+  thread_local vector<vector<Point>> found;
+  findContours(roi, found, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+  for (vector<Point>& contour : found) {
+    Rect box = boundingRect(contour);
+    vector<vector<Point>>& target = touchesSeam(box) ? tile.cut : tile.contours;
+
+    target.emplace_back(contour.size());
+    for (size_t i = 0; i < contour.size(); i++)
+      target.back()[i] = contour[i] + rect.tl();
+  }
+
+  if (tile.cut.empty())
+    return;
+
+  // a cut contour starts on the first pixel of its component, so the pieces find
+  // theirs by that point
+  thread_local unordered_map<int64_t, int> cut_at;
+  cut_at.clear();
+  for (size_t i = 0; i < tile.cut.size(); i++)
+    cut_at[pointKey(tile.cut[i][0])] = (int)i;
+
+  // labels along the edges join the pieces of a component across the seams
+  thread_local Mat labels, stats, centroids;
+  tile.labels = connectedComponentsWithStats(roi, labels, stats, centroids, 8, CV_32S);
+
+  tile.top.assign(labels.ptr<int>(0), labels.ptr<int>(0) + rect.width);
+  tile.bottom.assign(labels.ptr<int>(rect.height - 1), labels.ptr<int>(rect.height - 1) + rect.width);
+  tile.left.resize(rect.height);
+  tile.right.resize(rect.height);
+  for (int y = 0; y < rect.height; y++) {
+    tile.left[y] = labels.at<int>(y, 0);
+    tile.right[y] = labels.at<int>(y, rect.width - 1);
+  }
+
+  for (int label = 1; label < tile.labels; label++) {
+    Rect box(stats.at<int>(label, CC_STAT_LEFT), stats.at<int>(label, CC_STAT_TOP),
+             stats.at<int>(label, CC_STAT_WIDTH), stats.at<int>(label, CC_STAT_HEIGHT));
+    if ( !touchesSeam(box) )
+      continue;
+
+    const int* row = labels.ptr<int>(box.y);
+    int x = box.x;
+    while (row[x] != label)
+      x++;
+
+    const Point first = Point(x, box.y) + rect.tl();
+    auto cut = cut_at.find(pointKey(first));
+    tile.pieces.push_back({label, box + rect.tl(), first, cut != cut_at.end() ? cut->second : -1});
+  }
+}
+
+void TiledContourFinder::find(const Mat& binary, vector<vector<Point>>& contours, Point offset)
+{
+  TRACE_SPAN("contours.tiled");
+  stats_ = TiledContourStats();
+
+  const int tile_size = max(params_.tile_size, 16);
+  if ((double)binary.total() < params_.min_pixels || (binary.cols <= tile_size && binary.rows <= tile_size)) {
+    findContours(binary, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, offset);
+    stats_.tiles = 1;
+    return;
+  }
+
+  const int tile_cols = (binary.cols + tile_size - 1) / tile_size;
+  const int tile_rows = (binary.rows + tile_size - 1) / tile_size;
+  tiles_.resize(tile_cols * tile_rows);
+  stats_.tiles = (int)tiles_.size();
+
+  for (int r = 0; r < tile_rows; r++) {
+    for (int c = 0; c < tile_cols; c++) {
+      Rect rect(c * tile_size, r * tile_size, tile_size, tile_size);
+      tiles_[r * tile_cols + c].rect = rect & Rect(0, 0, binary.cols, binary.rows);
+    }
+  }
+
+  {
+    TRACE_SPAN("contours.tiles");
+    parallel_for_(Range(0, (int)tiles_.size()), [&](const Range& range) {
+      for (int i = range.start; i < range.end; i++)
+        traceTile(binary, tiles_[i]);
+    });
+  }
+
+  // union-find over the labels of every tile, 8 connected across the seams
+  vector<int> base(tiles_.size() + 1, 0);
+  for (size_t i = 0; i < tiles_.size(); i++)
+    base[i + 1] = base[i] + tiles_[i].labels;
+  parent_.resize(base.back());
+  iota(parent_.begin(), parent_.end(), 0);
+
+  for (int r = 0; r < tile_rows; r++) {
+    for (int c = 0; c < tile_cols; c++) {
+      const int a = r * tile_cols + c;
+      const Tile& tile = tiles_[a];
+      if (tile.labels == 0)
+        continue;
+
+      if (c + 1 < tile_cols && tiles_[a + 1].labels > 0) {
+        const Tile& right = tiles_[a + 1];
+        for (int y = 0; y < tile.rect.height; y++) {
+          if (tile.right[y] == 0)
+            continue;
+          for (int j = max(y - 1, 0); j <= min(y + 1, tile.rect.height - 1); j++)
+            if (right.left[j] != 0)
+              unite(parent_, base[a] + tile.right[y], base[a + 1] + right.left[j]);
+        }
+      }
+
+      if (r + 1 >= tile_rows)
+        continue;
+
+      const int b = a + tile_cols;
+      if (tiles_[b].labels > 0) {
+        const Tile& below = tiles_[b];
+        for (int x = 0; x < tile.rect.width; x++) {
+          if (tile.bottom[x] == 0)
+            continue;
+          for (int j = max(x - 1, 0); j <= min(x + 1, tile.rect.width - 1); j++)
+            if (below.top[j] != 0)
+              unite(parent_, base[a] + tile.bottom[x], base[b] + below.top[j]);
+        }
+      }
+
+      // corners touching diagonally
+      if (c + 1 < tile_cols && tiles_[b + 1].labels > 0 && tile.bottom.back() != 0 && tiles_[b + 1].top.front() != 0)
+        unite(parent_, base[a] + tile.bottom.back(), base[b + 1] + tiles_[b + 1].top.front());
+      if (c > 0 && tiles_[b - 1].labels > 0 && tile.bottom.front() != 0 && tiles_[b - 1].top.back() != 0)
+        unite(parent_, base[a] + tile.bottom.front(), base[b - 1] + tiles_[b - 1].top.back());
+    }
+  }
+
+  // pieces of the same component form one group
+  vector<SeamGroup> groups;
+  unordered_map<int, int> group_of;
+
+  for (size_t t = 0; t < tiles_.size(); t++) {
+    const Tile& tile = tiles_[t];
+    for (const Piece& piece : tile.pieces) {
+      int root = findRoot(parent_, base[t] + piece.label);
+      auto inserted = group_of.emplace(root, (int)groups.size());
+      if (inserted.second) {
+        groups.emplace_back();
+        groups.back().box = piece.box;
+        groups.back().first = piece.first;
+      }
+
+      SeamGroup& group = groups[inserted.first->second];
+      group.box |= piece.box;
+      if (piece.first.y < group.first.y || (piece.first.y == group.first.y && piece.first.x < group.first.x))
+        group.first = piece.first;
+
+      // a piece alone is the whole component, the tile traced it already
+      group.pieces++;
+      if (piece.cut >= 0)
+        group.contour = &tile.cut[piece.cut];
+    }
+  }
+
+  vector<int> joined;
+  for (int i = 0; i < (int)groups.size(); i++)
+    if (groups[i].pieces > 1)
+      joined.push_back(i);
+
+  stats_.seam_components = (int)groups.size();
+  stats_.retraced = (int)joined.size();
+
+  // the border of every joined component is followed across the seams, the walk
+  // costs the length of the border and not the area of its box
+  {
+    TRACE_SPAN("contours.seams");
+    parallel_for_(Range(0, (int)joined.size()), [&](const Range& range) {
+      for (int i = range.start; i < range.end; i++) {
+        SeamGroup& group = groups[joined[i]];
+
+        followOuterBorder(binary, group.first, group.traced);
+        rowCrossings(group.traced, group.box, group.crossings);
+        group.contour = &group.traced;
+      }
+    });
+  }
+
+  vector<Traced> result;
+  for (const Tile& tile : tiles_)
+    for (const vector<Point>& contour : tile.contours)
+      result.push_back({contour[0], &contour});
+  for (const SeamGroup& group : groups)
+    if (group.contour && !group.contour->empty())
+      result.push_back({group.first, group.contour});
+
+  // joined components listed under every tile their box overlaps, a contour only
+  // has to be tested against the ones listed under the tile of its first point
+  vector<vector<int>> joined_in(tiles_.size());
+  for (int g : joined) {
+    const Rect& box = groups[g].box;
+    for (int r = box.y / tile_size; r <= (box.y + box.height - 1) / tile_size; r++)
+      for (int c = box.x / tile_size; c <= (box.x + box.width - 1) / tile_size; c++)
+        joined_in[r * tile_cols + c].push_back(g);
+  }
+
+  // anything inside the outer border of a joined component lies in one of its
+  // holes; contours in the hole of a component of a single tile were never found
+  vector<uchar> outer(result.size(), 1);
+  parallel_for_(Range(0, (int)result.size()), [&](const Range& range) {
+    for (int i = range.start; i < range.end; i++) {
+      const Point& first = result[i].first;
+      for (int g : joined_in[(first.y / tile_size) * tile_cols + first.x / tile_size]) {
+        const SeamGroup& group = groups[g];
+        if (group.contour == result[i].contour)
+          continue;
+        if (insideBorder(group, result[i].first)) {
+          outer[i] = 0;
+          break;
+        }
+      }
+    }
+  });
+
+  size_t kept = 0;
+  for (size_t i = 0; i < result.size(); i++)
+    if (outer[i])
+      result[kept++] = result[i];
+  result.resize(kept);
+
+  // findContours lists the last border it found first
+  sort(result.begin(), result.end(), [](const Traced& a, const Traced& b) {
+    return a.first.y != b.first.y ? a.first.y > b.first.y : a.first.x > b.first.x;
+  });
+
+  contours.resize(result.size());
+  for (size_t i = 0; i < result.size(); i++) {
+    const vector<Point>& contour = *result[i].contour;
+    contours[i].resize(contour.size());
+    for (size_t j = 0; j < contour.size(); j++)
+      contours[i][j] = contour[j] + offset;
+  }
+
+  if (params_.verify)
+    compareWithReference(binary, contours, offset);
+}
+
+int TiledContourFinder::verify(const Mat& binary)
+{
+  bool verify_each_run = params_.verify;
+  params_.verify = false;
+  find(binary, checked_);
+  params_.verify = verify_each_run;
+
+  return compareWithReference(binary, checked_, Point());
+}
+
+int TiledContourFinder::compareWithReference(const Mat& binary, const vector<vector<Point>>& contours, Point offset)
+{
+  vector<vector<Point>> reference;
+  findContours(binary, reference, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, offset);
+
+  size_t common = min(reference.size(), contours.size());
+  last_mismatch_ = (int)(max(reference.size(), contours.size()) - common);
+  for (size_t i = 0; i < common; i++)
+    if (reference[i] != contours[i])
+      last_mismatch_++;
+
+  if (last_mismatch_ > 0)
+    cerr << "Tiled contour mismatch: " << last_mismatch_ << " of " << reference.size() << " contours differ from findContours" << endl;
+
+  return last_mismatch_;
+}
+
+void findExternalContours(const Mat& binary, vector<vector<Point>>& contours, Point offset)
+{
+  thread_local TiledContourFinder finder;
+  finder.find(binary, contours, offset);
+}
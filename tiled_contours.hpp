@@ -0,0 +1,96 @@
+/**
+ * @file tiled_contours.hpp
+ * @brief Outer contour extraction for very large binary images.
+ *        The image is cut into tiles traced in parallel. A contour that stays clear of
+ *        the seams between tiles is already final; components crossing a seam are
+ *        joined through their labels along the seams, and only their outer border is
+ *        followed across the seams, which costs its length and not the area it spans.
+ *        Contours inside a hole of a joined component are dropped, so the result is
+ *        the same set and order findContours gives with RETR_EXTERNAL and
+ *        CHAIN_APPROX_SIMPLE.
+ *        The input is one Mat. It can be a header over memory mapped storage: the
+ *        tiles are read one by one and the border walks only touch pages along the
+ *        borders, but there is no tile by tile streaming input.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+struct TiledContourParams {
+  int tile_size = 1024;             // tile width and height in pixels
+  double min_pixels = 4e6;          // smaller images are traced in one piece
+  bool verify = false;              // compare every run against findContours on the whole image
+};
+
+struct TiledContourStats {
+  int tiles = 0;
+  int seam_components = 0;          // components crossing a seam
+  int retraced = 0;                 // of those, spanning several tiles and followed across the seams
+};
+
+class TiledContourFinder
+{
+public:
+  explicit TiledContourFinder(const TiledContourParams& params = TiledContourParams());
+
+  /**
+   * @brief find the outer contours of a binary image
+   *
+   * @param binary CV_8UC1 image, non zero pixels are foreground
+   * @param contours outer contours, CHAIN_APPROX_SIMPLE
+   * @param offset added to every point
+   */
+  void find(const cv::Mat& binary, std::vector<std::vector<cv::Point>>& contours, cv::Point offset = cv::Point());
+
+  /**
+   * @brief verify compare a tiled run against findContours on the whole image
+   *
+   * @param binary CV_8UC1 image
+   * @return number of contours that differ, 0 when identical
+   */
+  int verify(const cv::Mat& binary);
+
+  const TiledContourStats& lastStats() const { return stats_; }
+  int lastMismatch() const { return last_mismatch_; }
+  const TiledContourParams& params() const { return params_; }
+
+private:
+  struct Piece {
+    int label;                      // label inside its tile
+    cv::Rect box;                   // image coordinates
+    cv::Point first;                // first pixel in raster order, image coordinates
+    int cut;                        // its contour in the tile's cut list, -1 when none
+  };
+
+  struct Tile {
+    cv::Rect rect;
+    std::vector<std::vector<cv::Point>> contours;   // contours clear of the seams, image coordinates
+    std::vector<std::vector<cv::Point>> cut;        // contours touching a seam, image coordinates
+    std::vector<Piece> pieces;      // components touching a seam
+    int labels = 0;                 // labels in the tile including the background, 0 when not labelled
+    std::vector<int> top, bottom, left, right;      // labels along the tile edges
+  };
+
+  void traceTile(const cv::Mat& binary, Tile& tile);
+  int compareWithReference(const cv::Mat& binary, const std::vector<std::vector<cv::Point>>& contours, cv::Point offset);
+
+  TiledContourParams params_;
+  std::vector<Tile> tiles_;
+  std::vector<int> parent_;         // union-find over the seam labels of every tile
+  std::vector<std::vector<cv::Point>> checked_;   // result of verify()
+  TiledContourStats stats_;
+  int last_mismatch_ = 0;
+};
+
+/**
+ * @brief findExternalContours findContours(binary, contours, RETR_EXTERNAL,
+ *        CHAIN_APPROX_SIMPLE, offset), tiled and parallel on large images
+ *
+ * @param binary CV_8UC1 image, non zero pixels are foreground
+ * @param contours outer contours
+ * @param offset added to every point
+ */
+void findExternalContours(const cv::Mat& binary, std::vector<std::vector<cv::Point>>& contours, cv::Point offset = cv::Point());
@@ -0,0 +1,208 @@
+/**
+ * @file trace.cpp
+ * @brief Per-thread span buffers, Chrome trace output and latency histograms.
+ *
+ */
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace trace {
+
+namespace {
+
+struct Event {
+  const char* name;
+  int64_t start;
+  int64_t end;
+};
+
+// events recorded by one thread, only that thread appends to it
+struct ThreadBuffer {
+  static constexpr size_t CAPACITY = 1 << 16;
+
+  explicit ThreadBuffer(int id) : tid(id) { events.reserve(CAPACITY); }
+
+  int tid;
+  vector<Event> events;
+  size_t next = 0;                // ring position once the buffer is full
+  atomic<size_t> overwritten{0};
+};
+
+// spans of a buffer oldest first, a full buffer wraps around at next
+template<class F>
+void forEachEvent(const ThreadBuffer& buffer, F&& visit)
+{
+  const size_t count = buffer.events.size();
+  for (size_t i = 0; i < count; i++)
+    visit(buffer.events[(buffer.next + i) % count]);
+}
+
+// written once, by trace::flush or at exit, when no thread records any more: the
+// buffers are read without the lock their owners append without
+class Registry
+{
+public:
+  ~Registry() { flush(); }
+
+  ThreadBuffer* add()
+  {
+    lock_guard<mutex> lock(mutex_);
+    buffers_.push_back(make_unique<ThreadBuffer>((int)buffers_.size()));
+    return buffers_.back().get();
+  }
+
+  void flush();
+
+private:
+  mutex mutex_;
+  vector<unique_ptr<ThreadBuffer>> buffers_;  // outlive their threads so they can be written at exit
+  bool flushed_ = false;
+};
+
+Registry& registry()
+{
+  static Registry instance;
+  return instance;
+}
+
+void writeChromeTrace(const string& path, const vector<unique_ptr<ThreadBuffer>>& buffers, int64_t origin)
+{
+  ofstream out(path);
+  if ( !out.is_open() ) {
+    cerr << "Could not write trace to " << path << endl;
+    return;
+  }
+
+  out << "{\"traceEvents\":[" << endl;
+  bool first = true;
+
+  for (const unique_ptr<ThreadBuffer>& buffer : buffers) {
+    forEachEvent(*buffer, [&](const Event& event) {
+      out << (first ? "" : ",\n")
+          << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+          << fixed << setprecision(3)
+          << ",\"ts\":" << (event.start - origin) / 1000.0
+          << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+      first = false;
+    });
+  }
+
+  out << endl << "],\"displayTimeUnit\":\"ms\"}" << endl;
+  cout << "Trace written to " << path << endl;
+}
+
+/**
+ * @brief printHistograms prints the latency distribution of every span name,
+ *        buckets are powers of two in microseconds
+ */
+void printHistograms(const vector<unique_ptr<ThreadBuffer>>& buffers)
+{
+  map<string, vector<int64_t>> stages;
+  for (const unique_ptr<ThreadBuffer>& buffer : buffers)
+    forEachEvent(*buffer, [&](const Event& event) { stages[event.name].push_back(event.end - event.start); });
+
+  cout << endl << "Stage latency (ms)" << endl;
+  cout << left << setw(24) << "stage" << right << setw(8) << "count" << setw(10) << "mean"
+       << setw(10) << "p50" << setw(10) << "p99" << setw(10) << "max" << endl;
+
+  for (auto& [name, durations] : stages) {
+    sort(durations.begin(), durations.end());
+
+    double sum = 0;
+    for (int64_t d : durations)
+      sum += d;
+
+    auto percentile = [&](double p) {
+      return durations[min(durations.size() - 1, (size_t)(p * durations.size()))] / 1e6;
+    };
+
+    cout << left << setw(24) << name << right << setw(8) << durations.size()
+         << fixed << setprecision(3)
+         << setw(10) << sum / durations.size() / 1e6
+         << setw(10) << percentile(0.5)
+         << setw(10) << percentile(0.99)
+         << setw(10) << durations.back() / 1e6 << endl;
+
+    vector<size_t> buckets;
+    for (int64_t d : durations) {
+      size_t bucket = 0;
+      for (int64_t us = d / 1000; us > 1; us >>= 1)
+        bucket++;
+      if (bucket >= buckets.size())
+        buckets.resize(bucket + 1, 0);
+      buckets[bucket]++;
+    }
+
+    for (size_t b = 0; b < buckets.size(); b++) {
+      if (buckets[b] == 0)
+        continue;
+      cout << "    <" << setw(8) << (1 << (b + 1)) << " us " << string(max<size_t>(1, buckets[b] * 40 / durations.size()), '#')
+           << " " << buckets[b] << endl;
+    }
+  }
+}
+
+void Registry::flush()
+{
+  lock_guard<mutex> lock(mutex_);
+  if (flushed_)
+    return;
+  flushed_ = true;
+
+  int64_t origin = INT64_MAX;
+  size_t total = 0;
+  size_t overwritten = 0;
+  for (const unique_ptr<ThreadBuffer>& buffer : buffers_) {
+    for (const Event& event : buffer->events)
+      origin = min(origin, event.start);
+    total += buffer->events.size();
+    overwritten += buffer->overwritten;
+  }
+
+  if (total == 0)
+    return;
+
+  const char* path = getenv("TRACE_FILE");
+  writeChromeTrace(path ? path : "trace.json", buffers_, origin);
+  printHistograms(buffers_);
+
+  if (overwritten > 0)
+    cout << overwritten << " oldest spans were overwritten" << endl;
+}
+
+} // namespace
+
+void flush()
+{
+  registry().flush();
+}
+
+void record(const char* name, int64_t start_ns, int64_t end_ns)
+{
+  thread_local ThreadBuffer* buffer = registry().add();
+
+  // bounded: once full, keep the most recent spans
+  if (buffer->events.size() < ThreadBuffer::CAPACITY) {
+    buffer->events.push_back({name, start_ns, end_ns});
+  } else {
+    buffer->events[buffer->next] = {name, start_ns, end_ns};
+    buffer->next = (buffer->next + 1) % ThreadBuffer::CAPACITY;
+    buffer->overwritten.fetch_add(1, memory_order_relaxed);
+  }
+}
+
+} // namespace trace
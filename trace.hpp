@@ -0,0 +1,69 @@
+/**
+ * @file trace.hpp
+ * @brief Low overhead per-stage tracing.
+ *        TRACE_SPAN records a scoped span into a buffer owned by the calling thread,
+ *        so recording never takes a lock. trace::flush, or failing that the exit,
+ *        writes the spans as a Chrome/Perfetto trace (trace.json, or the path in
+ *        TRACE_FILE) and prints per-stage latency histograms.
+ *        Spans only exist when built with ENABLE_TRACING (cmake -DCV_TRACING=ON),
+ *        otherwise the macros expand to nothing.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace trace {
+
+// monotonic timestamp in nanoseconds, also used to stamp captured frames
+inline int64_t now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief record a finished span for the calling thread
+ *
+ * @param name span name, must be a string literal
+ * @param start_ns start timestamp
+ * @param end_ns end timestamp
+ */
+void record(const char* name, int64_t start_ns, int64_t end_ns);
+
+/**
+ * @brief flush write the trace and the histograms now, only the first call writes.
+ *        Call it once every recording thread is joined: the buffers are read without
+ *        a lock, and a process killed by a signal never runs the exit handler.
+ */
+void flush();
+
+class Span
+{
+public:
+  explicit Span(const char* name) : name_(name), start_(now()) {}
+  ~Span() { record(name_, start_, now()); }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+private:
+  const char* name_;
+  int64_t start_;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef ENABLE_TRACING
+  #define TRACE_SPAN(name) trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name)
+  // span from a frame's capture timestamp to now, the frame's end to end latency
+  #define TRACE_LATENCY(name, capture_ns) trace::record(name, capture_ns, trace::now())
+#else
+  #define TRACE_SPAN(name) ((void)0)
+  #define TRACE_LATENCY(name, capture_ns) ((void)0)
+#endif
@@ -0,0 +1,165 @@
+/**
+ * @file video_job.cpp
+ * @brief Offline processing of a video file split into segments.
+ *
+ */
+
+#include "video_job.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iostream>
+
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+using namespace std;
+
+/**
+ * @brief seekTo move the capture to a frame. Backends land on the preceding keyframe
+ *        and decode forward, but some stop short or overshoot: the position is read
+ *        back, a short landing is grabbed forward and an overshoot is an error.
+ *
+ * @return false when the capture could not be put on the frame
+ */
+static bool seekTo(VideoCapture& cap, size_t frame_index)
+{
+  cap.set(CAP_PROP_POS_FRAMES, (double)frame_index);
+
+  // a backend that cannot report the position is taken at its word
+  double landed = cap.get(CAP_PROP_POS_FRAMES);
+  if (landed < 0)
+    return true;
+
+  size_t position = (size_t)landed;
+  if (position > frame_index) {
+    cerr << "Seek to frame " << frame_index << " landed on frame " << position << ", segment skipped" << endl;
+    return false;
+  }
+
+  for (; position < frame_index; position++) {
+    if ( !cap.grab() ) {
+      cerr << "Seek to frame " << frame_index << " ended at frame " << position << endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief processSegment decodes frames [start, end) and processes every stride-th one.
+ *        Skipped frames are only grabbed, never converted.
+ *
+ * @param position frame the capture is on, SIZE_MAX when unknown; a segment that
+ *        follows on from the previous one is read without seeking
+ * @return size_t number of processed frames
+ */
+static size_t processSegment(VideoCapture& cap, size_t& position, size_t start, size_t end, int stride, const FrameProcessor& process, Mat& frame)
+{
+  TRACE_SPAN("video.segment");
+
+  if (position != start && !seekTo(cap, start)) {
+    position = SIZE_MAX;
+    return 0;
+  }
+  position = start;
+
+  size_t processed = 0;
+  for (size_t i = start; i < end; i++) {
+    if (i % stride != 0) {
+      if ( !cap.grab() )
+        break;
+      position++;
+      continue;
+    }
+
+    if ( !cap.read(frame) )
+      break;
+    position++;
+
+    process(i, frame);
+    processed++;
+  }
+
+  // a failed read leaves the capture somewhere past the end
+  if (position != end)
+    position = SIZE_MAX;
+
+  return processed;
+}
+
+VideoJobStats runVideoSegments(const string& path, const VideoJobOptions& options, const function<FrameProcessor(size_t worker)>& make_processor)
+{
+  VideoJobStats stats;
+
+  VideoCapture probe(path);
+  if ( !probe.isOpened() ) {
+    cout << "Could not open video: " << path << endl;
+    return stats;
+  }
+  int frame_count = (int)probe.get(CAP_PROP_FRAME_COUNT);
+  probe.release();
+
+  const int stride = max(options.stride, 1);
+  size_t num_workers = options.workers > 0 ? options.workers : max(1u, thread::hardware_concurrency());
+
+  // without a frame count the file can only be read front to back
+  vector<pair<size_t, size_t>> segments;
+  if (frame_count <= 0) {
+    num_workers = 1;
+    segments.push_back({0, SIZE_MAX});
+  } else {
+    stats.frames = frame_count;
+    size_t num_segments = min<size_t>(num_workers * max(options.segments_per_worker, 1), frame_count);
+    for (size_t s = 0; s < num_segments; s++)
+      segments.push_back({frame_count * s / num_segments, frame_count * (s + 1) / num_segments});
+    num_workers = min(num_workers, num_segments);
+  }
+
+  stats.segments = segments.size();
+  stats.workers = num_workers;
+
+  // parallelism comes from the segments, keep each worker on one core
+  int previous_threads = getNumThreads();
+  setNumThreads(1);
+
+  atomic<size_t> next_segment{0};
+  atomic<size_t> processed{0};
+  auto start = chrono::steady_clock::now();
+
+  {
+    ThreadPool pool(num_workers);
+    vector<future<void>> workers;
+
+    for (size_t w = 0; w < num_workers; w++) {
+      workers.push_back(pool.submit([&, w]() {
+        VideoCapture cap(path);
+        if ( !cap.isOpened() )
+          return;
+
+        FrameProcessor process = make_processor(w);
+        Mat frame;
+        size_t position = 0;
+
+        for (size_t s = next_segment++; s < segments.size(); s = next_segment++)
+          processed += processSegment(cap, position, segments[s].first, segments[s].second, stride, process, frame);
+      }));
+    }
+
+    for (future<void>& worker : workers)
+      worker.get();
+  }
+
+  setNumThreads(previous_threads);
+
+  stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  stats.processed = processed;
+  if (stats.frames == 0)
+    stats.frames = stats.processed * stride;
+
+  return stats;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file video_job.hpp
+ * @brief Offline processing of a video file split into segments.
+ *        Each worker opens its own VideoCapture and builds its own processor, the
+ *        segments are handed out on demand and the per-frame results are merged
+ *        back in frame order.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct VideoJobOptions {
+  int workers = 0;                // 0 uses the hardware concurrency
+  int stride = 1;                 // process every Nth frame of the file
+  int segments_per_worker = 4;    // more segments even out slow and fast parts of the video
+};
+
+struct VideoJobStats {
+  size_t frames = 0;              // frames in the file
+  size_t processed = 0;           // frames handed to a processor
+  size_t segments = 0;
+  size_t workers = 0;
+  double seconds = 0;
+  double fps() const { return seconds > 0 ? processed / seconds : 0; }
+};
+
+// called for every processed frame with its index in the file
+typedef std::function<void(size_t frame_index, const cv::Mat& frame)> FrameProcessor;
+
+/**
+ * @brief runVideoSegments run one processor per worker over the segments of a video
+ *
+ * @param path video file
+ * @param options job options
+ * @param make_processor builds the processor of a worker, called once on the worker's thread
+ * @return VideoJobStats job statistics, frames is 0 when the video could not be opened
+ */
+VideoJobStats runVideoSegments(
+  const std::string& path,
+  const VideoJobOptions& options,
+  const std::function<FrameProcessor(size_t worker)>& make_processor
+);
+
+/**
+ * @brief runVideoJob run a per-frame job over a video in parallel and collect the
+ *        results in frame order
+ *
+ * @param path video file
+ * @param options job options
+ * @param make_job builds the job of a worker, a callable taking a frame and returning a Result
+ * @param results (frame index, result) pairs in frame order
+ * @return VideoJobStats job statistics
+ */
+template <typename Result, typename MakeJob>
+VideoJobStats runVideoJob(
+  const std::string& path,
+  const VideoJobOptions& options,
+  MakeJob make_job,
+  std::vector<std::pair<size_t, Result>>& results)
+{
+  // every worker collects into its own list, merged by frame index afterwards
+  std::vector<std::vector<std::pair<size_t, Result>>> worker_results(
+    options.workers > 0 ? options.workers : std::max(1u, std::thread::hardware_concurrency()));
+
+  VideoJobStats stats = runVideoSegments(path, options, [&](size_t worker) -> FrameProcessor {
+    auto job = make_job(worker);
+    std::vector<std::pair<size_t, Result>>* collected = &worker_results[worker];
+    return [collected, job](size_t frame_index, const cv::Mat& frame) mutable {
+      collected->emplace_back(frame_index, job(frame));
+    };
+  });
+
+  results.clear();
+  for (std::vector<std::pair<size_t, Result>>& collected : worker_results)
+    std::move(collected.begin(), collected.end(), std::back_inserter(results));
+
+  std::sort(results.begin(), results.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  return stats;
+}
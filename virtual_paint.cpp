@@ -7,7 +7,9 @@
  *      1. click on a marker to pick color and fine tune color range
  *      2. start painting
  *      3. to add another marker, click on a different color
- *      4. press 'q' to quit
+ *      4. press 'c' to clear the canvas
+ *      5. press 'q' to quit
+ *      --source <spec> paints over another source than camera 0, see openSource
  * 
  * @date 2024-12-28
  * 
@@ -19,19 +21,20 @@
 #include <opencv2/highgui.hpp>
 #include <iostream>
 
+#include "frame_pool.hpp"
+#include "frame_source.hpp"
+#include "hsv_tuner.hpp"
+#include "marker_classifier.hpp"
+#include "overlay.hpp"
+#include "paint.hpp"
+#include "trace.hpp"
+
 
 using namespace std;
 using namespace cv;
 
 bool debug = true;
 
-typedef struct marker {
-  Scalar color;
-  Scalar min_color_range;
-  Scalar max_color_range;
-  vector<Point> pen_tip;
-} Marker;
-
 Mat img;      // Global image variable for persistence across functions
 
 /**
@@ -63,24 +66,16 @@ void mouseCallback(int event, int xPos, int yPos, int flags, void* userdata) {
 Marker colorPicker(Mat& img, Point mouse_click_pos)
 {
   Marker marker;
-  int h_min = 0, s_min = 0, v_min = 0;
-  int h_max = 179, s_max = 255, v_max = 255;
   int avg_b = 0, avg_g = 0, avg_r = 0;
   int no_pixels = 0;
 
   Scalar avg_bgr(0,0,0);
 
-  Mat img_hsv, mask;
-
   namedWindow("Finetune color", WINDOW_AUTOSIZE);
 
   // Create trackbars to fine tune color range
-  createTrackbar("Hue_min", "Finetune color", &h_min, 179);
-  createTrackbar("Hue_max", "Finetune color", &h_max, 179);
-  createTrackbar("Sat_min", "Finetune color", &s_min, 255);
-  createTrackbar("Sat_max", "Finetune color", &s_max, 255);
-  createTrackbar("Val_min", "Finetune color", &v_min, 255);
-  createTrackbar("Val_max", "Finetune color", &v_max, 255);
+  HsvTuner tuner("Finetune color");
+  tuner.createTrackbars();
 
   // grow the point to a bounding box
   int bbox_size = 10;
@@ -113,139 +108,90 @@ Marker colorPicker(Mat& img, Point mouse_click_pos)
 
   // Fine tune hsv values
 
-  int offset = 25;
-  while (true) {
-    // Conver RGB to HSV
-    cvtColor(img, img_hsv, COLOR_BGR2HSV);
-
-    Scalar lower(h_min, s_min, v_min);
-    Scalar upper(h_max, s_max, v_max);
+  // Conver RGB to HSV once, the mask is only recomputed when a trackbar moves
+  tuner.setImage(img);
 
-    inRange(img_hsv, lower, upper, mask);
-
-    imshow("Finetune color", mask);
+  while (true) {
+    if (tuner.update())
+      imshow("Finetune color", tuner.mask());
 
-    if ( waitKey(1) == 'n' ) {
+    if ( waitKey(15) == 'n' ) {
       destroyWindow("Finetune color");
       break;
     }
   }
 
+  HsvRange range = tuner.range();
   marker.color = avg_bgr;
-  marker.min_color_range = Scalar(h_min, s_min, v_min);
-  marker.max_color_range = Scalar(h_max, s_max, v_max);
+  marker.min_color_range = range.lower();
+  marker.max_color_range = range.upper();
 
   return marker;
 }
 
-/**
- * @brief getPenTip function to get pen tip from image
- * 
- * @param marker marker object
- */
-void getPenTip(Marker *marker)
+int main(int argc, char** argv)
 {
-  vector<vector<Point>> contours;
-  vector<Vec4i> heirarchy;
-
-  Mat mask;
-  Mat img_hsv;
-
-  // Conver RGB to HSV and get contours, then mask, then bounding rect, then pen tip
-  cvtColor(img, img_hsv, COLOR_BGR2HSV);
-
-  inRange(img_hsv, marker->min_color_range, marker->max_color_range, mask);
-
-  findContours(mask, contours, heirarchy, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
-  if (contours.size() == 0) return;
-
-  vector<vector<Point>> min_polygon(contours.size());   // Minimum bounding box poligon, used to predict shape
-  vector<Rect> bounding_rect(contours.size());
-  
-  Point pen_tip(0, 0);
-
-  for (int i = 0; i < contours.size(); i++) {
-
-    double area = contourArea(contours[i]);
-    double perimeter = arcLength(contours[i], true);
-
-    // skip small contours
-    if (area < 1000)
-      continue;
-    
-    // Find minimum polygon
-    approxPolyDP(contours[i], min_polygon[i], 0.02*perimeter, true);
-    
-    // find minimum bounding rect; can be gotten from contour directly too
-    bounding_rect[i] = boundingRect(min_polygon[i]);
-
-    if (debug) drawContours(img, min_polygon, i, Scalar(0, 0, 255), 2);
-
-    // get pen tip from bounding rect
-    pen_tip.x = bounding_rect[i].x + bounding_rect[i].width / 2;  // center of bounding rect width
-    pen_tip.y = bounding_rect[i].y;                               // top of bounding rect
-
-    // draw crossair at pen tip
-    line(img, Point(pen_tip.x - 10, pen_tip.y), Point(pen_tip.x + 10, pen_tip.y), Scalar(0, 255, 0), 1);
-    line(img, Point(pen_tip.x, pen_tip.y - 10), Point(pen_tip.x, pen_tip.y + 10), Scalar(0, 255, 0), 1);
-
-    marker->pen_tip.push_back(pen_tip);
-  }
-}
-
-void drawPaint(Marker marker)
-{
-  if (marker.pen_tip.size() == 0) return;
-
-  for (int i = 0; i < marker.pen_tip.size(); i++) {
-    // pop empty pen tip
-    if (marker.pen_tip[i].x == 0 && marker.pen_tip[i].y == 0) {
-      marker.pen_tip.pop_back();
-      continue;
-    }
-    
-    // draw line from previous pen tip to current pen tip
-    if (i > 0 && (marker.pen_tip[i-1].x > 0 && marker.pen_tip[i].x > 0))
-      line(img, marker.pen_tip[i-1], marker.pen_tip[i], marker.color, 2);
-  }
-}
-
-int main()
-{
-  int camera_index = 0;
-  VideoCapture cap(camera_index);
+  string source = "0";
+  for (int i = 1; i < argc; i++)
+    if (string(argv[i]) == "--source" && i + 1 < argc)
+      source = argv[++i];
+
+  unique_ptr<FrameSource> cap = openSource(source);
+  if ( !cap->isOpened() )
+    return -1;
   vector<Marker> markers;
-  vector<Point> pen_tips;
+  MarkerClassifier classifier;
+  PaintCanvas canvas;
+  OverlayBuffer overlay;
   Point mouse_click_pos;
 
   namedWindow("Virtual canvas", WINDOW_AUTOSIZE);
   setMouseCallback("Virtual canvas", mouseCallback, &mouse_click_pos);
 
-  while(true) {
-    cap.read(img);
-    
+  while(cap->read(img)) {
+    // per frame temporaries come from the pool and go back at the end of the frame
+    FrameScope frame_scope(true);
+    makeWritable(img);
+
     // Add markers
     if ( mouse_click_pos.x > 0 && mouse_click_pos.y > 0 ) {
       markers.push_back( colorPicker(img, mouse_click_pos) );
+      classifier.build(markers);
 
       // reset mouse click position
       mouse_click_pos.x = 0;
       mouse_click_pos.y = 0;
     }
 
-    // Paint on canvas
+    // Paint on canvas, one labelling pass serves every marker and only the
+    // new stroke segments are drawn into the persistent canvas layer
+    classifier.classify(img);
     for (int i = 0; i < markers.size(); i++) {
-      getPenTip(&markers[i]);
-      drawPaint(markers[i]);
+      getPenTip(classifier, i, &markers[i], overlay, debug);
+      canvas.addStrokes(i, markers[i], img.size());
+
+      // a marker out of sight starts a new stroke when it comes back
+      if (markers[i].pen_tip.empty())
+        canvas.penUp(i);
 
       if (debug) cout << "Pen tip[" << i << "]: " << markers[i].pen_tip << endl;
     }
+    // crossairs of every marker in one pass, under the paint
+    renderOverlay(overlay, img);
+    overlay.clear();
+    canvas.composite(img);
 
     imshow("Virtual canvas", img);
 
-    if ( waitKey(1) == 'q' )
+    char key = (char)waitKey(1);
+    if ( key == 'q' )
       break;
+    if ( key == 'c' )
+      canvas.clear();
   }
 
+  if (debug) printFramePoolStats(FramePool::shared().stats());
+
+  trace::flush();
   return  0;
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+/**
+ * @file warp_engine.cpp
+ * @brief Perspective warping with cached fixed-point remap tables.
+ *
+ */
+
+#include "warp_engine.hpp"
+
+#include <climits>
+
+using namespace cv;
+using namespace std;
+
+WarpEngine::WarpEngine(float quantization, size_t cache_size, int band_rows)
+  : quantization_(quantization > 0 ? quantization : 1.0f),
+    cache_size_(max<size_t>(cache_size, 1)),
+    band_rows_(max(band_rows, 1))
+{
+}
+
+WarpEngine::Entry& WarpEngine::lookup(const vector<Point2f>& corners, Size size, int crop)
+{
+  vector<Point> key;
+  for (const Point2f& corner : corners)
+    key.push_back(Point(cvRound(corner.x / quantization_), cvRound(corner.y / quantization_)));
+
+  use_counter_++;
+
+  for (Entry& entry : cache_) {
+    if (entry.key == key && entry.size == size && entry.crop == crop) {
+      entry.last_used = use_counter_;
+      last_cached_ = true;
+      return entry;
+    }
+  }
+
+  // evict the least recently used entry once the cache is full
+  Entry* entry;
+  if (cache_.size() < cache_size_) {
+    cache_.emplace_back();
+    entry = &cache_.back();
+  } else {
+    entry = &*min_element(cache_.begin(), cache_.end(), [](const Entry& a, const Entry& b) {
+      return a.last_used < b.last_used;
+    });
+  }
+
+  entry->key = key;
+  entry->size = size;
+  entry->crop = crop;
+  entry->last_used = use_counter_;
+  buildMaps(*entry, corners);
+
+  last_cached_ = false;
+  rebuilds_++;
+
+  return *entry;
+}
+
+/**
+ * @brief buildMaps computes the fixed-point source coordinates of every output pixel
+ *        the same way warpPerspective does internally, but only for the cropped region
+ */
+void WarpEngine::buildMaps(Entry& entry, const vector<Point2f>& corners)
+{
+  const float width = (float)entry.size.width;
+  const float height = (float)entry.size.height;
+  const int crop = entry.crop;
+  const Size cropped(entry.size.width - 2 * crop, entry.size.height - 2 * crop);
+
+  Point2f src_coord[4] = {corners[0], corners[1], corners[2], corners[3]};
+  Point2f dest_coord[4] = {
+    {0.0f, 0.0f},
+    {width, 0.0f},
+    {0.0f, height},
+    {width, height}
+  };
+
+  // output to input mapping
+  Mat matrix = getPerspectiveTransform(src_coord, dest_coord);
+  Mat inverse;
+  invert(matrix, inverse);
+  const double* M = inverse.ptr<double>();
+
+  entry.map_xy.create(cropped, CV_16SC2);
+  entry.map_alpha.create(cropped, CV_16UC1);
+
+  parallel_for_(Range(0, cropped.height), [&](const Range& rows) {
+    for (int row = rows.start; row < rows.end; row++) {
+      short* xy = entry.map_xy.ptr<short>(row);
+      ushort* alpha = entry.map_alpha.ptr<ushort>(row);
+      int y = row + crop;
+
+      double X0 = M[1] * y + M[2];
+      double Y0 = M[4] * y + M[5];
+      double W0 = M[7] * y + M[8];
+
+      for (int col = 0; col < cropped.width; col++) {
+        int x = col + crop;
+
+        double W = W0 + M[6] * x;
+        W = W ? INTER_TAB_SIZE / W : 0;
+        double fX = max((double)INT_MIN, min((double)INT_MAX, (X0 + M[0] * x) * W));
+        double fY = max((double)INT_MIN, min((double)INT_MAX, (Y0 + M[3] * x) * W));
+        int X = saturate_cast<int>(fX);
+        int Y = saturate_cast<int>(fY);
+
+        xy[col * 2] = saturate_cast<short>(X >> INTER_BITS);
+        xy[col * 2 + 1] = saturate_cast<short>(Y >> INTER_BITS);
+        alpha[col] = (ushort)((Y & (INTER_TAB_SIZE - 1)) * INTER_TAB_SIZE + (X & (INTER_TAB_SIZE - 1)));
+      }
+    }
+  });
+}
+
+void WarpEngine::warp(const Mat& input, const vector<Point2f>& corners, Size size, int crop, Mat& output)
+{
+  CV_Assert(corners.size() == 4);
+  crop = max(crop, 0);
+
+  const Size cropped(size.width - 2 * crop, size.height - 2 * crop);
+  if (cropped.width <= 0 || cropped.height <= 0) {
+    output.release();
+    return;
+  }
+
+  Entry& entry = lookup(corners, size, crop);
+
+  // write straight into the caller's buffer, band by band
+  output.create(cropped, input.type());
+  const int num_bands = (cropped.height + band_rows_ - 1) / band_rows_;
+
+  parallel_for_(Range(0, num_bands), [&](const Range& bands) {
+    for (int band = bands.start; band < bands.end; band++) {
+      int start = band * band_rows_;
+      int end = min(start + band_rows_, cropped.height);
+
+      Mat output_band = output.rowRange(start, end);
+      remap(
+        input,
+        output_band,
+        entry.map_xy.rowRange(start, end),
+        entry.map_alpha.rowRange(start, end),
+        INTER_LINEAR,
+        BORDER_CONSTANT
+      );
+    }
+  });
+}
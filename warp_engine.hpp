@@ -0,0 +1,63 @@
+/**
+ * @file warp_engine.hpp
+ * @brief Perspective warping with cached fixed-point remap tables.
+ *        The tables are keyed on the quantized source quad, output size and crop,
+ *        so a stable quad costs a single remap per frame. Only the cropped region is
+ *        computed and the warp is split across threads in row bands.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+class WarpEngine
+{
+public:
+  /**
+   * @brief Construct a new Warp Engine
+   *
+   * @param quantization corner movements below this many pixels reuse the cached tables
+   * @param cache_size number of cached table sets
+   * @param band_rows rows per band of the parallel warp
+   */
+  explicit WarpEngine(float quantization = 0.25f, size_t cache_size = 4, int band_rows = 64);
+
+  /**
+   * @brief warp the quad of input to a size x size rectangle, cropped by crop pixels on every side
+   *
+   * @param input input image
+   * @param corners source corners: top left, top right, bottom left, bottom right
+   * @param size output size before cropping
+   * @param crop pixels removed from every side
+   * @param output caller provided output buffer, reallocated only when the size changes
+   */
+  void warp(const cv::Mat& input, const std::vector<cv::Point2f>& corners, cv::Size size, int crop, cv::Mat& output);
+
+  bool lastWasCached() const { return last_cached_; }
+  uint64_t rebuilds() const { return rebuilds_; }
+
+private:
+  struct Entry {
+    std::vector<cv::Point> key;     // corners in units of the quantization step
+    cv::Size size;
+    int crop = 0;
+    cv::Mat map_xy;                 // CV_16SC2 integer source coordinates
+    cv::Mat map_alpha;              // CV_16UC1 interpolation table index
+    uint64_t last_used = 0;
+  };
+
+  Entry& lookup(const std::vector<cv::Point2f>& corners, cv::Size size, int crop);
+  void buildMaps(Entry& entry, const std::vector<cv::Point2f>& corners);
+
+  float quantization_;
+  size_t cache_size_;
+  int band_rows_;
+
+  std::vector<Entry> cache_;
+  uint64_t use_counter_ = 0;
+  uint64_t rebuilds_ = 0;
+  bool last_cached_ = false;
+};
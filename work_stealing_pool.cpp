@@ -0,0 +1,141 @@
+/**
+ * @file work_stealing_pool.cpp
+ * @brief Pool of worker threads with one task deque per worker.
+ *
+ */
+
+#include "work_stealing_pool.hpp"
+
+#ifdef _WIN32
+  #define NOMINMAX
+  #include <windows.h>
+#elif defined(__linux__)
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+using namespace std;
+
+// index of the pool worker running on this thread, used to keep follow-up tasks local
+static thread_local const WorkStealingPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+static void pinToCore(thread& worker, size_t core)
+{
+#ifdef _WIN32
+  SetThreadAffinityMask(worker.native_handle(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core % CPU_SETSIZE, &cpus);
+  pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus);
+#else
+  (void)worker;
+  (void)core;
+#endif
+}
+
+WorkStealingPool::WorkStealingPool(size_t num_threads, bool pin_cores)
+{
+  if (num_threads == 0)
+    num_threads = max(1u, thread::hardware_concurrency());
+
+  for (size_t i = 0; i < num_threads; i++)
+    workers_.push_back(make_unique<Worker>());
+
+  size_t cores = max(1u, thread::hardware_concurrency());
+  for (size_t i = 0; i < num_threads; i++) {
+    workers_[i]->thread = thread(&WorkStealingPool::workerLoop, this, i);
+    if (pin_cores)
+      pinToCore(workers_[i]->thread, i % cores);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+  {
+    lock_guard<mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  task_ready_.notify_all();
+
+  for (unique_ptr<Worker>& worker : workers_)
+    worker->thread.join();
+}
+
+void WorkStealingPool::submit(function<void()> task, size_t worker)
+{
+  if (worker == ANY_WORKER)
+    worker = current_pool == this ? current_worker : next_worker_++;
+  worker %= workers_.size();
+
+  {
+    lock_guard<mutex> lock(workers_[worker]->mutex);
+    workers_[worker]->tasks.push_back(move(task));
+  }
+
+  {
+    lock_guard<mutex> lock(sleep_mutex_);
+    pending_++;
+  }
+  // any idle worker will do, it steals the task if it is not its own
+  task_ready_.notify_one();
+}
+
+/**
+ * @brief popTask takes the newest task of the worker itself, or else the oldest
+ *        task of the first other worker that has one
+ */
+bool WorkStealingPool::popTask(size_t index, function<void()>& task)
+{
+  {
+    Worker& own = *workers_[index];
+    lock_guard<mutex> lock(own.mutex);
+    if ( !own.tasks.empty() ) {
+      task = move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+
+  for (size_t offset = 1; offset < workers_.size(); offset++) {
+    Worker& victim = *workers_[(index + offset) % workers_.size()];
+    lock_guard<mutex> lock(victim.mutex);
+    if ( !victim.tasks.empty() ) {
+      task = move(victim.tasks.front());
+      victim.tasks.pop_front();
+      stolen_++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief workerLoop runs tasks until the pool is destroyed,
+ *        pending tasks are drained before the workers exit
+ */
+void WorkStealingPool::workerLoop(size_t index)
+{
+  current_pool = this;
+  current_worker = index;
+
+  while (true) {
+    {
+      unique_lock<mutex> lock(sleep_mutex_);
+      task_ready_.wait(lock, [this]() { return stopping_ || pending_ > 0; });
+
+      if (pending_ == 0)
+        return;
+      pending_--;
+    }
+
+    // a pending task is reserved for this worker, it is in one of the deques
+    function<void()> task;
+    while ( !popTask(index, task) )
+      this_thread::yield();
+
+    task();
+  }
+}
@@ -0,0 +1,68 @@
+/**
+ * @file work_stealing_pool.hpp
+ * @brief Pool of worker threads with one task deque per worker.
+ *        A worker runs its own tasks newest first and steals the oldest task of
+ *        another worker once its deque is empty, so tasks submitted with an
+ *        affinity stay on their worker unless it falls behind.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+public:
+  static constexpr size_t ANY_WORKER = SIZE_MAX;
+
+  /**
+   * @brief Construct a new Work Stealing Pool
+   *
+   * @param num_threads number of workers, 0 uses the hardware concurrency
+   * @param pin_cores pin worker i to core i
+   */
+  explicit WorkStealingPool(size_t num_threads = 0, bool pin_cores = false);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  /**
+   * @brief submit a task
+   *
+   * @param task callable taking no arguments
+   * @param worker preferred worker, ANY_WORKER picks the calling worker or the next one in turn
+   */
+  void submit(std::function<void()> task, size_t worker = ANY_WORKER);
+
+  size_t size() const { return workers_.size(); }
+  uint64_t stolen() const { return stolen_; }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+    std::thread thread;
+  };
+
+  void workerLoop(size_t index);
+  bool popTask(size_t index, std::function<void()>& task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> pending_{0};
+  std::atomic<size_t> next_worker_{0};
+  std::atomic<uint64_t> stolen_{0};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable task_ready_;
+  bool stopping_ = false;
+};